@@ -0,0 +1,41 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief The allocator of the trusted library; since the library replaces
+ *        the global `operator new` and `operator delete` (including the
+ *        over-aligned ones, which are padded), it's used by all dynamic
+ *        allocations (e.g., the block-flow graphs, and the exprs of the
+ *        module)
+*/
+struct AllocatorHooks
+{
+	// Allocate `size` bytes aligned for any scalar type;
+	// return nullptr on failure
+	void* (*m_alloc)(size_t size, void* userData);
+	void (*m_free)(void* ptr, void* userData);
+	void* m_userData;
+}; // struct AllocatorHooks
+
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+
+/**
+ * @brief Replace the allocator, which is `malloc` and `free` by default.
+ *        It must be called before anything is allocated (e.g., when the
+ *        enclave is initialized), since memory is always freed by the
+ *        current hooks.
+*/
+void SetAllocatorHooks(const AllocatorHooks& hooks) noexcept;
+
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+} // namespace DecentWasmCounter
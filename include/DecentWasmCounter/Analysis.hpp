@@ -0,0 +1,74 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Static cost of a function, as it would be charged by the block
+ *        counters; each weight vector has one weight per cost dimension
+*/
+struct FuncAnalysis
+{
+	FuncAnalysis() :
+		m_funcIdx(0),
+		m_numBlocks(0),
+		m_numLoops(0),
+		m_maxLoopDepth(0),
+		m_minPathWeights(),
+		m_maxPathWeights(),
+		m_staticWeights()
+	{}
+
+	uint32_t m_funcIdx;
+
+	// Number of blocks in the block-flow graph
+	uint64_t m_numBlocks;
+
+	// Number of loops in the function
+	uint64_t m_numLoops;
+
+	// Maximum nesting depth of loops (0 if the function is loop-free)
+	uint64_t m_maxLoopDepth;
+
+	// Minimum and maximum total weights of blocks along an acyclic path from
+	// the function entry, which ends when the function returns or when a
+	// loop starts its next iteration;
+	// each dimension is bounded independently
+	std::vector<uint64_t> m_minPathWeights;
+	std::vector<uint64_t> m_maxPathWeights;
+
+	// Sum of weights of all reachable blocks
+	std::vector<uint64_t> m_staticWeights;
+}; // struct FuncAnalysis
+
+struct ModuleAnalysis
+{
+	ModuleAnalysis() :
+		m_funcs()
+	{}
+
+	// One entry per function defined in the module (imports are excluded)
+	std::vector<FuncAnalysis> m_funcs;
+}; // struct ModuleAnalysis
+
+/**
+ * @brief Output format of `ExportGraph()`
+*/
+enum class GraphFormat
+{
+	// Graphviz DOT
+	Dot,
+	// One JSON object per function
+	Json,
+}; // enum class GraphFormat
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,113 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "CostModel.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Type of an edge in the block-flow graph
+*/
+enum class BlockEdgeType : uint8_t
+{
+	Normal      = 0, // Branch that doesn't involve loop
+	IntoLoop    = 1, // Branch into the loop (i.e., the next iteration)
+	OutOfLoop   = 2, // Branch out of the loop
+	IntoHandler = 3, // Exception caught by a handler in the same function
+}; // enum class BlockEdgeType
+
+struct BlockTableEdge
+{
+	// Index of the child block in FuncBlockTable::m_blocks
+	uint64_t m_childIdx;
+	BlockEdgeType m_type;
+}; // struct BlockTableEdge
+
+/**
+ * @brief A block in the block-flow graph, and where its weights should be
+ *        charged.
+ *        Instructions are identified by their ordinals in the function body,
+ *        in the order they are decoded, starting from 0 and not counting
+ *        `else`, `catch`, `catch_all`, `delegate`, and `end`.
+*/
+struct BlockTableEntry
+{
+	BlockTableEntry() :
+		m_exprOrdinal(0),
+		m_isChargedBefore(false),
+		m_weights(),
+		m_edges()
+	{}
+
+	// Ordinal of the last instruction of the block
+	uint64_t m_exprOrdinal;
+
+	// Whether the weights are charged right before the last instruction
+	// (i.e., it's a branch, or a call that may throw into a handler);
+	// otherwise, right after it (after its `end`, if it's a `block`, `loop`,
+	// `if`, or `try`)
+	bool m_isChargedBefore;
+
+	// One weight per cost dimension
+	std::vector<uint64_t> m_weights;
+
+	std::vector<BlockTableEdge> m_edges;
+}; // struct BlockTableEntry
+
+/**
+ * @brief Runtime-proportional charge right before a size-dependent
+ *        instruction, by its size operand on the top of the stack
+*/
+struct DynamicChargeEntry
+{
+	DynamicChargeEntry() :
+		m_exprOrdinal(0),
+		m_costs()
+	{}
+
+	uint64_t m_exprOrdinal;
+
+	// One cost per cost dimension
+	std::vector<DynamicCost> m_costs;
+}; // struct DynamicChargeEntry
+
+struct FuncBlockTable
+{
+	FuncBlockTable() :
+		m_funcIdx(0),
+		m_blocks(),
+		m_dynCharges()
+	{}
+
+	uint32_t m_funcIdx;
+
+	// The first block is the head of the graph (i.e., the function entry);
+	// empty if the function is charged at its call sites, or has no code
+	std::vector<BlockTableEntry> m_blocks;
+
+	std::vector<DynamicChargeEntry> m_dynCharges;
+}; // struct FuncBlockTable
+
+struct BlockTable
+{
+	BlockTable() :
+		m_numDims(0),
+		m_funcs()
+	{}
+
+	uint64_t m_numDims;
+
+	// One entry per function defined in the module (imports are excluded)
+	std::vector<FuncBlockTable> m_funcs;
+}; // struct BlockTable
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,271 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CostModel.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief What to do with the functions that can never be executed, i.e.,
+ *        the ones that can't be reached from any export, the start
+ *        function, element segments, or `ref.func`, through `call`s
+ *        and `ref.func`s
+*/
+enum class UnreachableFuncPolicy
+{
+	// Instrument them like any other function
+	Instrument,
+	// Leave them as they are, without counters
+	Skip,
+	// Replace their bodies with a single `unreachable`, to shrink the module
+	// and the work of the runtime (e.g., validation and compilation)
+	Stub,
+}; // enum class UnreachableFuncPolicy
+
+/**
+ * @brief What the injected code does when a counter exceeds its threshold
+*/
+enum class ExceedPolicy
+{
+	// Call the imported `decent_wasm_counter_exceed` function, and let the
+	// host decide what to do
+	Notify,
+	// Trap (i.e., `unreachable`) in the guest without calling into the host;
+	// the counter global keeps the final count, and
+	// `decent_wasm_counter_exceed` (or
+	// `decent_wasm_counter_aggregate_exceed`) doesn't need to be imported
+	Trap,
+}; // enum class ExceedPolicy
+
+/**
+ * @brief A budget shared by all instances of the module (e.g., one instance
+ *        per thread, with a shared memory), on top of the threshold of each
+ *        instance.
+ *        The counters stay in the globals of each instance, so there is no
+ *        contention on every increment; instead, each instance batches its
+ *        deltas, and adds them to a slot in the memory with an atomic add
+ *        once the batch is big enough.
+ *        Under ExceedPolicy::Notify, the module must also import
+ *        `env.decent_wasm_counter_aggregate_exceed`, which has the same
+ *        signature as `decent_wasm_counter_exceed`, and is called when the
+ *        aggregate budget is exceeded.
+*/
+struct AggregateBudgetConfig
+{
+	AggregateBudgetConfig() :
+		m_flushInterval(0),
+		m_memoryIdx(0),
+		m_slotOffset(0),
+		m_flushExportName("decent_wasm_counter_flush")
+	{}
+
+	bool IsEnabled() const
+	{
+		return m_flushInterval > 0;
+	}
+
+	/**
+	 * @brief The batched delta is flushed once it reaches this value;
+	 *        the aggregate budget is disabled if it's 0
+	*/
+	uint64_t m_flushInterval;
+
+	/**
+	 * @brief The memory where the slots are; it should be a shared memory
+	 *        if the instances are running in different threads
+	*/
+	uint32_t m_memoryIdx;
+
+	/**
+	 * @brief Address of the slots (must be 8-byte aligned); dimension d uses
+	 *        the 16 bytes at `m_slotOffset + 16 * d`, i.e., the aggregate
+	 *        count (i64), followed by the aggregate budget (i64) set by the
+	 *        host before any instance starts
+	*/
+	uint64_t m_slotOffset;
+
+	/**
+	 * @brief Export name of the function that flushes the batched deltas
+	 *        (e.g., to be called by the host when a thread exits);
+	 *        not exported if empty
+	*/
+	std::string m_flushExportName;
+}; // struct AggregateBudgetConfig
+
+/**
+ * @brief Pre-assigned cost of a trusted function (e.g., a vetted runtime
+ *        library), whose body is not instrumented
+*/
+struct TrustedFuncCost
+{
+	TrustedFuncCost() :
+		m_weights(),
+		m_sizeCosts()
+	{}
+
+	// Flat weight, one per cost dimension (0 for the ones not given)
+	std::vector<uint64_t> m_weights;
+
+	// Runtime-proportional cost by the value of the last parameter (e.g.,
+	// the length of the input), one per cost dimension;
+	// the last parameter must be an i32 or i64 if any of them is given
+	std::vector<DynamicCost> m_sizeCosts;
+}; // struct TrustedFuncCost
+
+struct InstrumentConfig
+{
+	InstrumentConfig() :
+		m_costModels({ GetDefaultCostModel() }),
+		m_exceedPolicy(ExceedPolicy::Notify),
+		m_elideLeafFuncCounters(false),
+		m_mergeEquivalentBlocks(false),
+		m_pruneUnreachableCode(false),
+		m_unreachableFuncPolicy(UnreachableFuncPolicy::Instrument),
+		m_maxIncrThunks(0),
+		m_emitRepricingInfo(false),
+		m_emitBlockTableOnly(false),
+		m_aggregateBudget(),
+		m_trustedFuncs(),
+		m_counterExportName(),
+		m_thresholdExportName(),
+		m_entryFuncName(),
+		m_entryWrapperName("decent_entry_function"),
+		m_memoryLimit(0)
+	{}
+
+	/**
+	 * @brief The cost of each instruction, one model per cost dimension
+	 *        (e.g., CPU, memory traffic, host calls).
+	 *        Each dimension has its own counter and threshold, while the
+	 *        block-flow graph is built only once, and each block has only
+	 *        one combined increment call.
+	 *        When there are more than one dimensions, the
+	 *        `decent_wasm_counter_exceed` import becomes `(param i64 i32)`,
+	 *        where the 2nd parameter is the index of the dimension exceeded.
+	*/
+	std::vector<CostModel> m_costModels;
+
+	ExceedPolicy m_exceedPolicy;
+
+	/**
+	 * @brief Strip counters from functions that are loop-free,
+	 *        recursion-free, and only entered by direct `call`s;
+	 *        their worst-case cost is charged at each call site instead.
+	 *        NOTE: this over-approximates the cost of leaf functions with
+	 *        branches, since the most expensive path is always charged.
+	*/
+	bool m_elideLeafFuncCounters;
+
+	/**
+	 * @brief Charge the blocks that always run together (i.e., A dominates
+	 *        B, B post-dominates A, and both are directly in the same loop)
+	 *        with a single counter, at the first of them.
+	 *        The counts are the same, but a block may be charged before it
+	 *        runs, if the execution is ended in the middle (e.g., by a trap).
+	 *        This can't be used with m_emitRepricingInfo.
+	*/
+	bool m_mergeEquivalentBlocks;
+
+	/**
+	 * @brief Replace code that can never be executed (e.g., the code after
+	 *        an unconditional `br`, `return`, or `unreachable`) with a single
+	 *        `unreachable`, to shrink the module
+	*/
+	bool m_pruneUnreachableCode;
+
+	/**
+	 * @brief Whether the functions that can never be executed are
+	 *        instrumented, skipped, or stubbed out
+	*/
+	UnreachableFuncPolicy m_unreachableFuncPolicy;
+
+	/**
+	 * @brief Maximum number of increment thunks; disabled if it's 0.
+	 *        A thunk is a zero-argument function that calls the increment
+	 *        function with a fixed set of weights, so the counters charging
+	 *        the most frequent weights become a single `call`, which shrinks
+	 *        the module without changing the counts.
+	 *        This can't be used with m_emitRepricingInfo.
+	*/
+	uint32_t m_maxIncrThunks;
+
+	/**
+	 * @brief Inject a counter for every reachable block, including the ones
+	 *        with zero weights, and record what each counter is charging in
+	 *        the `decent_wasm_counter.reprice` custom section, so the module
+	 *        can be repriced later by `Reprice()`.
+	 *        This can't be used with m_elideLeafFuncCounters.
+	*/
+	bool m_emitRepricingInfo;
+
+	/**
+	 * @brief Leave the function bodies untouched, and only record the
+	 *        block-flow graph of each function, with the weights of its
+	 *        blocks and where they should be charged, in the
+	 *        `decent_wasm_counter.blocks` custom section (see `BlockTable`),
+	 *        so an engine can meter the module natively.
+	 *        Options that change the code (e.g., m_pruneUnreachableCode,
+	 *        m_aggregateBudget, m_trustedFuncs) or add exports can't be used
+	 *        with it, while m_elideLeafFuncCounters is reflected in the table.
+	*/
+	bool m_emitBlockTableOnly;
+
+	/**
+	 * @brief Budget shared by all instances of the module; disabled by
+	 *        default
+	*/
+	AggregateBudgetConfig m_aggregateBudget;
+
+	/**
+	 * @brief Functions whose costs are pre-assigned, keyed by their export
+	 *        names or their names (e.g., `$sha256`).
+	 *        They don't have block counters; instead, their costs are
+	 *        charged at each call site, or at their entries if they can be
+	 *        entered without a direct `call` (e.g., exported, or in a table),
+	 *        or called by another trusted function.
+	 *        This can't be used with m_emitRepricingInfo.
+	*/
+	std::unordered_map<std::string, TrustedFuncCost> m_trustedFuncs;
+
+	/**
+	 * @brief Export the counter and threshold globals in these names, so the
+	 *        host can set and read them directly; not exported if empty.
+	 *        With more than one cost dimensions, the globals of dimension
+	 *        d > 0 are exported as `<name>_<d>`.
+	*/
+	std::string m_counterExportName;
+	std::string m_thresholdExportName;
+
+	/**
+	 * @brief Name of the exported entry function to be wrapped; if not empty,
+	 *        a function that takes the entry function's parameters followed by
+	 *        one i64 threshold per cost dimension, sets the threshold(s), and
+	 *        calls the entry function, is exported as `m_entryWrapperName`
+	*/
+	std::string m_entryFuncName;
+	std::string m_entryWrapperName;
+
+	/**
+	 * @brief Maximum number of bytes allocated (and not yet freed) while a
+	 *        module is instrumented, including what's added to the module;
+	 *        unlimited if it's 0.
+	 *        For a prepared module, the limit applies to `PrepareModule()`
+	 *        and to each `InstrumentFunction()` call separately.
+	 *        Only supported by the trusted library, where all allocations go
+	 *        through the allocator hooks (see `SetAllocatorHooks()`).
+	*/
+	uint64_t m_memoryLimit;
+}; // struct InstrumentConfig
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,132 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <unordered_map>
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Runtime-proportional cost of a size-dependent instruction, i.e.,
+ *        `(size >> m_unitShift) * m_perUnit`, where `size` is the value of
+ *        the size operand (bytes, pages, or table elements) at run time
+*/
+struct DynamicCost
+{
+	DynamicCost() :
+		DynamicCost(0, 0)
+	{}
+
+	DynamicCost(uint64_t perUnit, uint32_t unitShift) :
+		m_perUnit(perUnit),
+		m_unitShift(unitShift)
+	{}
+
+	uint64_t m_perUnit;
+	uint32_t m_unitShift;
+}; // struct DynamicCost
+
+struct CostModel
+{
+	CostModel() :
+		m_exprTypeWeights(),
+		m_opcodeWeights(),
+		m_simdLaneWeights(),
+		m_defaultExprWeight(0),
+		m_importFuncWeights(),
+		m_defaultImportFuncWeight(0),
+		m_dynamicCosts()
+	{}
+
+	// Static weight of each type of expression,
+	// keyed by WABT expression type name (e.g., "Binary", "Load")
+	std::unordered_map<std::string, uint64_t> m_exprTypeWeights;
+
+	// Static weight of a specific instruction, keyed by its mnemonic
+	// (e.g., "i64.div_u"); this overrides the weight of its expression type
+	std::unordered_map<std::string, uint64_t> m_opcodeWeights;
+
+	// Weight per lane of SIMD instructions, keyed by expression type name
+	// (e.g., "Binary" for `i32x4.add`, "SimdLaneOp", "LoadSplat");
+	// a SIMD instruction on N lanes (e.g., 4 for `i32x4.*`, 16 for
+	// `i8x16.*`, and 1 for `v128.*`) weighs N times of it.
+	// This overrides the weight of the expression type, but not the weight
+	// of a specific instruction given in m_opcodeWeights
+	std::unordered_map<std::string, uint64_t> m_simdLaneWeights;
+
+	// Weight of expressions that are not listed above
+	uint64_t m_defaultExprWeight;
+
+	// Weight of calls to imported functions,
+	// keyed by module name and then field name
+	std::unordered_map<std::string,
+		std::unordered_map<std::string, uint64_t> > m_importFuncWeights;
+
+	// Weight of calls to imported functions that are not listed above
+	uint64_t m_defaultImportFuncWeight;
+
+	// Runtime-proportional cost, keyed by instruction mnemonic;
+	// supported instructions are `memory.copy`, `memory.fill`,
+	// `memory.init`, `memory.grow`, `table.copy`, `table.init`,
+	// `table.fill`, and `table.grow`
+	std::unordered_map<std::string, DynamicCost> m_dynamicCosts;
+}; // struct CostModel
+
+inline const CostModel& GetDefaultCostModel()
+{
+	static const CostModel m = []()
+	{
+		CostModel model;
+
+		model.m_exprTypeWeights = {
+			{ "Binary",  1 },
+			{ "Compare", 1 },
+			// atomic read-modify-write is arithmetic as well
+			{ "AtomicRmw",        1 },
+			{ "AtomicRmwCmpxchg", 1 },
+			// these go through the runtime to wake up or suspend threads
+			{ "AtomicNotify", 10 },
+			{ "AtomicWait",   50 },
+		};
+
+		model.m_simdLaneWeights = {
+			{ "Binary",  1 },
+			{ "Compare", 1 },
+		};
+
+		model.m_importFuncWeights = {
+			{ "env",
+				{
+					{ "decent_wasm_test_log", 10 },
+				}
+			},
+		};
+		model.m_defaultImportFuncWeight = 2;
+
+		model.m_dynamicCosts = {
+			// 1 per 8 bytes
+			{ "memory.copy", DynamicCost(1, 3) },
+			{ "memory.fill", DynamicCost(1, 3) },
+			{ "memory.init", DynamicCost(1, 3) },
+			// 1 per 8 bytes of the 64 KiB page
+			{ "memory.grow", DynamicCost(8192, 0) },
+			// 1 per element
+			{ "table.copy",  DynamicCost(1, 0) },
+			{ "table.init",  DynamicCost(1, 0) },
+			{ "table.fill",  DynamicCost(1, 0) },
+			{ "table.grow",  DynamicCost(1, 0) },
+		};
+
+		return model;
+	}();
+	return m;
+}
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,247 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CostModel.hpp"
+#include "Exceptions.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Parse a cost model from a cost table, which is a text with one
+ *        entry per line (`#` starts a comment):
+ *
+ *        type <ExprTypeName> <weight>
+ *        opcode <mnemonic> <weight>
+ *        simd_lane <ExprTypeName> <weight>
+ *        default <weight>
+ *        import <module> <field> <weight>
+ *        default_import <weight>
+ *        dynamic <mnemonic> <perUnit> <unitShift>
+ *
+ *        Entries that are not listed are left as in an empty CostModel
+ *        (i.e., zero weights).
+*/
+inline CostModel ParseCostTable(const std::string& text)
+{
+	CostModel model;
+
+	std::istringstream textStream(text);
+	std::string line;
+	size_t lineNum = 0;
+	while (std::getline(textStream, line))
+	{
+		++lineNum;
+
+		auto commentPos = line.find('#');
+		if (commentPos != std::string::npos)
+		{
+			line.erase(commentPos);
+		}
+
+		std::istringstream lineStream(line);
+		std::vector<std::string> tokens;
+		std::string token;
+		while (lineStream >> token)
+		{
+			tokens.push_back(token);
+		}
+		if (tokens.empty())
+		{
+			continue;
+		}
+
+		auto parseNum = [&](const std::string& str) -> uint64_t
+		{
+			if (str.empty() ||
+				!std::all_of(str.begin(), str.end(),
+					[](char c) { return (c >= '0') && (c <= '9'); }))
+			{
+				throw Exception("Invalid number " + str + " in cost table "
+					"line " + std::to_string(lineNum));
+			}
+			return std::stoull(str);
+		};
+		auto checkNumTokens = [&](size_t num)
+		{
+			if (tokens.size() != num)
+			{
+				throw Exception("Invalid number of fields in cost table "
+					"line " + std::to_string(lineNum));
+			}
+		};
+
+		const std::string& kind = tokens[0];
+		if (kind == "type")
+		{
+			checkNumTokens(3);
+			model.m_exprTypeWeights[tokens[1]] = parseNum(tokens[2]);
+		}
+		else if (kind == "opcode")
+		{
+			checkNumTokens(3);
+			model.m_opcodeWeights[tokens[1]] = parseNum(tokens[2]);
+		}
+		else if (kind == "simd_lane")
+		{
+			checkNumTokens(3);
+			model.m_simdLaneWeights[tokens[1]] = parseNum(tokens[2]);
+		}
+		else if (kind == "default")
+		{
+			checkNumTokens(2);
+			model.m_defaultExprWeight = parseNum(tokens[1]);
+		}
+		else if (kind == "import")
+		{
+			checkNumTokens(4);
+			model.m_importFuncWeights[tokens[1]][tokens[2]] =
+				parseNum(tokens[3]);
+		}
+		else if (kind == "default_import")
+		{
+			checkNumTokens(2);
+			model.m_defaultImportFuncWeight = parseNum(tokens[1]);
+		}
+		else if (kind == "dynamic")
+		{
+			checkNumTokens(4);
+			model.m_dynamicCosts[tokens[1]] = DynamicCost(
+				parseNum(tokens[2]),
+				static_cast<uint32_t>(parseNum(tokens[3])));
+		}
+		else
+		{
+			throw Exception("Unknown entry " + kind + " in cost table "
+				"line " + std::to_string(lineNum));
+		}
+	}
+
+	return model;
+}
+
+/**
+ * @brief Write the cost model as a cost table that can be parsed by
+ *        ParseCostTable; entries are sorted, so the output is deterministic
+*/
+inline std::string WriteCostTable(const CostModel& model)
+{
+	std::string text;
+
+	for (const auto& item : std::map<std::string, uint64_t>(
+		model.m_exprTypeWeights.begin(), model.m_exprTypeWeights.end()))
+	{
+		text += "type " + item.first + ' ' +
+			std::to_string(item.second) + '\n';
+	}
+	for (const auto& item : std::map<std::string, uint64_t>(
+		model.m_opcodeWeights.begin(), model.m_opcodeWeights.end()))
+	{
+		text += "opcode " + item.first + ' ' +
+			std::to_string(item.second) + '\n';
+	}
+	for (const auto& item : std::map<std::string, uint64_t>(
+		model.m_simdLaneWeights.begin(), model.m_simdLaneWeights.end()))
+	{
+		text += "simd_lane " + item.first + ' ' +
+			std::to_string(item.second) + '\n';
+	}
+	text += "default " + std::to_string(model.m_defaultExprWeight) + '\n';
+
+	std::map<std::string, std::map<std::string, uint64_t> > impWeights;
+	for (const auto& modItem : model.m_importFuncWeights)
+	{
+		impWeights[modItem.first].insert(
+			modItem.second.begin(), modItem.second.end());
+	}
+	for (const auto& modItem : impWeights)
+	{
+		for (const auto& fieldItem : modItem.second)
+		{
+			text += "import " + modItem.first + ' ' + fieldItem.first + ' ' +
+				std::to_string(fieldItem.second) + '\n';
+		}
+	}
+	text += "default_import " +
+		std::to_string(model.m_defaultImportFuncWeight) + '\n';
+
+	for (const auto& item : std::map<std::string, DynamicCost>(
+		model.m_dynamicCosts.begin(), model.m_dynamicCosts.end()))
+	{
+		text += "dynamic " + item.first + ' ' +
+			std::to_string(item.second.m_perUnit) + ' ' +
+			std::to_string(item.second.m_unitShift) + '\n';
+	}
+
+	return text;
+}
+
+/**
+ * @brief The measured cost of an instruction, to be fitted into a cost model
+*/
+struct CostSample
+{
+	// Instruction mnemonic, e.g., "i32.add"
+	std::string m_instr;
+	// WABT expression type name, e.g., "Binary"
+	std::string m_exprType;
+	// Whether the weight can be set per opcode
+	// (see CostModel::m_opcodeWeights)
+	bool m_hasOpcode;
+	// Cost relative to the reference instruction, already scaled
+	double m_relCost;
+}; // struct CostSample
+
+/**
+ * @brief Fit the measured samples into a cost model: the weight of an
+ *        opcode is its rounded cost, and the weight of an expression type
+ *        is the average of its instructions (at least 1 for both)
+ *
+ * @param base The model to start from; only the measured entries are
+ *             overwritten, so the rest (e.g., atomics, imported functions,
+ *             and runtime-proportional costs) keep their weights
+*/
+inline CostModel FitCostModel(
+	const std::vector<CostSample>& samples,
+	CostModel base)
+{
+	auto toWeight = [](double cost) -> uint64_t
+	{
+		return std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(cost)));
+	};
+
+	std::map<std::string, std::pair<double, size_t> > typeSums;
+	for (const CostSample& sample : samples)
+	{
+		if (sample.m_hasOpcode)
+		{
+			base.m_opcodeWeights[sample.m_instr] = toWeight(sample.m_relCost);
+		}
+
+		auto& typeSum = typeSums[sample.m_exprType];
+		typeSum.first += sample.m_relCost;
+		typeSum.second += 1;
+	}
+	for (const auto& item : typeSums)
+	{
+		base.m_exprTypeWeights[item.first] = toWeight(
+			item.second.first / static_cast<double>(item.second.second));
+	}
+
+	return base;
+}
+
+} // namespace DecentWasmCounter
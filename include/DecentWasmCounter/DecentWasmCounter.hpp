@@ -5,11 +5,103 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <DecentWasmWat/WasmWat.h>
 
+#include "Analysis.hpp"
+#include "BlockTable.hpp"
+#include "Config.hpp"
+#include "Exceptions.hpp"
+#include "Instrumenter.hpp"
+#include "PreparedModule.hpp"
+#include "Result.hpp"
+#include "Statistics.hpp"
+
 namespace DecentWasmCounter
 {
 
 void Instrument(wabt::Module& mod);
 
+void Instrument(wabt::Module& mod, const InstrumentConfig& config);
+
+/**
+ * @brief Instrument the module, and report what each pass did
+ *        and how long it took
+*/
+void Instrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config,
+	ModuleStatistics& stats);
+
+/**
+ * @brief Same as `Instrument()`, but failures are reported in the returned
+ *        result instead of being thrown.
+ *        Modules that can't be instrumented (e.g., with unsupported
+ *        instructions or unresolvable branches) are rejected before they are
+ *        modified, and without any exception being thrown internally.
+ *        If the instrumented module fails the validation (ValidationFailed),
+ *        or on internal errors (Internal), the module is left partially
+ *        instrumented, and should be discarded.
+*/
+InstrumentResult TryInstrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config) noexcept;
+
+InstrumentResult TryInstrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config,
+	ModuleStatistics& stats) noexcept;
+
+/**
+ * @brief Update the weights charged by the block counters of a module
+ *        instrumented with `InstrumentConfig::m_emitRepricingInfo`, to match
+ *        the given cost models, without analyzing the module again.
+ *        The runtime-proportional charges are kept as they were.
+ *
+ * @param models One model per cost dimension; the number of dimensions
+ *               must be the same as the one used to instrument the module
+ * @exception Exception if the block counters don't match the repricing
+ *            section, in which case the module is left untouched
+*/
+void Reprice(wabt::Module& mod, const std::vector<CostModel>& models);
+
+/**
+ * @brief Read the block table of a module instrumented with
+ *        `InstrumentConfig::m_emitBlockTableOnly`
+*/
+BlockTable GetBlockTable(const wabt::Module& mod);
+
+/**
+ * @brief Calculate the static cost of each function in the module, without
+ *        modifying or validating it (i.e., a dry run of the analysis done by
+ *        `Instrument()`)
+ *
+ * @param models One model per cost dimension
+*/
+ModuleAnalysis Analyze(
+	const wabt::Module& mod,
+	const std::vector<CostModel>& models);
+
+ModuleAnalysis Analyze(const wabt::Module& mod);
+
+/**
+ * @brief Export the block-flow graph of a function, with the expr range
+ *        (ordinals as in `BlockTable`), weights, and loop head flag of each
+ *        block, and the types of each edge
+ *
+ * @param funcIdx   Index of a function defined in the module
+ * @param models    One model per cost dimension
+ * @param hitCounts Number of times each block is executed (e.g., collected
+ *                  from a profiling run), indexed in the same order as
+ *                  `FuncBlockTable::m_blocks`; not exported if it's empty
+*/
+std::string ExportGraph(
+	const wabt::Module& mod,
+	uint32_t funcIdx,
+	const std::vector<CostModel>& models,
+	GraphFormat format,
+	const std::vector<uint64_t>& hitCounts = std::vector<uint64_t>());
+
 } // namespace DecentWasmCounter
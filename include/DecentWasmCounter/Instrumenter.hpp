@@ -0,0 +1,96 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+
+#include <memory>
+#include <vector>
+
+#include <DecentWasmWat/WasmWat.h>
+
+#include "Config.hpp"
+#include "PreparedModule.hpp"
+#include "Result.hpp"
+#include "Statistics.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief An instrumentation session for many modules with the same
+ *        configuration; the per-configuration work (e.g., building the
+ *        weight maps of the cost models) is done once, at construction.
+ *        All member functions are const, and can be called concurrently on
+ *        different modules.
+*/
+class Instrumenter
+{
+public:
+
+	Instrumenter();
+
+	explicit Instrumenter(const InstrumentConfig& config);
+
+	Instrumenter(const Instrumenter&) = delete;
+
+	Instrumenter(Instrumenter&& other) noexcept;
+
+	~Instrumenter();
+
+	Instrumenter& operator=(const Instrumenter&) = delete;
+
+	Instrumenter& operator=(Instrumenter&& other) noexcept;
+
+	const InstrumentConfig& GetConfig() const;
+
+	/**
+	 * @brief Same as `DecentWasmCounter::Instrument()` with the session's
+	 *        configuration
+	*/
+	void Instrument(wabt::Module& mod) const;
+
+	void Instrument(wabt::Module& mod, ModuleStatistics& stats) const;
+
+	/**
+	 * @brief Same as `DecentWasmCounter::TryInstrument()` with the session's
+	 *        configuration
+	*/
+	InstrumentResult TryInstrument(wabt::Module& mod) const noexcept;
+
+	InstrumentResult TryInstrument(
+		wabt::Module& mod,
+		ModuleStatistics& stats) const noexcept;
+
+	/**
+	 * @brief Instrument the modules on a pool of worker threads
+	 *
+	 * @param numWorkers Number of worker threads; the number of hardware
+	 *                   threads if it's 0
+	 * @param stats      If it's not null, resized to one entry per module
+	 * @return One result per module, in the same order
+	*/
+	std::vector<InstrumentResult> InstrumentAll(
+		const std::vector<wabt::Module*>& mods,
+		size_t numWorkers = 0,
+		std::vector<ModuleStatistics>* stats = nullptr) const;
+
+	/**
+	 * @brief Same as `DecentWasmCounter::PrepareModule()` with the session's
+	 *        configuration; the prepared module refers to the session, which
+	 *        must outlive it
+	*/
+	PreparedModule PrepareModule(wabt::Module& mod) const;
+
+private:
+
+	struct Impl;
+
+	std::unique_ptr<Impl> m_impl;
+
+}; // class Instrumenter
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,106 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <memory>
+
+#include <DecentWasmWat/WasmWat.h>
+
+#include "Config.hpp"
+#include "Statistics.hpp"
+
+namespace DecentWasmCounter
+{
+
+class Instrumenter;
+
+/**
+ * @brief A module whose module-level instrumentation (i.e., the injected
+ *        counter and functions, the costs charged at call sites, and the
+ *        host interfaces) is done by `PrepareModule()`, while its function
+ *        bodies are instrumented on demand by `InstrumentFunction()`.
+ *        It refers to the module, which must outlive it.
+*/
+class PreparedModule
+{
+public:
+
+	PreparedModule(const PreparedModule&) = delete;
+
+	PreparedModule(PreparedModule&& other) noexcept;
+
+	~PreparedModule();
+
+	PreparedModule& operator=(const PreparedModule&) = delete;
+
+	PreparedModule& operator=(PreparedModule&& other) noexcept;
+
+	wabt::Module& GetModule() const;
+
+	/**
+	 * @brief Whether the function with the given index will be changed by
+	 *        `InstrumentFunction()`; false for imported and injected
+	 *        functions, the bodies of trusted functions, and the ones that
+	 *        are already instrumented
+	*/
+	bool IsPending(uint32_t funcIdx) const;
+
+private:
+
+	friend class Instrumenter;
+
+	friend PreparedModule PrepareModule(
+		wabt::Module& mod,
+		const InstrumentConfig& config);
+
+	friend FuncStatistics InstrumentFunction(
+		PreparedModule& prepared,
+		uint32_t funcIdx);
+
+	struct Impl;
+
+	explicit PreparedModule(std::unique_ptr<Impl> impl);
+
+	std::unique_ptr<Impl> m_impl;
+
+}; // class PreparedModule
+
+/**
+ * @brief Do the module-level instrumentation once, so that function bodies
+ *        can be instrumented later by `InstrumentFunction()`, e.g., when
+ *        they're compiled for the first time.
+ *        Only the configuration is checked here; each function is checked
+ *        when it's instrumented.
+ *        The repricing info, the block table, and the increment thunks
+ *        need the whole module, so they can't be used this way.
+ *        The module is not validated after instrumentation; since each
+ *        function is instrumented the same way as by `Instrument()`, it's
+ *        as valid as the input module.
+*/
+PreparedModule PrepareModule(
+	wabt::Module& mod,
+	const InstrumentConfig& config);
+
+/**
+ * @brief Instrument one function of a prepared module; it can be called
+ *        concurrently for different functions of the same module.
+ *        Calling it again for the same function does nothing.
+ *
+ * @param funcIdx Index of a function defined in the module
+ * @exception Exception if the function can't be instrumented (e.g., it
+ *            has an unsupported instruction), in which case it's left
+ *            untouched
+ * @exception std::bad_alloc if the call allocates more than
+ *            `InstrumentConfig::m_memoryLimit`, in which case the module
+ *            should be discarded
+*/
+FuncStatistics InstrumentFunction(
+	PreparedModule& prepared,
+	uint32_t funcIdx);
+
+} // namespace DecentWasmCounter
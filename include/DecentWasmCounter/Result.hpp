@@ -0,0 +1,104 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <limits>
+#include <string>
+#include <utility>
+
+namespace DecentWasmCounter
+{
+
+enum class ErrorCode : uint32_t
+{
+	Success = 0,
+	// The given InstrumentConfig can't be used (e.g., no cost model, or
+	// conflicting options)
+	InvalidConfig,
+	// `env.decent_wasm_counter_exceed` (or
+	// `env.decent_wasm_counter_aggregate_exceed` if the aggregate budget is
+	// enabled) is not imported, or imported more than once
+	InvalidExceedImport,
+	// An instruction that can't be instrumented yet
+	UnsupportedExpr,
+	// A branch whose target can't be resolved
+	InvalidBranch,
+	// The exported entry function to be wrapped is not found
+	EntryFuncNotFound,
+	// An export name to be added is already used
+	ExportNameConflict,
+	// The instrumented module failed the validation
+	ValidationFailed,
+	// InstrumentConfig::m_memoryLimit is exceeded
+	MemoryLimitExceeded,
+	// Any other failure
+	Internal,
+}; // enum class ErrorCode
+
+inline const char* GetErrorCodeName(ErrorCode code) noexcept
+{
+	switch (code)
+	{
+	case ErrorCode::Success:             return "Success";
+	case ErrorCode::InvalidConfig:       return "InvalidConfig";
+	case ErrorCode::InvalidExceedImport: return "InvalidExceedImport";
+	case ErrorCode::UnsupportedExpr:     return "UnsupportedExpr";
+	case ErrorCode::InvalidBranch:       return "InvalidBranch";
+	case ErrorCode::EntryFuncNotFound:   return "EntryFuncNotFound";
+	case ErrorCode::ExportNameConflict:  return "ExportNameConflict";
+	case ErrorCode::ValidationFailed:    return "ValidationFailed";
+	case ErrorCode::MemoryLimitExceeded: return "MemoryLimitExceeded";
+	default:                             return "Internal";
+	}
+}
+
+struct InstrumentResult
+{
+	static constexpr uint32_t sk_noFunc =
+		std::numeric_limits<uint32_t>::max();
+	static constexpr uint64_t sk_noExpr =
+		std::numeric_limits<uint64_t>::max();
+
+	InstrumentResult() :
+		m_code(ErrorCode::Success),
+		m_funcIdx(sk_noFunc),
+		m_exprOffset(sk_noExpr),
+		m_message()
+	{}
+
+	InstrumentResult(
+		ErrorCode code,
+		std::string message,
+		uint32_t funcIdx = sk_noFunc,
+		uint64_t exprOffset = sk_noExpr) :
+		m_code(code),
+		m_funcIdx(funcIdx),
+		m_exprOffset(exprOffset),
+		m_message(std::move(message))
+	{}
+
+	bool IsSuccess() const noexcept
+	{
+		return m_code == ErrorCode::Success;
+	}
+
+	ErrorCode m_code;
+
+	// Index of the function where the error is found,
+	// or sk_noFunc if it's not specific to a function
+	uint32_t m_funcIdx;
+
+	// Offset of the expr where the error is found, counted in exprs from the
+	// beginning of the function body (in pre-order, i.e., a block-like expr
+	// comes before the exprs nested in it), or sk_noExpr
+	uint64_t m_exprOffset;
+
+	std::string m_message;
+}; // struct InstrumentResult
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,147 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace DecentWasmCounter
+{
+
+enum class PassKind
+{
+	Analysis,  // Only reads the code (and the block-flow graph)
+	Transform, // Modifies the code
+}; // enum class PassKind
+
+struct PassStatistics
+{
+	PassStatistics() :
+		m_name(),
+		m_kind(PassKind::Analysis),
+		m_numRuns(0),
+		m_wallTimeNs(0),
+		m_numAllocs(0)
+	{}
+
+	std::string m_name;
+	PassKind m_kind;
+
+	// Number of times the pass is run (e.g., once per function)
+	uint64_t m_numRuns;
+
+	// Total wall time spent in the pass, in nanoseconds
+	uint64_t m_wallTimeNs;
+
+	// Total number of objects (blocks, exprs, etc.) allocated by the pass
+	uint64_t m_numAllocs;
+}; // struct PassStatistics
+
+struct FuncStatistics
+{
+	FuncStatistics() :
+		m_funcIdx(0),
+		m_isCounted(false),
+		m_numBlocks(0),
+		m_numEmptyBlocksDropped(0),
+		m_numDeadBlocks(0),
+		m_numExprsPruned(0),
+		m_numCountersInjected(0),
+		m_numBlocksMerged(0),
+		m_staticWeights(),
+		m_numBytesAdded(0)
+	{}
+
+	uint32_t m_funcIdx;
+
+	// Whether the function has block counters (i.e., it's not charged at
+	// its call sites)
+	bool m_isCounted;
+
+	// Number of blocks in the block-flow graph
+	uint64_t m_numBlocks;
+
+	// Number of empty blocks dropped during graph generation
+	uint64_t m_numEmptyBlocksDropped;
+
+	// Number of blocks that can't be reached
+	uint64_t m_numDeadBlocks;
+
+	// Number of exprs removed from dead blocks
+	// (if InstrumentConfig::m_pruneUnreachableCode is enabled)
+	uint64_t m_numExprsPruned;
+
+	// Number of calls to the increment function injected
+	// (block counters and runtime-proportional charges)
+	uint64_t m_numCountersInjected;
+
+	// Number of blocks charged by the counter of another block
+	// (if InstrumentConfig::m_mergeEquivalentBlocks is enabled)
+	uint64_t m_numBlocksMerged;
+
+	// Sum of the weights of all blocks, one per cost dimension
+	std::vector<uint64_t> m_staticWeights;
+
+	// Estimated size (in the binary format) of the injected code
+	uint64_t m_numBytesAdded;
+}; // struct FuncStatistics
+
+struct ModuleStatistics
+{
+	ModuleStatistics() :
+		m_passes(),
+		m_funcs(),
+		m_numBlocks(0),
+		m_numEmptyBlocksDropped(0),
+		m_numDeadBlocks(0),
+		m_numExprsPruned(0),
+		m_numCountersInjected(0),
+		m_numBlocksMerged(0),
+		m_staticWeights(),
+		m_numBytesAdded(0),
+		m_numUnreachableFuncs(0),
+		m_numIncrThunks(0),
+		m_numIncrThunkSites(0),
+		m_wallTimeNs(0)
+	{}
+
+	// One entry per pass, in the order they are run; module-level steps
+	// (e.g., injecting the counter function, validation) are included
+	std::vector<PassStatistics> m_passes;
+
+	// One entry per function defined in the module (i.e., not imported),
+	// excluding the injected increment function
+	std::vector<FuncStatistics> m_funcs;
+
+	// Sum of the per-function statistics above
+	uint64_t m_numBlocks;
+	uint64_t m_numEmptyBlocksDropped;
+	uint64_t m_numDeadBlocks;
+	uint64_t m_numExprsPruned;
+	uint64_t m_numCountersInjected;
+	uint64_t m_numBlocksMerged;
+	std::vector<uint64_t> m_staticWeights;
+
+	// Estimated size of the injected code, including the increment
+	// function and the counter/threshold globals
+	uint64_t m_numBytesAdded;
+
+	// Number of functions that can never be executed, which are skipped or
+	// stubbed out (see InstrumentConfig::m_unreachableFuncPolicy)
+	uint64_t m_numUnreachableFuncs;
+
+	// Number of increment thunks injected, and the number of counters
+	// rewritten to call them (see InstrumentConfig::m_maxIncrThunks)
+	uint64_t m_numIncrThunks;
+	uint64_t m_numIncrThunkSites;
+
+	// Total wall time of the instrumentation, in nanoseconds
+	uint64_t m_wallTimeNs;
+}; // struct ModuleStatistics
+
+} // namespace DecentWasmCounter
@@ -30,6 +30,7 @@ enum class BrType
 	Normal, // Normal branch that doesn't involve loop
 	IntoLoop, // Branch into the loop
 	OutOfLoop, // Branch out of the loop
+	IntoHandler, // Exception caught by a handler in the same function
 }; // enum class BrType
 
 struct Block;
@@ -54,11 +55,17 @@ struct BlockParent
 
 struct Block
 {
+	/**
+	 * @param isCaughtLocally Whether exceptions raised in this block can be
+	 *                        caught by a handler in the same function
+	*/
 	Block(BlockType type,
 		wabt::ExprList& expr,
-		wabt::ExprList::iterator blkBegin) :
+		wabt::ExprList::iterator blkBegin,
+		bool isCaughtLocally = false) :
 		m_type(type),
 		m_isLoopHead(false),
+		m_isCaughtLocally(isCaughtLocally),
 		m_exprList(&expr),
 		m_exprBegin(m_exprList->begin()),
 		m_exprEnd(m_exprList->end()),
@@ -70,8 +77,9 @@ struct Block
 			wabt::ExprType::Unreachable),
 		m_blkLstExprType(m_blkFstExprType),
 		m_isWeightCalc(false),
-		m_weight(0),
+		m_weights(),
 		m_isCtrInjected(false),
+		m_isReachable(false),
 		m_parents(),
 		m_children()
 	{}
@@ -96,6 +104,15 @@ struct Block
 			// Else, we search for the end
 			for (m_blkEnd = m_blkBegin; (m_blkEnd != m_exprEnd); ++m_blkEnd)
 			{
+				if (m_isCaughtLocally && IsMayThrowExpr(m_blkEnd->type()) &&
+					!IsEffectiveControlFlowExpr(m_blkEnd->type()))
+				{
+					// A call that may throw into a handler, include it, so
+					// the block is charged before the control goes elsewhere
+					m_blkLstExprType = m_blkEnd->type();
+					++m_blkEnd;
+					return;
+				}
 				if (IsEffectiveControlFlowExpr(m_blkEnd->type()))
 				{
 					// If it's a control flow expr, we found an end
@@ -122,11 +139,38 @@ struct Block
 		return m_blkBegin == m_blkEnd;
 	}
 
+	bool HasWeight() const
+	{
+		for (size_t w : m_weights)
+		{
+			if (w > 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
 	bool IsBlkEndsOnExprList() const
 	{
 		return m_blkEnd == m_exprEnd;
 	}
 
+	/**
+	 * @brief Whether the last expr of this block may transfer the control
+	 *        somewhere other than the next expr (i.e., a branch, or a call
+	 *        whose exception can be caught in the same function), so the
+	 *        counter must be placed before it
+	*/
+	bool IsLastExprJump() const
+	{
+		if (IsEffectiveControlFlowExpr(m_blkLstExprType))
+		{
+			return !IsBlockLikeDecl(m_blkLstExprType);
+		}
+		return m_isCaughtLocally && IsMayThrowExpr(m_blkLstExprType);
+	}
+
 	wabt::ExprList::iterator GetBlkLastExpr(size_t i) const
 	{
 		auto it = m_blkEnd;
@@ -144,6 +188,7 @@ struct Block
 
 	BlockType m_type;
 	bool m_isLoopHead;
+	bool m_isCaughtLocally;
 	wabt::ExprList* m_exprList;
 	wabt::ExprList::iterator m_exprBegin;
 	wabt::ExprList::iterator m_exprEnd;
@@ -153,10 +198,12 @@ struct Block
 	wabt::ExprType m_blkLstExprType;
 
 	bool m_isWeightCalc;
-	size_t m_weight;
+	std::vector<size_t> m_weights; // one weight per cost dimension
 
 	bool m_isCtrInjected;
 
+	bool m_isReachable; // set by MarkReachableBlocks
+
 	std::vector<BlockParent> m_parents;
 	std::vector<BlockChild> m_children;
 
@@ -164,12 +211,24 @@ struct Block
 
 struct BlockStorage
 {
+	BlockStorage() :
+		m_vec(),
+		m_numAllocs(0),
+		m_numEmptyDropped(0)
+	{}
+
 	void Append(std::unique_ptr<Block> b)
 	{
 		m_vec.emplace_back(std::move(b));
 	}
 
 	std::vector<std::unique_ptr<Block> > m_vec;
+
+	// Number of blocks allocated during graph generation,
+	// including the ones that are not kept
+	size_t m_numAllocs;
+	// Number of empty blocks dropped during graph generation
+	size_t m_numEmptyDropped;
 };
 
 struct Graph
@@ -188,6 +247,18 @@ struct BrBinding
 	std::string m_name;
 	Block* m_blk;
 	size_t m_blkLvl;
+
+	// Heads of the handlers catching exceptions raised directly in this
+	// scope (i.e., the body of a `try`); nullptr if the handler flows to the
+	// end of the function
+	std::vector<Block*> m_handlers;
+	// Whether one of the handlers is `catch_all`, so exceptions never go
+	// beyond this scope
+	bool m_isCatchAll;
+	// For the body of a `try ... delegate`, exceptions are delegated to the
+	// scope at level m_delegateLvl - 1 (none if it's 0)
+	bool m_isDelegate;
+	size_t m_delegateLvl;
 }; // struct BrBinding
 
 } // namespace DecentWasmCounter
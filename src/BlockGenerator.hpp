@@ -20,6 +20,15 @@
 namespace DecentWasmCounter
 {
 
+/**
+ * @brief Whether the branch binding is a loop; the binding of a block at the
+ *        end of the function is nullptr, since nothing follows it
+*/
+inline bool IsLoopBinding(const BrBinding& binding)
+{
+	return (binding.m_blk != nullptr) && binding.m_blk->m_isLoopHead;
+}
+
 inline BrType CheckContBlockBrType(
 	const std::vector<BrBinding>& scopeStack,
 	size_t contBlockLvl)
@@ -30,7 +39,7 @@ inline BrType CheckContBlockBrType(
 	for (auto it = scopeStack.rbegin();
 		(it != scopeStack.rend()) && (idx < scopeStack.size()); ++it, ++idx)
 	{
-		passLoop = passLoop || (it->m_blk->m_isLoopHead);
+		passLoop = passLoop || IsLoopBinding(*it);
 	}
 
 	return passLoop ? BrType::OutOfLoop : BrType::Normal;
@@ -48,15 +57,21 @@ inline BlockChild FindBrDestination(
 	{
 		if (idx == 0)
 		{
-			BrType brType = (it->m_blk->m_isLoopHead) ? BrType::IntoLoop :
+			BrType brType = IsLoopBinding(*it) ? BrType::IntoLoop :
 				(passLoop ? BrType::OutOfLoop : BrType::Normal);
-			BrType cntType = (it->m_blk->m_isLoopHead) ? BrType::IntoLoop :
+			BrType cntType = IsLoopBinding(*it) ? BrType::IntoLoop :
 				CheckContBlockBrType(scopeStack, it->m_blkLvl);
 
 			return BlockChild(brType, cntType, it->m_blk);
 		}
 
-		passLoop = passLoop || (it->m_blk->m_isLoopHead);
+		passLoop = passLoop || IsLoopBinding(*it);
+	}
+
+	if (idx == 0)
+	{
+		// branch to the function body, i.e., return from the function
+		return BlockChild(BrType::Normal, BrType::Normal, nullptr);
 	}
 
 	throw Exception("Branch to an index that is out of range");
@@ -72,15 +87,15 @@ inline BlockChild FindBrDestination(
 	{
 		if (it->m_name == name)
 		{
-			BrType brType = (it->m_blk->m_isLoopHead) ? BrType::IntoLoop :
+			BrType brType = IsLoopBinding(*it) ? BrType::IntoLoop :
 				(passLoop ? BrType::OutOfLoop : BrType::Normal);
-			BrType cntType = (it->m_blk->m_isLoopHead) ? BrType::IntoLoop :
+			BrType cntType = IsLoopBinding(*it) ? BrType::IntoLoop :
 				CheckContBlockBrType(scopeStack, it->m_blkLvl);
 
 			return BlockChild(brType, cntType, it->m_blk);
 		}
 
-		passLoop = passLoop || (it->m_blk->m_isLoopHead);
+		passLoop = passLoop || IsLoopBinding(*it);
 	}
 
 	throw Exception("Branch to an name that is not found");
@@ -106,6 +121,90 @@ inline BlockChild FindBrDestination(
 	}
 }
 
+/**
+ * @brief Get the level of the scope that a `try ... delegate` delegates its
+ *        exceptions to (i.e., the number of enclosing scopes that are still
+ *        in effect there; 0 if it delegates to the caller)
+ *
+ * @param scopeStack The scopes enclosing the `try`, not including itself
+*/
+inline size_t FindDelegateLevel(
+	const std::vector<BrBinding>& scopeStack,
+	const wabt::Var& var)
+{
+	if (var.is_index())
+	{
+		if (var.index() > scopeStack.size())
+		{
+			throw Exception("Delegate to an index that is out of range");
+		}
+		return scopeStack.size() - var.index();
+	}
+	else if (var.is_name())
+	{
+		for (size_t lvl = scopeStack.size(); lvl > 0; --lvl)
+		{
+			if (scopeStack[lvl - 1].m_name == var.name())
+			{
+				return lvl;
+			}
+		}
+		throw Exception("Delegate to an name that is not found");
+	}
+	else
+	{
+		throw Exception("Unkown var type");
+	}
+}
+
+/**
+ * @brief Get the handlers that may catch an exception raised in the
+ *        innermost scope; a handler is nullptr if it flows to the end of the
+ *        function.
+ *        Handlers of enclosing `try`s are included as well, until one of
+ *        them has `catch_all`, since we don't know which tag is thrown.
+ *
+ * @return Empty if the exception can't be caught in the function
+*/
+inline std::vector<Block*> FindThrowDestinations(
+	const std::vector<BrBinding>& scopeStack)
+{
+	std::vector<Block*> res;
+
+	size_t lvl = scopeStack.size();
+	while (lvl > 0)
+	{
+		const BrBinding& binding = scopeStack[lvl - 1];
+
+		res.insert(res.end(),
+			binding.m_handlers.begin(), binding.m_handlers.end());
+		if (binding.m_isCatchAll)
+		{
+			break;
+		}
+
+		lvl = binding.m_isDelegate ? binding.m_delegateLvl : (lvl - 1);
+	}
+
+	return res;
+}
+
+inline void ConnectThrowDestinations(
+	Block* blkPtr,
+	const std::vector<Block*>& throwDests)
+{
+	for (Block* dest : throwDests)
+	{
+		// nothing to connect if the handler flows to the end of the func
+		if (dest != nullptr)
+		{
+			blkPtr->m_children.push_back(BlockChild(
+				BrType::IntoHandler, BrType::IntoHandler, dest));
+			dest->m_parents.push_back({ blkPtr });
+		}
+	}
+}
+
 // Returns the head block of the given expr
 // We only return 1 pointer to head block,
 // since is only one entry point to Func/Block/Loop
@@ -120,6 +219,10 @@ inline Block* GenerateGraph(
 	auto exprBegin = exprList.begin();
 	auto exprEnd = exprList.end();
 
+	// Handlers that catch exceptions raised in this expr list
+	const std::vector<Block*> throwDests = FindThrowDestinations(scopeStack);
+	const bool isCaughtLocally = !throwDests.empty();
+
 	// # create a stack of blocks, where the last block is on the top
 	//   so it will be processed first
 	std::vector<std::unique_ptr<Block> > blockStack;
@@ -131,7 +234,9 @@ inline Block* GenerateGraph(
 		std::unique_ptr<Block> blk = Internal::make_unique<Block>(
 			blkType,
 			exprList,
-			it);
+			it,
+			isCaughtLocally);
+		++storage.m_numAllocs;
 
 		// expand block
 		blk->ExpandBlock();
@@ -145,6 +250,10 @@ inline Block* GenerateGraph(
 			// !isEmpty || (!notEnd && isEffectiveCtrlFlow)
 			blockStack.emplace_back(std::move(blk));
 		}
+		else
+		{
+			++storage.m_numEmptyDropped;
+		}
 	}
 
 	// Work from the stack top
@@ -221,6 +330,60 @@ inline Block* GenerateGraph(
 				}
 				break;
 			}
+			case wabt::ExprType::Try:
+			{
+				const wabt::TryExpr* tryExpr =
+					wabt::cast<const wabt::TryExpr>(&(*(blk->m_blkBegin)));
+				wabt::ExprList& tryExprList =
+					const_cast<wabt::ExprList&>(tryExpr->block.exprs);
+
+				// Handlers are generated first, so the blocks in the body can
+				// be connected to them.
+				// For handlers, br/br_if 0 also points to head, but exceptions
+				// raised in them are not caught by the same `try`
+				BrBinding tryBinding{ tryExpr->block.label, head, headLvl };
+				for (const wabt::Catch& catchBlk : tryExpr->catches)
+				{
+					wabt::ExprList& catchExprList =
+						const_cast<wabt::ExprList&>(catchBlk.exprs);
+
+					scopeStack.push_back({ tryExpr->block.label, head, headLvl });
+
+					Block* catchHead = GenerateGraph(BlockType::Block,
+						catchExprList,
+						storage, scopeStack,
+						headLvl, head);
+
+					scopeStack.pop_back();
+
+					tryBinding.m_handlers.push_back(catchHead);
+					tryBinding.m_isCatchAll =
+						tryBinding.m_isCatchAll || catchBlk.IsCatchAll();
+				}
+				if (tryExpr->kind == wabt::TryKind::Delegate)
+				{
+					tryBinding.m_isDelegate = true;
+					tryBinding.m_delegateLvl = FindDelegateLevel(
+						scopeStack, tryExpr->delegate_target);
+				}
+
+				// For the body, br/br_if 0 should also points to head
+				scopeStack.push_back(std::move(tryBinding));
+
+				Block* tmpHead = GenerateGraph(BlockType::Block, tryExprList,
+					storage, scopeStack,
+					headLvl, head);
+
+				scopeStack.pop_back();
+
+				if (tmpHead != head)
+				{
+					// head is updated
+					head = tmpHead;
+					headLvl = scopeStack.size();
+				}
+				break;
+			}
 			default:
 				throw Exception("Unimplemented feature");
 			}
@@ -254,8 +417,12 @@ inline Block* GenerateGraph(
 						auto foundRes = FindBrDestination(scopeStack, brExpr->var);
 
 						// set up block flow link
-						blkPtr->m_children.push_back(foundRes);
-						foundRes.m_ptr->m_parents.push_back({ blkPtr });
+						// (there is no child if it branches out of the func)
+						if (foundRes.m_ptr != nullptr)
+						{
+							blkPtr->m_children.push_back(foundRes);
+							foundRes.m_ptr->m_parents.push_back({ blkPtr });
+						}
 
 						head = blkPtr;
 						headLvl = scopeStack.size();
@@ -271,8 +438,11 @@ inline Block* GenerateGraph(
 
 						// set up block flow link
 						// -> flow when jump
-						blkPtr->m_children.push_back(foundRes);
-						foundRes.m_ptr->m_parents.push_back({ blkPtr });
+						if (foundRes.m_ptr != nullptr)
+						{
+							blkPtr->m_children.push_back(foundRes);
+							foundRes.m_ptr->m_parents.push_back({ blkPtr });
+						}
 						// -> flow when not jump
 						if (head != nullptr)
 						{
@@ -288,10 +458,25 @@ inline Block* GenerateGraph(
 						headLvl = scopeStack.size();
 						break;
 					}
+					case wabt::ExprType::Throw:
+					case wabt::ExprType::Rethrow:
+					{
+						// the exception always goes to the handlers (if any),
+						// otherwise, it leaves the func
+						ConnectThrowDestinations(blkPtr, throwDests);
+
+						head = blkPtr;
+						headLvl = scopeStack.size();
+						break;
+					}
 					//case wabt::ExprType::BrTable:
 					case wabt::ExprType::Return:
+					case wabt::ExprType::ReturnCall:
+					case wabt::ExprType::ReturnCallIndirect:
+					case wabt::ExprType::Unreachable:
 					{
-						// return directly terminate the func, so there is no child
+						// return and tail calls directly terminate the func,
+						// and unreachable traps, so there is no child
 
 						head = blkPtr;
 						headLvl = scopeStack.size();
@@ -320,6 +505,11 @@ inline Block* GenerateGraph(
 						));
 						head->m_parents.push_back({ blkPtr });
 					}
+					// -> flow when the call throws
+					if (blkPtr->IsLastExprJump())
+					{
+						ConnectThrowDestinations(blkPtr, throwDests);
+					}
 
 					head = blkPtr;
 					headLvl = scopeStack.size();
@@ -0,0 +1,331 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include <DecentWasmCounter/BlockTable.hpp>
+#include <DecentWasmCounter/Exceptions.hpp>
+
+#include "Block.hpp"
+#include "Repricing.hpp"
+#include "WeightCalculator.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Name of the custom section that keeps the block table for engines
+ *        that meter the module natively
+*/
+inline const char* GetBlockTableSectionName()
+{
+	return "decent_wasm_counter.blocks";
+}
+
+using ExprOrdinalMap = std::unordered_map<const wabt::Expr*, uint64_t>;
+
+/**
+ * @brief Number the exprs in the order they are decoded, i.e., a block-like
+ *        expr comes before the exprs inside it
+*/
+inline void AssignExprOrdinals(
+	const wabt::ExprList& exprList,
+	ExprOrdinalMap& ordinals,
+	uint64_t& nextOrdinal)
+{
+	for (const wabt::Expr& expr : exprList)
+	{
+		ordinals[&expr] = nextOrdinal++;
+
+		switch (expr.type())
+		{
+		case wabt::ExprType::Block:
+			AssignExprOrdinals(wabt::cast<const wabt::BlockExpr>(&expr)->
+				block.exprs, ordinals, nextOrdinal);
+			break;
+		case wabt::ExprType::Loop:
+			AssignExprOrdinals(wabt::cast<const wabt::LoopExpr>(&expr)->
+				block.exprs, ordinals, nextOrdinal);
+			break;
+		case wabt::ExprType::If:
+		{
+			const wabt::IfExpr* ifExpr = wabt::cast<const wabt::IfExpr>(&expr);
+			AssignExprOrdinals(ifExpr->true_.exprs, ordinals, nextOrdinal);
+			AssignExprOrdinals(ifExpr->false_, ordinals, nextOrdinal);
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			const wabt::TryExpr* tryExpr =
+				wabt::cast<const wabt::TryExpr>(&expr);
+			AssignExprOrdinals(tryExpr->block.exprs, ordinals, nextOrdinal);
+			for (const auto& catchBlk : tryExpr->catches)
+			{
+				AssignExprOrdinals(catchBlk.exprs, ordinals, nextOrdinal);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+inline BlockEdgeType ToBlockEdgeType(BrType brType)
+{
+	switch (brType)
+	{
+	case BrType::IntoLoop:
+		return BlockEdgeType::IntoLoop;
+	case BrType::OutOfLoop:
+		return BlockEdgeType::OutOfLoop;
+	case BrType::IntoHandler:
+		return BlockEdgeType::IntoHandler;
+	case BrType::Normal:
+	default:
+		return BlockEdgeType::Normal;
+	}
+}
+
+using BlockIndexMap = std::unordered_map<const Block*, uint64_t>;
+
+/**
+ * @brief Get the blocks that can be reached from the head of the graph, in
+ *        the order they would be visited by InjectBlockCounter; the head
+ *        comes first
+*/
+inline std::vector<const Block*> GetBlocksInCountOrder(
+	const Graph& gr,
+	BlockIndexMap& blkIdx)
+{
+	std::vector<const Block*> blks;
+	std::vector<const Block*> stack;
+	if (gr.m_head != nullptr)
+	{
+		stack.push_back(gr.m_head);
+	}
+	while (stack.size() > 0)
+	{
+		const Block* blk = stack.back();
+		stack.pop_back();
+
+		if (!blkIdx.emplace(blk, blks.size()).second)
+		{
+			continue;
+		}
+		blks.push_back(blk);
+
+		// children are visited in their order
+		for (auto it = blk->m_children.rbegin();
+			it != blk->m_children.rend(); ++it)
+		{
+			if ((it->m_ptr != nullptr) &&
+				(blkIdx.find(it->m_ptr) == blkIdx.end()))
+			{
+				stack.push_back(it->m_ptr);
+			}
+		}
+	}
+	return blks;
+}
+
+/**
+ * @brief Build the table of the function from its block-flow graph, whose
+ *        weights must have been calculated
+*/
+inline FuncBlockTable BuildFuncBlockTable(
+	const wabt::Func& func,
+	wabt::Index funcIdx,
+	const Graph& gr,
+	const DynamicWeightMapType& dynWeightMap)
+{
+	FuncBlockTable table;
+	table.m_funcIdx = static_cast<uint32_t>(funcIdx);
+
+	ExprOrdinalMap ordinals;
+	uint64_t nextOrdinal = 0;
+	AssignExprOrdinals(func.exprs, ordinals, nextOrdinal);
+
+	// # blocks
+	BlockIndexMap blkIdx;
+	std::vector<const Block*> blks = GetBlocksInCountOrder(gr, blkIdx);
+
+	for (const Block* blk : blks)
+	{
+		if (!blk->m_isWeightCalc)
+		{
+			throw Exception("The block weight is not calculated");
+		}
+
+		BlockTableEntry entry;
+		entry.m_exprOrdinal = ordinals.at(&(*(blk->GetBlkLastExpr(1))));
+		entry.m_isChargedBefore = blk->IsLastExprJump();
+		entry.m_weights.assign(blk->m_weights.begin(), blk->m_weights.end());
+		for (const auto& child : blk->m_children)
+		{
+			if (child.m_ptr != nullptr)
+			{
+				entry.m_edges.push_back(BlockTableEdge{
+					blkIdx.at(child.m_ptr), ToBlockEdgeType(child.m_brType) });
+			}
+		}
+		table.m_blocks.emplace_back(std::move(entry));
+	}
+
+	// # runtime-proportional charges
+	for (const auto& item : ordinals)
+	{
+		auto itCost = dynWeightMap.find(item.first->type());
+		if (itCost != dynWeightMap.cend())
+		{
+			DynamicChargeEntry entry;
+			entry.m_exprOrdinal = item.second;
+			entry.m_costs = itCost->second;
+			table.m_dynCharges.emplace_back(std::move(entry));
+		}
+	}
+	std::sort(table.m_dynCharges.begin(), table.m_dynCharges.end(),
+		[](const DynamicChargeEntry& a, const DynamicChargeEntry& b)
+		{
+			return a.m_exprOrdinal < b.m_exprOrdinal;
+		}
+	);
+
+	return table;
+}
+
+/**
+ * @brief Encode the block table:
+ *        version, number of dimensions,
+ *        functions (index,
+ *            blocks (ordinal, flags, weights, edges (child index, type)),
+ *            dynamic charges (ordinal, costs (per unit, unit shift)))
+ *        where bit 0 of flags is m_isChargedBefore
+*/
+inline std::vector<uint8_t> EncodeBlockTable(const BlockTable& table)
+{
+	std::vector<uint8_t> out;
+	WriteULeb128(1, out); // version
+	WriteULeb128(table.m_numDims, out);
+
+	WriteULeb128(table.m_funcs.size(), out);
+	for (const FuncBlockTable& func : table.m_funcs)
+	{
+		WriteULeb128(func.m_funcIdx, out);
+
+		WriteULeb128(func.m_blocks.size(), out);
+		for (const BlockTableEntry& blk : func.m_blocks)
+		{
+			WriteULeb128(blk.m_exprOrdinal, out);
+			out.push_back(blk.m_isChargedBefore ? 1 : 0);
+			for (uint64_t weight : blk.m_weights)
+			{
+				WriteULeb128(weight, out);
+			}
+			WriteULeb128(blk.m_edges.size(), out);
+			for (const BlockTableEdge& edge : blk.m_edges)
+			{
+				WriteULeb128(edge.m_childIdx, out);
+				out.push_back(static_cast<uint8_t>(edge.m_type));
+			}
+		}
+
+		WriteULeb128(func.m_dynCharges.size(), out);
+		for (const DynamicChargeEntry& dyn : func.m_dynCharges)
+		{
+			WriteULeb128(dyn.m_exprOrdinal, out);
+			for (const DynamicCost& cost : dyn.m_costs)
+			{
+				WriteULeb128(cost.m_perUnit, out);
+				WriteULeb128(cost.m_unitShift, out);
+			}
+		}
+	}
+	return out;
+}
+
+inline BlockTable DecodeBlockTable(const std::vector<uint8_t>& in)
+{
+	BlockTable table;
+	size_t pos = 0;
+
+	auto readByte = [&]() -> uint8_t
+	{
+		if (pos >= in.size())
+		{
+			throw Exception("The block table section is truncated");
+		}
+		return in[pos++];
+	};
+
+	if (ReadULeb128(in, pos) != 1)
+	{
+		throw Exception("Unsupported version of the block table section");
+	}
+	table.m_numDims = ReadULeb128(in, pos);
+
+	uint64_t numFuncs = ReadULeb128(in, pos);
+	for (uint64_t i = 0; i < numFuncs; ++i)
+	{
+		FuncBlockTable func;
+		func.m_funcIdx = static_cast<uint32_t>(ReadULeb128(in, pos));
+
+		uint64_t numBlocks = ReadULeb128(in, pos);
+		for (uint64_t j = 0; j < numBlocks; ++j)
+		{
+			BlockTableEntry blk;
+			blk.m_exprOrdinal = ReadULeb128(in, pos);
+			blk.m_isChargedBefore = (readByte() & 1U) != 0;
+			for (uint64_t dim = 0; dim < table.m_numDims; ++dim)
+			{
+				blk.m_weights.push_back(ReadULeb128(in, pos));
+			}
+			uint64_t numEdges = ReadULeb128(in, pos);
+			for (uint64_t k = 0; k < numEdges; ++k)
+			{
+				BlockTableEdge edge;
+				edge.m_childIdx = ReadULeb128(in, pos);
+				edge.m_type = static_cast<BlockEdgeType>(readByte());
+				if (edge.m_childIdx >= numBlocks)
+				{
+					throw Exception(
+						"The block table section has an invalid edge");
+				}
+				blk.m_edges.push_back(edge);
+			}
+			func.m_blocks.emplace_back(std::move(blk));
+		}
+
+		uint64_t numDyns = ReadULeb128(in, pos);
+		for (uint64_t j = 0; j < numDyns; ++j)
+		{
+			DynamicChargeEntry dyn;
+			dyn.m_exprOrdinal = ReadULeb128(in, pos);
+			for (uint64_t dim = 0; dim < table.m_numDims; ++dim)
+			{
+				uint64_t perUnit = ReadULeb128(in, pos);
+				uint32_t unitShift =
+					static_cast<uint32_t>(ReadULeb128(in, pos));
+				dyn.m_costs.emplace_back(perUnit, unitShift);
+			}
+			func.m_dynCharges.emplace_back(std::move(dyn));
+		}
+
+		table.m_funcs.emplace_back(std::move(func));
+	}
+
+	return table;
+}
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,335 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include "ExprWalker.hpp"
+
+namespace DecentWasmCounter
+{
+
+struct CallGraph
+{
+	CallGraph() :
+		m_numImports(0),
+		m_callees(),
+		m_refFuncs(),
+		m_isRoot(),
+		m_isEntry()
+	{}
+
+	bool IsImport(wabt::Index funcIdx) const
+	{
+		return funcIdx < m_numImports;
+	}
+
+	size_t m_numImports;
+
+	// Functions that are directly called by each function
+	// (indexed by function index, sorted, no duplicates)
+	std::vector<std::vector<wabt::Index> > m_callees;
+
+	// Functions referenced by `ref.func` in each function body
+	// (indexed by function index, sorted, no duplicates)
+	std::vector<std::vector<wabt::Index> > m_refFuncs;
+
+	// Whether the function can be entered no matter which functions are
+	// executed, i.e., exported, start function, in element segments, or
+	// referenced by `ref.func` in global initializers
+	std::vector<bool> m_isRoot;
+
+	// Whether the function can be entered without a direct `call`
+	// i.e., exported, start function, in element segments, or
+	// referenced by `ref.func`
+	std::vector<bool> m_isEntry;
+}; // struct CallGraph
+
+inline void CollectRefFuncs(
+	const wabt::Module& mod,
+	const wabt::ExprList& exprList,
+	std::vector<wabt::Index>& refFuncs)
+{
+	WalkExprList(exprList,
+		[&mod, &refFuncs](const wabt::Expr& expr)
+		{
+			if (expr.type() == wabt::ExprType::RefFunc)
+			{
+				const wabt::RefFuncExpr* refExpr =
+					wabt::cast<const wabt::RefFuncExpr>(&expr);
+				refFuncs.push_back(mod.GetFuncIndex(refExpr->var));
+			}
+		}
+	);
+}
+
+inline void MarkRefFuncEntries(
+	const wabt::Module& mod,
+	const wabt::ExprList& exprList,
+	CallGraph& cg)
+{
+	std::vector<wabt::Index> refFuncs;
+	CollectRefFuncs(mod, exprList, refFuncs);
+	for (wabt::Index idx : refFuncs)
+	{
+		if (idx < cg.m_isEntry.size())
+		{
+			cg.m_isEntry[idx] = true;
+		}
+	}
+}
+
+inline CallGraph BuildCallGraph(const wabt::Module& mod)
+{
+	CallGraph cg;
+	cg.m_numImports = mod.num_func_imports;
+	cg.m_callees.resize(mod.funcs.size());
+	cg.m_refFuncs.resize(mod.funcs.size());
+	cg.m_isEntry.resize(mod.funcs.size(), false);
+
+	// # direct calls
+	for (size_t i = cg.m_numImports; i < mod.funcs.size(); ++i)
+	{
+		std::vector<wabt::Index>& callees = cg.m_callees[i];
+
+		WalkExprList(mod.funcs[i]->exprs,
+			[&mod, &callees](const wabt::Expr& expr)
+			{
+				if (expr.type() == wabt::ExprType::Call)
+				{
+					callees.push_back(mod.GetFuncIndex(
+						wabt::cast<const wabt::CallExpr>(&expr)->var));
+				}
+				else if (expr.type() == wabt::ExprType::ReturnCall)
+				{
+					callees.push_back(mod.GetFuncIndex(
+						wabt::cast<const wabt::ReturnCallExpr>(&expr)->var));
+				}
+			}
+		);
+
+		std::sort(callees.begin(), callees.end());
+		callees.erase(
+			std::unique(callees.begin(), callees.end()), callees.end());
+
+		std::vector<wabt::Index>& refFuncs = cg.m_refFuncs[i];
+		CollectRefFuncs(mod, mod.funcs[i]->exprs, refFuncs);
+		std::sort(refFuncs.begin(), refFuncs.end());
+		refFuncs.erase(
+			std::unique(refFuncs.begin(), refFuncs.end()), refFuncs.end());
+	}
+
+	// # exports
+	for (const wabt::Export* exp : mod.exports)
+	{
+		if (exp->kind == wabt::ExternalKind::Func)
+		{
+			wabt::Index idx = mod.GetFuncIndex(exp->var);
+			if (idx < cg.m_isEntry.size())
+			{
+				cg.m_isEntry[idx] = true;
+			}
+		}
+	}
+
+	// # start function
+	for (const wabt::Var* start : mod.starts)
+	{
+		wabt::Index idx = mod.GetFuncIndex(*start);
+		if (idx < cg.m_isEntry.size())
+		{
+			cg.m_isEntry[idx] = true;
+		}
+	}
+
+	// # element segments
+	for (const wabt::ElemSegment* seg : mod.elem_segments)
+	{
+		for (const wabt::ElemExpr& elemExpr : seg->elem_exprs)
+		{
+			if (elemExpr.kind == wabt::ElemExprKind::RefFunc)
+			{
+				wabt::Index idx = mod.GetFuncIndex(elemExpr.var);
+				if (idx < cg.m_isEntry.size())
+				{
+					cg.m_isEntry[idx] = true;
+				}
+			}
+		}
+	}
+
+	// # ref.func in global initializers
+	for (const wabt::Global* global : mod.globals)
+	{
+		MarkRefFuncEntries(mod, global->init_expr, cg);
+	}
+
+	cg.m_isRoot = cg.m_isEntry;
+
+	// # ref.func in function bodies
+	for (const auto& refFuncs : cg.m_refFuncs)
+	{
+		for (wabt::Index idx : refFuncs)
+		{
+			if (idx < cg.m_isEntry.size())
+			{
+				cg.m_isEntry[idx] = true;
+			}
+		}
+	}
+
+	return cg;
+}
+
+/**
+ * @brief Find the functions that can be executed, i.e., the roots, and the
+ *        ones called or referenced by `ref.func` in the functions that can
+ *        be executed
+ *
+ * @return One flag per function (imports included)
+*/
+inline std::vector<bool> GetReachableFuncs(const CallGraph& cg)
+{
+	std::vector<bool> isReachable(cg.m_callees.size(), false);
+
+	std::vector<wabt::Index> stack;
+	for (size_t i = 0; i < cg.m_isRoot.size(); ++i)
+	{
+		if (cg.m_isRoot[i])
+		{
+			isReachable[i] = true;
+			stack.push_back(static_cast<wabt::Index>(i));
+		}
+	}
+
+	while (stack.size() > 0)
+	{
+		wabt::Index funcIdx = stack.back();
+		stack.pop_back();
+
+		for (const auto* nexts : { &cg.m_callees[funcIdx],
+			&cg.m_refFuncs[funcIdx] })
+		{
+			for (wabt::Index next : *nexts)
+			{
+				if ((next < isReachable.size()) && !isReachable[next])
+				{
+					isReachable[next] = true;
+					stack.push_back(next);
+				}
+			}
+		}
+	}
+
+	return isReachable;
+}
+
+struct CallGraphSccState
+{
+	CallGraphSccState(size_t numFuncs) :
+		m_counter(0),
+		m_order(numFuncs, 0),
+		m_lowLink(numFuncs, 0),
+		m_isVisited(numFuncs, false),
+		m_isOnStack(numFuncs, false),
+		m_stack()
+	{}
+
+	size_t m_counter;
+	std::vector<size_t> m_order;
+	std::vector<size_t> m_lowLink;
+	std::vector<bool> m_isVisited;
+	std::vector<bool> m_isOnStack;
+	std::vector<wabt::Index> m_stack;
+}; // struct CallGraphSccState
+
+inline void VisitCallGraphScc(
+	const CallGraph& cg,
+	wabt::Index funcIdx,
+	CallGraphSccState& state,
+	std::vector<std::vector<wabt::Index> >& sccs)
+{
+	state.m_isVisited[funcIdx] = true;
+	state.m_order[funcIdx] = state.m_lowLink[funcIdx] = state.m_counter++;
+	state.m_stack.push_back(funcIdx);
+	state.m_isOnStack[funcIdx] = true;
+
+	for (wabt::Index callee : cg.m_callees[funcIdx])
+	{
+		if (callee >= cg.m_callees.size())
+		{
+			continue;
+		}
+
+		if (!state.m_isVisited[callee])
+		{
+			VisitCallGraphScc(cg, callee, state, sccs);
+			state.m_lowLink[funcIdx] =
+				std::min(state.m_lowLink[funcIdx], state.m_lowLink[callee]);
+		}
+		else if (state.m_isOnStack[callee])
+		{
+			state.m_lowLink[funcIdx] =
+				std::min(state.m_lowLink[funcIdx], state.m_order[callee]);
+		}
+	}
+
+	if (state.m_lowLink[funcIdx] == state.m_order[funcIdx])
+	{
+		// funcIdx is the root of a strongly connected component
+		std::vector<wabt::Index> scc;
+		wabt::Index member = wabt::kInvalidIndex;
+		do
+		{
+			member = state.m_stack.back();
+			state.m_stack.pop_back();
+			state.m_isOnStack[member] = false;
+			scc.push_back(member);
+		} while (member != funcIdx);
+
+		sccs.emplace_back(std::move(scc));
+	}
+}
+
+/**
+ * @brief Get strongly connected components of the call graph (Tarjan's
+ *        algorithm). The components are returned in reverse topological
+ *        order, i.e., callees come before their callers.
+*/
+inline std::vector<std::vector<wabt::Index> > GetCallGraphSccs(
+	const CallGraph& cg)
+{
+	std::vector<std::vector<wabt::Index> > sccs;
+	CallGraphSccState state(cg.m_callees.size());
+
+	for (size_t i = 0; i < cg.m_callees.size(); ++i)
+	{
+		if (!state.m_isVisited[i])
+		{
+			VisitCallGraphScc(cg, static_cast<wabt::Index>(i), state, sccs);
+		}
+	}
+
+	return sccs;
+}
+
+inline bool IsFuncRecursive(
+	const CallGraph& cg,
+	const std::vector<wabt::Index>& scc)
+{
+	if (scc.size() > 1)
+	{
+		return true;
+	}
+	const auto& callees = cg.m_callees[scc[0]];
+	return std::binary_search(callees.begin(), callees.end(), scc[0]);
+}
+
+} // namespace DecentWasmCounter
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <src/cast.h>
 #include <src/ir.h>
 
 #include <DecentWasmCounter/Exceptions.hpp>
@@ -12,12 +13,21 @@
 namespace DecentWasmCounter
 {
 
-inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
+enum class ExprFlowKind
+{
+	NonControlFlow,
+	ControlFlow,
+	// Not supported yet, since we don't know how it affects the block flow
+	Unsupported,
+}; // enum class ExprFlowKind
+
+inline ExprFlowKind GetExprFlowKind(wabt::ExprType exprType) noexcept
 {
 	// TODO: double check these instruction types
 	switch (exprType)
 	{
-	// TODO: check if these instruction has effect on the execution flow
+	// non-control flow (`memory.atomic.wait` may block the thread, but the
+	// execution always continues with the next expr)
 	case wabt::ExprType::AtomicLoad:
 	case wabt::ExprType::AtomicRmw:
 	case wabt::ExprType::AtomicRmwCmpxchg:
@@ -25,24 +35,24 @@ inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
 	case wabt::ExprType::AtomicNotify:
 	case wabt::ExprType::AtomicFence:
 	case wabt::ExprType::AtomicWait:
-		throw Exception("Unimplemented feature");
+		return ExprFlowKind::NonControlFlow;
 
 	// non-control flow
 	case wabt::ExprType::Binary:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
 	// control flow
 	case wabt::ExprType::Block:
 	case wabt::ExprType::Br:
 	case wabt::ExprType::BrIf:
 	case wabt::ExprType::BrTable:
-		return true;
+		return ExprFlowKind::ControlFlow;
 
 	// these ARE control flow expr, but it doesn't affect our block flow
 	case wabt::ExprType::Call:
 	case wabt::ExprType::CallIndirect:
 	case wabt::ExprType::CallRef:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
 	// non-control flow
 	case wabt::ExprType::CodeMetadata:
@@ -52,22 +62,22 @@ inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
 	case wabt::ExprType::Drop:
 	case wabt::ExprType::GlobalGet:
 	case wabt::ExprType::GlobalSet:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
 	// TODO: check if these instruction has effect on the execution flow
 	case wabt::ExprType::If:
-		throw Exception("Unimplemented feature");
+		return ExprFlowKind::Unsupported;
 
 	// non-control flow
 	case wabt::ExprType::Load:
 	case wabt::ExprType::LocalGet:
 	case wabt::ExprType::LocalSet:
 	case wabt::ExprType::LocalTee:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
 	// control flow
 	case wabt::ExprType::Loop:
-		return true;
+		return ExprFlowKind::ControlFlow;
 
 	// non-control flow
 	case wabt::ExprType::MemoryCopy:
@@ -80,27 +90,33 @@ inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
 	case wabt::ExprType::RefIsNull:
 	case wabt::ExprType::RefFunc:
 	case wabt::ExprType::RefNull:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
-	// TODO: check if these instruction has effect on the execution flow
+	// control flow (the exception goes to a handler, or leaves the func)
 	case wabt::ExprType::Rethrow:
-		throw Exception("Unimplemented feature");
+		return ExprFlowKind::ControlFlow;
 
 	// control flow
 	case wabt::ExprType::Return:
-		return true;
+		return ExprFlowKind::ControlFlow;
 
-	// TODO: check if these instruction has effect on the execution flow
+	// control flow (tail calls terminate the func, like return)
 	case wabt::ExprType::ReturnCall:
 	case wabt::ExprType::ReturnCallIndirect:
+		return ExprFlowKind::ControlFlow;
+
+	// TODO: check if these instruction has effect on the execution flow
 	case wabt::ExprType::Select:
+		return ExprFlowKind::Unsupported;
+
+	// non-control flow (SIMD)
 	case wabt::ExprType::SimdLaneOp:
 	case wabt::ExprType::SimdLoadLane:
 	case wabt::ExprType::SimdStoreLane:
 	case wabt::ExprType::SimdShuffleOp:
 	case wabt::ExprType::LoadSplat:
 	case wabt::ExprType::LoadZero:
-		throw Exception("Unimplemented feature");
+		return ExprFlowKind::NonControlFlow;
 
 	// non-control flow
 	case wabt::ExprType::Store:
@@ -113,18 +129,34 @@ inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
 	case wabt::ExprType::TableSet:
 	case wabt::ExprType::TableFill:
 	case wabt::ExprType::Ternary:
-		return false;
+		return ExprFlowKind::NonControlFlow;
 
-	// TODO: check if these instruction has effect on the execution flow
+	// control flow (the exception goes to a handler, or leaves the func)
 	case wabt::ExprType::Throw:
 	case wabt::ExprType::Try:
-		throw Exception("Unimplemented feature");
+		return ExprFlowKind::ControlFlow;
 
 	// non-control flow
 	case wabt::ExprType::Unary:
+		return ExprFlowKind::NonControlFlow;
+
+	// control flow (trap, the execution never continues)
 	case wabt::ExprType::Unreachable:
-		return false;
+		return ExprFlowKind::ControlFlow;
 
+	default:
+		return ExprFlowKind::Unsupported;
+	}
+}
+
+inline bool IsEffectiveControlFlowExpr(wabt::ExprType exprType)
+{
+	switch (GetExprFlowKind(exprType))
+	{
+	case ExprFlowKind::ControlFlow:
+		return true;
+	case ExprFlowKind::NonControlFlow:
+		return false;
 	default:
 		throw Exception("Unimplemented feature");
 	}
@@ -138,6 +170,7 @@ inline bool IsBlockLikeDecl(wabt::ExprType exprType)
 		{
 		case wabt::ExprType::Block:
 		case wabt::ExprType::Loop:
+		case wabt::ExprType::Try:
 			return true;
 		default:
 			return false;
@@ -146,4 +179,105 @@ inline bool IsBlockLikeDecl(wabt::ExprType exprType)
 	return false;
 }
 
+/**
+ * @brief Whether an exception can be raised by the given type of expr, and
+ *        caught by a handler in the same function.
+ *        NOTE: exceptions raised by the callee of a tail call can't be caught
+ *        by the caller, since the caller's frame is already gone.
+*/
+inline bool IsMayThrowExpr(wabt::ExprType exprType)
+{
+	switch (exprType)
+	{
+	case wabt::ExprType::Call:
+	case wabt::ExprType::CallIndirect:
+	case wabt::ExprType::CallRef:
+	case wabt::ExprType::Throw:
+	case wabt::ExprType::Rethrow:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Whether the given type of expr carries an opcode that identifies
+ *        the exact instruction (e.g., `i32.add` for a Binary expr)
+*/
+inline bool HasExprOpcode(wabt::ExprType exprType)
+{
+	switch (exprType)
+	{
+	case wabt::ExprType::AtomicLoad:
+	case wabt::ExprType::AtomicRmw:
+	case wabt::ExprType::AtomicRmwCmpxchg:
+	case wabt::ExprType::AtomicStore:
+	case wabt::ExprType::AtomicNotify:
+	case wabt::ExprType::AtomicWait:
+	case wabt::ExprType::Binary:
+	case wabt::ExprType::Compare:
+	case wabt::ExprType::Convert:
+	case wabt::ExprType::Load:
+	case wabt::ExprType::LoadSplat:
+	case wabt::ExprType::LoadZero:
+	case wabt::ExprType::SimdLaneOp:
+	case wabt::ExprType::SimdLoadLane:
+	case wabt::ExprType::SimdStoreLane:
+	case wabt::ExprType::SimdShuffleOp:
+	case wabt::ExprType::Store:
+	case wabt::ExprType::Ternary:
+	case wabt::ExprType::Unary:
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline wabt::Opcode GetExprOpcode(const wabt::Expr& expr)
+{
+	switch (expr.type())
+	{
+	case wabt::ExprType::AtomicLoad:
+		return wabt::cast<const wabt::AtomicLoadExpr>(&expr)->opcode;
+	case wabt::ExprType::AtomicRmw:
+		return wabt::cast<const wabt::AtomicRmwExpr>(&expr)->opcode;
+	case wabt::ExprType::AtomicRmwCmpxchg:
+		return wabt::cast<const wabt::AtomicRmwCmpxchgExpr>(&expr)->opcode;
+	case wabt::ExprType::AtomicStore:
+		return wabt::cast<const wabt::AtomicStoreExpr>(&expr)->opcode;
+	case wabt::ExprType::AtomicNotify:
+		return wabt::cast<const wabt::AtomicNotifyExpr>(&expr)->opcode;
+	case wabt::ExprType::AtomicWait:
+		return wabt::cast<const wabt::AtomicWaitExpr>(&expr)->opcode;
+	case wabt::ExprType::Binary:
+		return wabt::cast<const wabt::BinaryExpr>(&expr)->opcode;
+	case wabt::ExprType::Compare:
+		return wabt::cast<const wabt::CompareExpr>(&expr)->opcode;
+	case wabt::ExprType::Convert:
+		return wabt::cast<const wabt::ConvertExpr>(&expr)->opcode;
+	case wabt::ExprType::Load:
+		return wabt::cast<const wabt::LoadExpr>(&expr)->opcode;
+	case wabt::ExprType::LoadSplat:
+		return wabt::cast<const wabt::LoadSplatExpr>(&expr)->opcode;
+	case wabt::ExprType::LoadZero:
+		return wabt::cast<const wabt::LoadZeroExpr>(&expr)->opcode;
+	case wabt::ExprType::SimdLaneOp:
+		return wabt::cast<const wabt::SimdLaneOpExpr>(&expr)->opcode;
+	case wabt::ExprType::SimdLoadLane:
+		return wabt::cast<const wabt::SimdLoadLaneExpr>(&expr)->opcode;
+	case wabt::ExprType::SimdStoreLane:
+		return wabt::cast<const wabt::SimdStoreLaneExpr>(&expr)->opcode;
+	case wabt::ExprType::SimdShuffleOp:
+		return wabt::cast<const wabt::SimdShuffleOpExpr>(&expr)->opcode;
+	case wabt::ExprType::Store:
+		return wabt::cast<const wabt::StoreExpr>(&expr)->opcode;
+	case wabt::ExprType::Ternary:
+		return wabt::cast<const wabt::TernaryExpr>(&expr)->opcode;
+	case wabt::ExprType::Unary:
+		return wabt::cast<const wabt::UnaryExpr>(&expr)->opcode;
+	default:
+		throw Exception("The given expr doesn't carry an opcode");
+	}
+}
+
 } // namespace DecentWasmCounter
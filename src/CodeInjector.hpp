@@ -5,16 +5,21 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <src/ir.h>
 #include <src/cast.h>
 
+#include <DecentWasmCounter/Config.hpp>
 #include <DecentWasmCounter/Exceptions.hpp>
 
 #include "Block.hpp"
 #include "Classification.hpp"
+#include "ExprWalker.hpp"
+#include "WeightCalculator.hpp"
 #include "make_unique.hpp"
 
 namespace DecentWasmCounter
@@ -22,13 +27,135 @@ namespace DecentWasmCounter
 
 struct InjectedSymbolInfo
 {
-	size_t m_thrId;
-	size_t m_ctrId;
+	// global index of threshold and counter, one per cost dimension
+	std::vector<size_t> m_thrIds;
+	std::vector<size_t> m_ctrIds;
+	// global index of the batched deltas not yet flushed to the aggregate
+	// budget slots, one per cost dimension (empty if it's disabled)
+	std::vector<size_t> m_pendingIds;
 
 	size_t m_funcExceedId;
+	// called instead of m_funcExceedId when the aggregate budget is
+	// exceeded; wabt::kInvalidIndex if it's not imported
+	size_t m_funcAggrExceedId;
 	size_t m_funcIncrId;
+	// wabt::kInvalidIndex if the aggregate budget is disabled
+	size_t m_funcFlushId;
+
+	bool IsInjectedFunc(size_t funcIdx) const
+	{
+		return (funcIdx == m_funcIncrId) || (funcIdx == m_funcFlushId);
+	}
 }; // struct InjectedSymbolInfo
 
+inline size_t GetULeb128Size(uint64_t val)
+{
+	size_t size = 1;
+	while (val >= 0x80U)
+	{
+		val >>= 7;
+		++size;
+	}
+	return size;
+}
+
+inline size_t GetSLeb128Size(int64_t val)
+{
+	size_t size = 1;
+	while ((val < -0x40) || (val >= 0x40))
+	{
+		// arithmetic shift keeps the sign
+		val = (val < 0) ? ~((~val) >> 7) : (val >> 7);
+		++size;
+	}
+	return size;
+}
+
+/**
+ * @brief Get the size of the given expr in the binary format.
+ *        This only covers the exprs we inject; any other expr is
+ *        estimated as a single-byte opcode.
+*/
+inline size_t GetInjectedExprSize(const wabt::Expr& expr)
+{
+	switch (expr.type())
+	{
+	case wabt::ExprType::Const:
+	{
+		const wabt::Const& c = wabt::cast<const wabt::ConstExpr>(&expr)->const_;
+		if (c.type() == wabt::Type::I64)
+		{
+			return 1 + GetSLeb128Size(static_cast<int64_t>(c.u64()));
+		}
+		return 1 + GetSLeb128Size(static_cast<int32_t>(c.u32()));
+	}
+	case wabt::ExprType::Call:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::CallExpr>(&expr)->var.index());
+	case wabt::ExprType::LocalGet:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::LocalGetExpr>(&expr)->var.index());
+	case wabt::ExprType::LocalSet:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::LocalSetExpr>(&expr)->var.index());
+	case wabt::ExprType::LocalTee:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::LocalTeeExpr>(&expr)->var.index());
+	case wabt::ExprType::GlobalGet:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::GlobalGetExpr>(&expr)->var.index());
+	case wabt::ExprType::GlobalSet:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::GlobalSetExpr>(&expr)->var.index());
+	case wabt::ExprType::BrIf:
+		return 1 + GetULeb128Size(
+			wabt::cast<const wabt::BrIfExpr>(&expr)->var.index());
+	case wabt::ExprType::AtomicLoad:
+		// prefix, opcode, alignment, offset
+		return 3 + GetULeb128Size(
+			wabt::cast<const wabt::AtomicLoadExpr>(&expr)->offset);
+	case wabt::ExprType::AtomicRmw:
+		return 3 + GetULeb128Size(
+			wabt::cast<const wabt::AtomicRmwExpr>(&expr)->offset);
+	case wabt::ExprType::Block:
+	{
+		// block, block type, ..., end
+		size_t size = 3;
+		for (const auto& e :
+			wabt::cast<const wabt::BlockExpr>(&expr)->block.exprs)
+		{
+			size += GetInjectedExprSize(e);
+		}
+		return size;
+	}
+	default:
+		return 1;
+	}
+}
+
+/**
+ * @brief Records what has been injected into a function
+*/
+struct InjectionStats
+{
+	InjectionStats() :
+		m_numCounters(0),
+		m_numExprs(0),
+		m_numBytes(0)
+	{}
+
+	void AddExpr(const wabt::Expr& expr)
+	{
+		++m_numExprs;
+		m_numBytes += GetInjectedExprSize(expr);
+	}
+
+	// Number of calls to the increment function
+	size_t m_numCounters;
+	size_t m_numExprs;
+	size_t m_numBytes;
+}; // struct InjectionStats
+
 inline bool IsFuncTypeFieldExist(
 	const wabt::FuncSignature& sig,
 	const std::vector<wabt::TypeEntry*>& types)
@@ -67,32 +194,32 @@ inline void AddFuncTypeIfNotExist(
 	}
 }
 
-inline InjectedSymbolInfo InjectCounterAndFunc(wabt::Module& mod)
+inline size_t AppendI64MutGlobal(wabt::Module& mod)
 {
-	InjectedSymbolInfo info;
-
-	// # threshold
-	info.m_thrId = mod.globals.size();
-	std::unique_ptr<wabt::GlobalModuleField> globalThr =
+	size_t idx = mod.globals.size();
+	std::unique_ptr<wabt::GlobalModuleField> global =
 		Internal::make_unique<wabt::GlobalModuleField>();
-	globalThr->global.type = wabt::Type::I64;
-	globalThr->global.mutable_ = true;
-	globalThr->global.init_expr.push_back(
+	global->global.type = wabt::Type::I64;
+	global->global.mutable_ = true;
+	global->global.init_expr.push_back(
 		Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(0)));
 
-	mod.AppendField(std::move(globalThr));
-
-	// # global counter
-	info.m_ctrId = mod.globals.size();
-	std::unique_ptr<wabt::GlobalModuleField> globalCtr =
-		Internal::make_unique<wabt::GlobalModuleField>();
-	globalCtr->global.type = wabt::Type::I64;
-	globalCtr->global.mutable_ = true;
-	globalCtr->global.init_expr.push_back(
-		Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(0)));
+	mod.AppendField(std::move(global));
 
-	mod.AppendField(std::move(globalCtr));
+	return idx;
+}
 
+/**
+ * @brief Look for the import of the given notification function (e.g.,
+ *        decent_wasm_counter_exceed), and fix its signature
+ *
+ * @return Index of the imported function
+*/
+inline size_t FixCounterExceedImport(
+	wabt::Module& mod,
+	size_t numDims,
+	const std::string& fieldName = "decent_wasm_counter_exceed")
+{
 	// # modify import function decent_wasm_counter_exceed
 	// - -> Looking for import statement
 	wabt::FuncImport* funcExceed = nullptr;
@@ -102,11 +229,11 @@ inline InjectedSymbolInfo InjectCounterAndFunc(wabt::Module& mod)
 		{
 			wabt::FuncImport* imFunc = wabt::cast<wabt::FuncImport>(im);
 			if (imFunc->module_name == "env" &&
-				imFunc->field_name == "decent_wasm_counter_exceed")
+				imFunc->field_name == fieldName)
 			{
 				if (funcExceed != nullptr)
 				{
-					throw Exception("There are more than one import of decent_wasm_counter_exceed function");
+					throw Exception("There are more than one import of " + fieldName + " function");
 				}
 				else
 				{
@@ -117,116 +244,551 @@ inline InjectedSymbolInfo InjectCounterAndFunc(wabt::Module& mod)
 	}
 	if (funcExceed == nullptr)
 	{
-		throw Exception("Couldn't find import to decent_wasm_counter_exceed function");
+		throw Exception("Couldn't find import to " + fieldName + " function");
 	}
 	// - -> Looking for function index
-	info.m_funcExceedId = wabt::kInvalidIndex;
+	size_t funcExceedId = wabt::kInvalidIndex;
 	for (size_t i = 0; i < mod.funcs.size(); ++i)
 	{
 		if (mod.funcs[i] == &(funcExceed->func))
 		{
-			info.m_funcExceedId = i;
+			funcExceedId = i;
 		}
 	}
-	if (info.m_funcExceedId == wabt::kInvalidIndex)
+	if (funcExceedId == wabt::kInvalidIndex)
 	{
-		throw Exception("Couldn't find the index to decent_wasm_counter_exceed function");
+		throw Exception("Couldn't find the index to " + fieldName + " function");
 	}
 	// - -> validate function format that can't be fixed
 	if (funcExceed->func.local_types.size())
 	{
-		throw Exception("Import to decent_wasm_counter_exceed function has wrong format");
+		throw Exception("Import to " + fieldName + " function has wrong format");
 	}
 	// - -> force to fix function format
+	//      (param i64) for single dimension, or
+	//      (param i64 i32) where the 2nd param is the dimension exceeded
 	funcExceed->func.decl.sig.param_types.clear();
 	funcExceed->func.decl.sig.param_type_names.clear();
 	funcExceed->func.decl.sig.result_types.clear();
 	funcExceed->func.decl.sig.result_type_names.clear();
 	funcExceed->func.decl.sig.param_types.push_back(wabt::Type::I64);
+	if (numDims > 1)
+	{
+		funcExceed->func.decl.sig.param_types.push_back(wabt::Type::I32);
+	}
 	funcExceed->func.decl.has_func_type = false;
 	funcExceed->func.exprs.clear();
 
 	AddFuncTypeIfNotExist(funcExceed->func.decl.sig, mod);
 
+	return funcExceedId;
+}
+
+// Appends the exprs that push a value onto the stack
+using ExprAppender = std::function<void(wabt::ExprList&)>;
+
+/**
+ * @brief Append a block that calls the given notification function (or
+ *        traps) if the total count of the given dimension exceeds its
+ *        threshold
+*/
+inline void AppendExceedCheck(
+	wabt::ExprList& exprs,
+	const ExprAppender& appendTotal,
+	const ExprAppender& appendThreshold,
+	size_t funcExceedId,
+	size_t numDims,
+	size_t dim,
+	ExceedPolicy policy)
+{
+	exprs.push_back(Internal::make_unique<wabt::BlockExpr>());
+	wabt::Block& blk = wabt::cast<wabt::BlockExpr>(&exprs.back())->block;
+
+	appendTotal(blk.exprs);
+	appendThreshold(blk.exprs);
+	blk.exprs.push_back(
+		Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64LeU));
+	blk.exprs.push_back(
+		Internal::make_unique<wabt::BrIfExpr>(wabt::Var(wabt::Index(0))));
+	if (policy == ExceedPolicy::Trap)
+	{
+		// the counter global (or the slot) already keeps the final value
+		blk.exprs.push_back(Internal::make_unique<wabt::UnreachableExpr>());
+		return;
+	}
+	appendTotal(blk.exprs);
+	if (numDims > 1)
+	{
+		blk.exprs.push_back(
+			Internal::make_unique<wabt::ConstExpr>(
+				wabt::Const::I32(static_cast<uint32_t>(dim))));
+	}
+	blk.exprs.push_back(
+		Internal::make_unique<wabt::CallExpr>(
+			wabt::Var(static_cast<wabt::Index>(funcExceedId))));
+}
+
+/**
+ * @brief Build the function that adds the batched deltas to the aggregate
+ *        budget slots, and checks if the aggregate counts exceed the budgets
+*/
+inline std::unique_ptr<wabt::FuncModuleField> BuildAggregateFlushFunc(
+	const wabt::Module& mod,
+	const InjectedSymbolInfo& info,
+	const AggregateBudgetConfig& aggrBudget,
+	ExceedPolicy policy)
+{
+	if (aggrBudget.m_memoryIdx >= mod.memories.size())
+	{
+		throw Exception(
+			"The memory for the aggregate budget doesn't exist");
+	}
+	bool isMem64 = mod.memories[aggrBudget.m_memoryIdx]->page_limits.is_64;
+	wabt::Var memVar(static_cast<wabt::Index>(aggrBudget.m_memoryIdx));
+
+	auto makeAddrExpr = [isMem64](uint64_t addr)
+	{
+		return Internal::make_unique<wabt::ConstExpr>(isMem64 ?
+			wabt::Const::I64(addr) :
+			wabt::Const::I32(static_cast<uint32_t>(addr)));
+	};
+
+	std::unique_ptr<wabt::FuncModuleField> funcFlush =
+		Internal::make_unique<wabt::FuncModuleField>();
+	wabt::ExprList& exprs = funcFlush->func.exprs;
+	// (local $total i64)
+	funcFlush->func.local_types.AppendDecl(wabt::Type::I64, 1);
+	const wabt::Index totalIdx = 0;
+
+	size_t numDims = info.m_pendingIds.size();
+	for (size_t dim = 0; dim < numDims; ++dim)
+	{
+		uint64_t slotAddr = aggrBudget.m_slotOffset + (16 * dim);
+		wabt::Var pendingVar(static_cast<wabt::Index>(info.m_pendingIds[dim]));
+
+		// - -> <slot address>
+		// - -> global.get $pending_d
+		// - -> i64.atomic.rmw.add         ;; returns the old aggregate count
+		// - -> global.get $pending_d
+		// - -> i64.add
+		// - -> local.set $total
+		// - -> i64.const 0
+		// - -> global.set $pending_d
+		exprs.push_back(makeAddrExpr(slotAddr));
+		exprs.push_back(Internal::make_unique<wabt::GlobalGetExpr>(pendingVar));
+		exprs.push_back(Internal::make_unique<wabt::AtomicRmwExpr>(
+			wabt::Opcode::I64AtomicRmwAdd, memVar, 8, 0));
+		exprs.push_back(Internal::make_unique<wabt::GlobalGetExpr>(pendingVar));
+		exprs.push_back(
+			Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Add));
+		exprs.push_back(
+			Internal::make_unique<wabt::LocalSetExpr>(wabt::Var(totalIdx)));
+		exprs.push_back(
+			Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(0)));
+		exprs.push_back(Internal::make_unique<wabt::GlobalSetExpr>(pendingVar));
+
+		// - -> check $total against the budget, like the per-instance check,
+		// - -> but with `<slot address>` and `i64.atomic.load offset=8`
+		AppendExceedCheck(exprs,
+			[&](wabt::ExprList& totalExprs)
+			{
+				totalExprs.push_back(
+					Internal::make_unique<wabt::LocalGetExpr>(
+						wabt::Var(totalIdx)));
+			},
+			[&](wabt::ExprList& thrExprs)
+			{
+				thrExprs.push_back(makeAddrExpr(slotAddr));
+				thrExprs.push_back(Internal::make_unique<wabt::AtomicLoadExpr>(
+					wabt::Opcode::I64AtomicLoad, memVar, 8, 8));
+			},
+			info.m_funcAggrExceedId, numDims, dim, policy);
+	}
+
+	return funcFlush;
+}
+
+/**
+ * @param numDims    Number of cost dimensions; each of them has its own
+ *                   threshold and counter
+ * @param policy     What to do when a counter exceeds its threshold
+ * @param aggrBudget Budget shared by all instances of the module
+*/
+inline InjectedSymbolInfo InjectCounterAndFunc(
+	wabt::Module& mod,
+	size_t numDims,
+	ExceedPolicy policy,
+	const AggregateBudgetConfig& aggrBudget = AggregateBudgetConfig())
+{
+	InjectedSymbolInfo info;
+
+	if (numDims == 0)
+	{
+		throw Exception("At least one cost dimension is needed");
+	}
+
+	for (size_t dim = 0; dim < numDims; ++dim)
+	{
+		// # threshold
+		info.m_thrIds.push_back(AppendI64MutGlobal(mod));
+		// # global counter
+		info.m_ctrIds.push_back(AppendI64MutGlobal(mod));
+	}
+	if (aggrBudget.IsEnabled())
+	{
+		for (size_t dim = 0; dim < numDims; ++dim)
+		{
+			// # batched delta not yet flushed
+			info.m_pendingIds.push_back(AppendI64MutGlobal(mod));
+		}
+	}
+
+	if (policy == ExceedPolicy::Notify)
+	{
+		info.m_funcExceedId = FixCounterExceedImport(mod, numDims);
+	}
+	else
+	{
+		// no need to import decent_wasm_counter_exceed
+		info.m_funcExceedId = wabt::kInvalidIndex;
+	}
+	if ((policy == ExceedPolicy::Notify) && aggrBudget.IsEnabled())
+	{
+		// the host has to tell the aggregate budget apart from the
+		// per-instance threshold, so it's notified by another import
+		info.m_funcAggrExceedId = FixCounterExceedImport(
+			mod, numDims, "decent_wasm_counter_aggregate_exceed");
+	}
+	else
+	{
+		info.m_funcAggrExceedId = wabt::kInvalidIndex;
+	}
+
 	// # function to check
 	info.m_funcIncrId = mod.funcs.size();
+	// # function to flush, right after it
+	info.m_funcFlushId = aggrBudget.IsEnabled() ?
+		(info.m_funcIncrId + 1) : wabt::kInvalidIndex;
 	std::unique_ptr<wabt::FuncModuleField> funcIncr =
 		Internal::make_unique<wabt::FuncModuleField>();
 
-	funcIncr->func.decl.sig.param_types.push_back(wabt::Type::I64);
-	// - -> local.get 0
-	// - -> global.get $counter
-	// - -> i64.add
-	// - -> global.set $counter
+	// one i64 param per dimension
+	// - -> for each dimension d:
+	// - ->		local.get d
+	// - ->		global.get $counter_d
+	// - ->		i64.add
+	// - ->		global.set $counter_d
+	for (size_t dim = 0; dim < numDims; ++dim)
+	{
+		funcIncr->func.decl.sig.param_types.push_back(wabt::Type::I64);
+
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::LocalGetExpr>(
+				wabt::Var(static_cast<wabt::Index>(dim))));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::GlobalGetExpr>(
+				wabt::Var(static_cast<wabt::Index>(info.m_ctrIds[dim]))));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::BinaryExpr>(
+				wabt::Opcode::I64Add));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::GlobalSetExpr>(
+				wabt::Var(static_cast<wabt::Index>(info.m_ctrIds[dim]))));
+	}
+	// - -> for each dimension d (only with the aggregate budget):
+	// - ->		local.get d
+	// - ->		global.get $pending_d
+	// - ->		i64.add
+	// - ->		global.set $pending_d
+	for (size_t dim = 0; dim < info.m_pendingIds.size(); ++dim)
+	{
+		wabt::Var pendingVar(static_cast<wabt::Index>(info.m_pendingIds[dim]));
+
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::LocalGetExpr>(
+				wabt::Var(static_cast<wabt::Index>(dim))));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::GlobalGetExpr>(pendingVar));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::BinaryExpr>(
+				wabt::Opcode::I64Add));
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::GlobalSetExpr>(pendingVar));
+	}
+	// - -> for each dimension d:
 	// - -> block
-	// - ->		global.get $counter
-	// - ->		global.get $threshold
-	// - ->		i64.lt_u
+	// - ->		global.get $counter_d
+	// - ->		global.get $threshold_d
+	// - ->		i64.le_u
 	// - -> 	br_if 0
-	// - ->		global.get $counter
+	// - ->		global.get $counter_d
+	// - ->		i32.const d    ;; only if there are multiple dimensions
 	// - ->		call $ctr_exceed
+	// - ->		;; or, for ExceedPolicy::Trap, only
+	// - ->		unreachable
 	// - -> end
-	funcIncr->func.exprs.push_back(
-		Internal::make_unique<wabt::LocalGetExpr>(
-			wabt::Var(wabt::Index(0))));
-	funcIncr->func.exprs.push_back(
-		Internal::make_unique<wabt::GlobalGetExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_ctrId))));
-	funcIncr->func.exprs.push_back(
-		Internal::make_unique<wabt::BinaryExpr>(
-			wabt::Opcode::I64Add));
-	funcIncr->func.exprs.push_back(
-		Internal::make_unique<wabt::GlobalSetExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_ctrId))));
-	// block
-	funcIncr->func.exprs.push_back(
-		Internal::make_unique<wabt::BlockExpr>());
-	wabt::Block& funcIncrBlock01 =
-		wabt::cast<wabt::BlockExpr>(&funcIncr->func.exprs.back())->block;
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::GlobalGetExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_ctrId))));
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::GlobalGetExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_thrId))));
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::BinaryExpr>(
-			wabt::Opcode::I64LeU));
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::BrIfExpr>(
-			wabt::Var(wabt::Index(0))));
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::GlobalGetExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_ctrId))));
-	funcIncrBlock01.exprs.push_back(
-		Internal::make_unique<wabt::CallExpr>(
-			wabt::Var(static_cast<wabt::Index>(info.m_funcExceedId))));
+	for (size_t dim = 0; dim < numDims; ++dim)
+	{
+		AppendExceedCheck(funcIncr->func.exprs,
+			[&](wabt::ExprList& totalExprs)
+			{
+				totalExprs.push_back(
+					Internal::make_unique<wabt::GlobalGetExpr>(
+						wabt::Var(static_cast<wabt::Index>(
+							info.m_ctrIds[dim]))));
+			},
+			[&](wabt::ExprList& thrExprs)
+			{
+				thrExprs.push_back(
+					Internal::make_unique<wabt::GlobalGetExpr>(
+						wabt::Var(static_cast<wabt::Index>(
+							info.m_thrIds[dim]))));
+			},
+			info.m_funcExceedId, numDims, dim, policy);
+	}
+	// - -> for each dimension d (only with the aggregate budget):
+	// - -> block
+	// - ->		global.get $pending_d
+	// - ->		i64.const interval
+	// - ->		i64.lt_u
+	// - -> 	br_if 0
+	// - ->		call $flush
+	// - -> end
+	for (size_t dim = 0; dim < info.m_pendingIds.size(); ++dim)
+	{
+		funcIncr->func.exprs.push_back(
+			Internal::make_unique<wabt::BlockExpr>());
+		wabt::Block& flushBlock =
+			wabt::cast<wabt::BlockExpr>(&funcIncr->func.exprs.back())->block;
+		flushBlock.exprs.push_back(
+			Internal::make_unique<wabt::GlobalGetExpr>(
+				wabt::Var(static_cast<wabt::Index>(info.m_pendingIds[dim]))));
+		flushBlock.exprs.push_back(
+			Internal::make_unique<wabt::ConstExpr>(
+				wabt::Const::I64(aggrBudget.m_flushInterval)));
+		flushBlock.exprs.push_back(
+			Internal::make_unique<wabt::BinaryExpr>(
+				wabt::Opcode::I64LtU));
+		flushBlock.exprs.push_back(
+			Internal::make_unique<wabt::BrIfExpr>(
+				wabt::Var(wabt::Index(0))));
+		flushBlock.exprs.push_back(
+			Internal::make_unique<wabt::CallExpr>(
+				wabt::Var(static_cast<wabt::Index>(info.m_funcFlushId))));
+	}
 
 	AddFuncTypeIfNotExist(funcIncr->func.decl.sig, mod);
 
 	mod.AppendField(std::move(funcIncr));
 
+	if (aggrBudget.IsEnabled())
+	{
+		std::unique_ptr<wabt::FuncModuleField> funcFlush =
+			BuildAggregateFlushFunc(mod, info, aggrBudget, policy);
+
+		AddFuncTypeIfNotExist(funcFlush->func.decl.sig, mod);
+
+		mod.AppendField(std::move(funcFlush));
+	}
+
 	return info;
 }
 
-inline void InjectBlockCounterExpr(
+inline bool IsExportNameExist(const wabt::Module& mod, const std::string& name)
+{
+	for (const wabt::Export* exp : mod.exports)
+	{
+		if (exp->name == name)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void AppendExport(
+	wabt::Module& mod,
+	const std::string& name,
+	wabt::ExternalKind kind,
+	size_t idx)
+{
+	if (IsExportNameExist(mod, name))
+	{
+		throw Exception("There is already an export named " + name);
+	}
+
+	std::unique_ptr<wabt::ExportModuleField> expField =
+		Internal::make_unique<wabt::ExportModuleField>();
+	expField->export_.name = name;
+	expField->export_.kind = kind;
+	expField->export_.var = wabt::Var(static_cast<wabt::Index>(idx));
+
+	mod.AppendField(std::move(expField));
+}
+
+/**
+ * @brief Get the export name of the global for the given cost dimension;
+ *        the 1st dimension uses the name as it is, and the others get
+ *        a suffix of `_<dimension index>`
+*/
+inline std::string GetDimensionExportName(const std::string& name, size_t dim)
+{
+	return dim == 0 ? name : (name + "_" + std::to_string(dim));
+}
+
+/**
+ * @brief Export counter and threshold globals, so the host can set and read
+ *        them directly
+ *
+ * @param ctrName Export name of the counter global; not exported if empty
+ * @param thrName Export name of the threshold global; not exported if empty
+*/
+inline void ExportCounterAndThreshold(
+	wabt::Module& mod,
+	const InjectedSymbolInfo& symInfo,
+	const std::string& ctrName,
+	const std::string& thrName)
+{
+	for (size_t dim = 0; dim < symInfo.m_ctrIds.size(); ++dim)
+	{
+		if (!ctrName.empty())
+		{
+			AppendExport(mod, GetDimensionExportName(ctrName, dim),
+				wabt::ExternalKind::Global, symInfo.m_ctrIds[dim]);
+		}
+		if (!thrName.empty())
+		{
+			AppendExport(mod, GetDimensionExportName(thrName, dim),
+				wabt::ExternalKind::Global, symInfo.m_thrIds[dim]);
+		}
+	}
+}
+
+/**
+ * @brief Inject a function that sets the threshold(s) and then calls the
+ *        exported entry function, and export it in the name of `wrapperName`
+ *
+ * @return Index of the injected function
+*/
+inline size_t InjectEntryWrapper(
+	wabt::Module& mod,
+	const InjectedSymbolInfo& symInfo,
+	const std::string& entryName,
+	const std::string& wrapperName)
+{
+	// # look for the entry function
+	const wabt::Export* entryExp = nullptr;
+	for (const wabt::Export* exp : mod.exports)
+	{
+		if (exp->name == entryName)
+		{
+			entryExp = exp;
+		}
+	}
+	if ((entryExp == nullptr) || (entryExp->kind != wabt::ExternalKind::Func))
+	{
+		throw Exception("Couldn't find the exported function " + entryName);
+	}
+	wabt::Index entryIdx = mod.GetFuncIndex(entryExp->var);
+	const wabt::FuncSignature entrySig = mod.funcs[entryIdx]->decl.sig;
+
+	if (IsExportNameExist(mod, wrapperName))
+	{
+		throw Exception("There is already an export named " + wrapperName);
+	}
+
+	// # wrapper function
+	// (param <entry params>... i64 <one per dimension>...)
+	// (result <entry results>...)
+	size_t wrapperIdx = mod.funcs.size();
+	std::unique_ptr<wabt::FuncModuleField> wrapper =
+		Internal::make_unique<wabt::FuncModuleField>();
+	wrapper->func.decl.sig.param_types = entrySig.param_types;
+	wrapper->func.decl.sig.result_types = entrySig.result_types;
+
+	wabt::Index numEntryParams =
+		static_cast<wabt::Index>(entrySig.param_types.size());
+
+	// - -> for each dimension d:
+	// - ->		local.get <threshold param d>
+	// - ->		global.set $threshold_d
+	for (size_t dim = 0; dim < symInfo.m_thrIds.size(); ++dim)
+	{
+		wrapper->func.decl.sig.param_types.push_back(wabt::Type::I64);
+
+		wrapper->func.exprs.push_back(
+			Internal::make_unique<wabt::LocalGetExpr>(
+				wabt::Var(numEntryParams + static_cast<wabt::Index>(dim))));
+		wrapper->func.exprs.push_back(
+			Internal::make_unique<wabt::GlobalSetExpr>(
+				wabt::Var(static_cast<wabt::Index>(symInfo.m_thrIds[dim]))));
+	}
+	// - -> local.get 0 ... local.get (n - 1)
+	// - -> call $entry
+	for (wabt::Index i = 0; i < numEntryParams; ++i)
+	{
+		wrapper->func.exprs.push_back(
+			Internal::make_unique<wabt::LocalGetExpr>(wabt::Var(i)));
+	}
+	wrapper->func.exprs.push_back(
+		Internal::make_unique<wabt::CallExpr>(wabt::Var(entryIdx)));
+
+	AddFuncTypeIfNotExist(wrapper->func.decl.sig, mod);
+
+	mod.AppendField(std::move(wrapper));
+
+	AppendExport(mod, wrapperName, wabt::ExternalKind::Func, wrapperIdx);
+
+	return wrapperIdx;
+}
+
+/**
+ * @return The iterator to the injected call to the increment function
+*/
+inline wabt::ExprList::iterator InjectBlockCounterExpr(
 	wabt::ExprList& exprList,
 	wabt::ExprList::iterator exprIt,
-	size_t weight,
-	wabt::Index ctrFuncIdx)
+	const std::vector<size_t>& weights,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
 {
-	// i64.const weight
+	// i64.const weight_0
+	// ...
+	// i64.const weight_(K-1)
 	// call $incr
 
 	exprIt = exprList.insert(exprIt,
 		Internal::make_unique<wabt::CallExpr>(
 			wabt::Var(ctrFuncIdx)));
-	exprIt = exprList.insert(exprIt,
-		Internal::make_unique<wabt::ConstExpr>(
-			wabt::Const::I64(weight)));
+	stats.AddExpr(*exprIt);
+	auto callIt = exprIt;
+	for (auto it = weights.rbegin(); it != weights.rend(); ++it)
+	{
+		exprIt = exprList.insert(exprIt,
+			Internal::make_unique<wabt::ConstExpr>(
+				wabt::Const::I64(*it)));
+		stats.AddExpr(*exprIt);
+	}
+	++stats.m_numCounters;
+
+	return callIt;
 }
 
-inline void InjectBlockCounter(Block* head, wabt::Index ctrFuncIdx)
+// Called with each block and the call to the increment function injected
+// for it
+using BlockCounterCallback =
+	std::function<void(const Block&, const wabt::Expr&)>;
+
+/**
+ * @param isZeroWeightCounted Inject counters for blocks with zero weights as
+ *                            well, so they can be repriced later
+*/
+inline void InjectBlockCounter(
+	Block* head,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats,
+	bool isZeroWeightCounted = false,
+	const BlockCounterCallback& onInjected = BlockCounterCallback())
 {
 	if ((head != nullptr))
 	{
@@ -239,37 +801,211 @@ inline void InjectBlockCounter(Block* head, wabt::Index ctrFuncIdx)
 		{
 			head->m_isCtrInjected = true;
 
-			if (head->m_weight > 0)
+			if (head->HasWeight() || isZeroWeightCounted)
 			{
-				// Only inject if weight > 0
+				// Only inject if any weight > 0, unless zero weights are counted
 
-				if (IsEffectiveControlFlowExpr(head->m_blkLstExprType) &&
-					!IsBlockLikeDecl(head->m_blkLstExprType))
+				auto injectPos = head->m_blkEnd;
+				if (head->IsLastExprJump())
 				{
-					// Last statement is a branch expr
-					auto exprBeforeBr = head->GetBlkLastExpr(1);
-
-					InjectBlockCounterExpr(*head->m_exprList,
-						exprBeforeBr,
-						head->m_weight,
-						ctrFuncIdx);
+					// Last statement is a branch expr, or a call that may
+					// throw into a handler
+					injectPos = head->GetBlkLastExpr(1);
 				}
-				else
+
+				auto callIt = InjectBlockCounterExpr(*head->m_exprList,
+					injectPos,
+					head->m_weights,
+					ctrFuncIdx,
+					stats);
+				if (onInjected)
 				{
-					InjectBlockCounterExpr(*head->m_exprList,
-						head->m_blkEnd,
-						head->m_weight,
-						ctrFuncIdx);
+					onInjected(*head, *callIt);
 				}
 			}
 
 			// Recursive on children
 			for (auto& child : head->m_children)
 			{
-				InjectBlockCounter(child.m_ptr, ctrFuncIdx);
+				InjectBlockCounter(child.m_ptr, ctrFuncIdx, stats,
+					isZeroWeightCounted, onInjected);
 			}
 		}
 	}
 }
 
+/**
+ * @brief Scratch locals appended to a function on demand, one per value type
+*/
+class ScratchLocals
+{
+public:
+	explicit ScratchLocals(wabt::Func& func) :
+		m_func(func),
+		m_locals()
+	{}
+
+	virtual ~ScratchLocals() = default;
+
+	wabt::Index Get(wabt::Type type)
+	{
+		for (const auto& local : m_locals)
+		{
+			if (local.first == type)
+			{
+				return local.second;
+			}
+		}
+
+		wabt::Index idx = m_func.GetNumParamsAndLocals();
+		m_func.local_types.AppendDecl(type, 1);
+		m_locals.emplace_back(type, idx);
+		return idx;
+	}
+
+private:
+	wabt::Func& m_func;
+	std::vector<std::pair<wabt::Type, wabt::Index> > m_locals;
+}; // class ScratchLocals
+
+inline bool IsMemory64(const wabt::Module& mod, const wabt::Var& memVar)
+{
+	wabt::Index memIdx = mod.GetMemoryIndex(memVar);
+	return (memIdx < mod.memories.size()) &&
+		mod.memories[memIdx]->page_limits.is_64;
+}
+
+/**
+ * @brief Get the type of the size operand of a size-dependent instruction
+ *
+ * @return i64 if the size addresses a memory64 memory, otherwise, i32;
+ *         the length of memory.init is an offset into the data segment,
+ *         so it's always i32
+*/
+inline wabt::Type GetDynamicSizeType(
+	const wabt::Module& mod,
+	const wabt::Expr& expr)
+{
+	bool is64 = false;
+	switch (expr.type())
+	{
+	case wabt::ExprType::MemoryFill:
+		is64 = IsMemory64(mod,
+			wabt::cast<wabt::MemoryFillExpr>(&expr)->memidx);
+		break;
+	case wabt::ExprType::MemoryGrow:
+		is64 = IsMemory64(mod,
+			wabt::cast<wabt::MemoryGrowExpr>(&expr)->memidx);
+		break;
+	case wabt::ExprType::MemoryCopy:
+	{
+		// copying between a 32-bit and a 64-bit memory takes an i32 size
+		const auto* copyExpr = wabt::cast<wabt::MemoryCopyExpr>(&expr);
+		is64 = IsMemory64(mod, copyExpr->srcmemidx) &&
+			IsMemory64(mod, copyExpr->destmemidx);
+		break;
+	}
+	default:
+		break;
+	}
+	return is64 ? wabt::Type::I64 : wabt::Type::I32;
+}
+
+inline void InjectDynamicCounterExpr(
+	wabt::ExprList& exprList,
+	wabt::ExprList::iterator exprIt,
+	const std::vector<DynamicCost>& costs,
+	wabt::Type sizeType,
+	wabt::Index scratchIdx,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
+{
+	// The size operand is on the top of the stack
+	// local.tee $scratch
+	// - -> for each dimension d:
+	// - ->		local.get $scratch
+	// - ->		i64.extend_i32_u    ;; if the size operand is i32
+	// - ->		i64.const shift     ;; if shift > 0
+	// - ->		i64.shr_u           ;; if shift > 0
+	// - ->		i64.const perUnit
+	// - ->		i64.mul
+	// - -> (or i64.const 0 if the dimension doesn't charge it)
+	// call $incr
+
+	stats.AddExpr(*exprList.insert(exprIt,
+		Internal::make_unique<wabt::LocalTeeExpr>(wabt::Var(scratchIdx))));
+	for (const DynamicCost& cost : costs)
+	{
+		if (cost.m_perUnit == 0)
+		{
+			stats.AddExpr(*exprList.insert(exprIt,
+				Internal::make_unique<wabt::ConstExpr>(wabt::Const::I64(0))));
+			continue;
+		}
+
+		stats.AddExpr(*exprList.insert(exprIt,
+			Internal::make_unique<wabt::LocalGetExpr>(
+				wabt::Var(scratchIdx))));
+		if (sizeType == wabt::Type::I32)
+		{
+			stats.AddExpr(*exprList.insert(exprIt,
+				Internal::make_unique<wabt::ConvertExpr>(
+					wabt::Opcode::I64ExtendI32U)));
+		}
+		if (cost.m_unitShift > 0)
+		{
+			stats.AddExpr(*exprList.insert(exprIt,
+				Internal::make_unique<wabt::ConstExpr>(
+					wabt::Const::I64(cost.m_unitShift))));
+			stats.AddExpr(*exprList.insert(exprIt,
+				Internal::make_unique<wabt::BinaryExpr>(
+					wabt::Opcode::I64ShrU)));
+		}
+		stats.AddExpr(*exprList.insert(exprIt,
+			Internal::make_unique<wabt::ConstExpr>(
+				wabt::Const::I64(cost.m_perUnit))));
+		stats.AddExpr(*exprList.insert(exprIt,
+			Internal::make_unique<wabt::BinaryExpr>(wabt::Opcode::I64Mul)));
+	}
+	stats.AddExpr(*exprList.insert(exprIt,
+		Internal::make_unique<wabt::CallExpr>(wabt::Var(ctrFuncIdx))));
+	++stats.m_numCounters;
+}
+
+/**
+ * @brief Inject code to charge runtime-proportional cost right before each
+ *        size-dependent instruction in the function
+ *
+ * @param mod The module the function belongs to, which is used to look up
+ *            the memories addressed by memory instructions
+*/
+inline void InjectDynamicCounter(
+	const wabt::Module& mod,
+	wabt::Func& func,
+	const DynamicWeightMapType& dynWeightMap,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
+{
+	if (dynWeightMap.empty())
+	{
+		return;
+	}
+
+	ScratchLocals scratch(func);
+
+	WalkExprListIterator(func.exprs,
+		[&](wabt::ExprList& exprList, wabt::ExprList::iterator exprIt)
+		{
+			auto itCost = dynWeightMap.find(exprIt->type());
+			if (itCost != dynWeightMap.cend())
+			{
+				wabt::Type sizeType = GetDynamicSizeType(mod, *exprIt);
+
+				InjectDynamicCounterExpr(exprList, exprIt, itCost->second,
+					sizeType, scratch.Get(sizeType), ctrFuncIdx, stats);
+			}
+		}
+	);
+}
+
 } // namespace DecentWasmCounter
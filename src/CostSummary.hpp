@@ -0,0 +1,218 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <src/ir.h>
+
+#include "Block.hpp"
+#include "BlockGenerator.hpp"
+#include "CallGraph.hpp"
+#include "ExprWalker.hpp"
+#include "WeightCalculator.hpp"
+
+namespace DecentWasmCounter
+{
+
+inline bool IsFuncLoopFree(const wabt::Func& func)
+{
+	bool hasLoop = false;
+	WalkExprList(func.exprs,
+		[&hasLoop](const wabt::Expr& expr)
+		{
+			hasLoop = hasLoop || (expr.type() == wabt::ExprType::Loop);
+		}
+	);
+	return !hasLoop;
+}
+
+/**
+ * @brief Calculate the maximum total weight (of the given cost dimension)
+ *        of blocks along any path starting from the given block.
+ *        The graph must be acyclic.
+*/
+inline size_t CalcMaxPathWeight(
+	const Block* head,
+	size_t dim,
+	std::unordered_map<const Block*, size_t>& memo)
+{
+	if (head == nullptr)
+	{
+		return 0;
+	}
+
+	auto it = memo.find(head);
+	if (it != memo.end())
+	{
+		return it->second;
+	}
+
+	size_t maxChildWeight = 0;
+	for (const auto& child : head->m_children)
+	{
+		maxChildWeight = std::max(
+			maxChildWeight,
+			CalcMaxPathWeight(child.m_ptr, dim, memo));
+	}
+
+	size_t res = head->m_weights[dim] + maxChildWeight;
+	memo.insert(std::make_pair(head, res));
+	return res;
+}
+
+/**
+ * @brief Calculate the minimum total weight (of the given cost dimension)
+ *        of blocks along any path starting from the given block, until the
+ *        function ends or a branch goes into a loop.
+ *        The graph must be acyclic.
+*/
+inline size_t CalcMinPathWeight(
+	const Block* head,
+	size_t dim,
+	std::unordered_map<const Block*, size_t>& memo)
+{
+	if (head == nullptr)
+	{
+		return 0;
+	}
+
+	auto it = memo.find(head);
+	if (it != memo.end())
+	{
+		return it->second;
+	}
+
+	// a `br_if` without the fall-through child falls off the function end,
+	// and so does a call that may throw into a handler
+	bool canEnd = head->m_children.empty() ||
+		((head->m_blkLstExprType == wabt::ExprType::BrIf) &&
+			(head->m_children.size() < 2)) ||
+		(!IsEffectiveControlFlowExpr(head->m_blkLstExprType) &&
+			std::all_of(head->m_children.begin(), head->m_children.end(),
+				[](const BlockChild& child)
+				{
+					return child.m_brType == BrType::IntoHandler;
+				}));
+
+	size_t minChildWeight = canEnd ? 0 : std::numeric_limits<size_t>::max();
+	for (const auto& child : head->m_children)
+	{
+		minChildWeight = std::min(
+			minChildWeight,
+			CalcMinPathWeight(child.m_ptr, dim, memo));
+	}
+
+	size_t res = head->m_weights[dim] + minChildWeight;
+	memo.insert(std::make_pair(head, res));
+	return res;
+}
+
+/**
+ * @brief Get the maximum nesting depth of loops in the given expr list
+*/
+inline size_t CalcMaxLoopDepth(const wabt::ExprList& exprList)
+{
+	size_t maxDepth = 0;
+	for (const wabt::Expr& expr : exprList)
+	{
+		switch (expr.type())
+		{
+		case wabt::ExprType::Block:
+			maxDepth = std::max(maxDepth, CalcMaxLoopDepth(
+				wabt::cast<wabt::BlockExpr>(&expr)->block.exprs));
+			break;
+		case wabt::ExprType::Loop:
+			maxDepth = std::max(maxDepth, 1 + CalcMaxLoopDepth(
+				wabt::cast<wabt::LoopExpr>(&expr)->block.exprs));
+			break;
+		case wabt::ExprType::If:
+		{
+			auto ifExpr = wabt::cast<wabt::IfExpr>(&expr);
+			maxDepth = std::max(maxDepth,
+				CalcMaxLoopDepth(ifExpr->true_.exprs));
+			maxDepth = std::max(maxDepth,
+				CalcMaxLoopDepth(ifExpr->false_));
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			auto tryExpr = wabt::cast<wabt::TryExpr>(&expr);
+			maxDepth = std::max(maxDepth,
+				CalcMaxLoopDepth(tryExpr->block.exprs));
+			for (const auto& catchBlk : tryExpr->catches)
+			{
+				maxDepth = std::max(maxDepth,
+					CalcMaxLoopDepth(catchBlk.exprs));
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return maxDepth;
+}
+
+/**
+ * @brief Calculate the worst-case cost of functions that can be charged at
+ *        their call sites, instead of counting the cost by themselves.
+ *        A function qualifies if it's loop-free, recursion-free, and it's
+ *        only entered by direct `call`s.
+ *        The results are stored in `funcInfo.m_inModFuncWeights`, so the
+ *        callers' blocks will include them when their weights are calculated.
+ *        Functions that already have their weights there (e.g., trusted
+ *        functions) are kept as they are.
+ *
+ * @param skipFuncIdx Index of the function that shouldn't be touched
+ *                    (i.e., the injected counter increment function)
+*/
+inline void CalcLeafFuncSummaries(
+	wabt::Module& mod,
+	const CallGraph& cg,
+	const WeightCalculator& wCalc,
+	wabt::Index skipFuncIdx,
+	ImportFuncInfo& funcInfo)
+{
+	// callees come before their callers, so the summaries of callees are
+	// ready when calculating weights of the callers
+	for (const auto& scc : GetCallGraphSccs(cg))
+	{
+		wabt::Index funcIdx = scc[0];
+		if (IsFuncRecursive(cg, scc) ||
+			cg.IsImport(funcIdx) ||
+			cg.m_isEntry[funcIdx] ||
+			(funcIdx == skipFuncIdx) ||
+			(funcInfo.m_inModFuncWeights.find(funcIdx) !=
+				funcInfo.m_inModFuncWeights.end()))
+		{
+			continue;
+		}
+
+		wabt::Func& func = *(mod.funcs[funcIdx]);
+		if (!IsFuncLoopFree(func))
+		{
+			continue;
+		}
+
+		Graph gr = GenerateGraph(func);
+		wCalc.CalcWeight(gr.m_head, funcInfo);
+
+		// each dimension is bounded independently
+		std::vector<size_t> summary(wCalc.GetNumOfDimensions(), 0);
+		for (size_t dim = 0; dim < summary.size(); ++dim)
+		{
+			std::unordered_map<const Block*, size_t> memo;
+			summary[dim] = CalcMaxPathWeight(gr.m_head, dim, memo);
+		}
+		funcInfo.m_inModFuncWeights[funcIdx] = std::move(summary);
+	}
+}
+
+} // namespace DecentWasmCounter
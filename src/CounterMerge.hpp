@@ -0,0 +1,418 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include "Block.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief The `loop`s of a function, and how they are nested
+*/
+struct LoopNest
+{
+	LoopNest() :
+		m_listLoops(),
+		m_parents()
+	{}
+
+	// Innermost `loop` enclosing each expr list; nullptr if there is none
+	std::unordered_map<const wabt::ExprList*, const wabt::Expr*> m_listLoops;
+	// Innermost `loop` enclosing each `loop`; nullptr if there is none
+	std::unordered_map<const wabt::Expr*, const wabt::Expr*> m_parents;
+
+	const wabt::Expr* GetParent(const wabt::Expr* loop) const
+	{
+		return loop == nullptr ? nullptr : m_parents.at(loop);
+	}
+
+	/**
+	 * @brief Whether the code in `loop` is inside `outer` as well (a loop is
+	 *        inside itself, and everything is inside nullptr)
+	*/
+	bool IsInside(const wabt::Expr* loop, const wabt::Expr* outer) const
+	{
+		for (; loop != nullptr; loop = GetParent(loop))
+		{
+			if (loop == outer)
+			{
+				return true;
+			}
+		}
+		return outer == nullptr;
+	}
+}; // struct LoopNest
+
+inline void BuildLoopNest(
+	const wabt::ExprList& exprList,
+	const wabt::Expr* loop,
+	LoopNest& nest)
+{
+	nest.m_listLoops[&exprList] = loop;
+
+	for (const wabt::Expr& expr : exprList)
+	{
+		switch (expr.type())
+		{
+		case wabt::ExprType::Block:
+			BuildLoopNest(wabt::cast<const wabt::BlockExpr>(&expr)->
+				block.exprs, loop, nest);
+			break;
+		case wabt::ExprType::Loop:
+			nest.m_parents[&expr] = loop;
+			BuildLoopNest(wabt::cast<const wabt::LoopExpr>(&expr)->
+				block.exprs, &expr, nest);
+			break;
+		case wabt::ExprType::If:
+		{
+			const wabt::IfExpr* ifExpr = wabt::cast<const wabt::IfExpr>(&expr);
+			BuildLoopNest(ifExpr->true_.exprs, loop, nest);
+			BuildLoopNest(ifExpr->false_, loop, nest);
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			const wabt::TryExpr* tryExpr =
+				wabt::cast<const wabt::TryExpr>(&expr);
+			BuildLoopNest(tryExpr->block.exprs, loop, nest);
+			for (const auto& catchBlk : tryExpr->catches)
+			{
+				BuildLoopNest(catchBlk.exprs, loop, nest);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Get the innermost `loop` that the block is in; a loop head is
+ *        considered to be in its own loop, since it's where the branches to
+ *        the next iteration go
+*/
+inline const wabt::Expr* GetBlockLoop(const Block& blk, const LoopNest& nest)
+{
+	if (blk.m_isLoopHead)
+	{
+		return &(*(blk.m_blkBegin));
+	}
+	return nest.m_listLoops.at(blk.m_exprList);
+}
+
+/**
+ * @brief Get the immediate dominator of each node of an acyclic graph, whose
+ *        nodes are given in a topological order, starting from the root
+ *
+ * @param preds Predecessors of each node, indexed by their positions in
+ *              the topological order
+ * @return The index of the immediate dominator of each node (the root is
+ *         its own dominator)
+*/
+inline std::vector<size_t> CalcAcyclicDominators(
+	const std::vector<std::vector<size_t> >& preds)
+{
+	std::vector<size_t> idom(preds.size(), 0);
+	for (size_t i = 1; i < preds.size(); ++i)
+	{
+		// dominators always come earlier in a topological order, so the
+		// later one of the two is never their common dominator
+		bool isFirst = true;
+		for (size_t pred : preds[i])
+		{
+			if (isFirst)
+			{
+				idom[i] = pred;
+				isFirst = false;
+				continue;
+			}
+			size_t a = idom[i];
+			size_t b = pred;
+			while (a != b)
+			{
+				if (a > b)
+				{
+					a = idom[a];
+				}
+				else
+				{
+					b = idom[b];
+				}
+			}
+			idom[i] = a;
+		}
+	}
+	return idom;
+}
+
+/**
+ * @brief Merge the weights of blocks that are always executed the same
+ *        number of times into one of them, so only one counter is needed;
+ *        the weights must have been calculated, and the reachable blocks
+ *        must have been marked.
+ *        Block B is merged into block A, if A dominates B, B post-dominates
+ *        A, and both are directly in the same loop, so that, in every
+ *        iteration of the loop, either both of them run once, or none of
+ *        them does.
+ *        The post-dominators are found on the block-flow graph where each
+ *        loop head (i.e., where the next iteration starts) flows to the
+ *        exits of its loop instead, so a loop is only a detour for the code
+ *        around it; the graph stays acyclic, since the exits never lead back
+ *        into the loop.
+ *
+ * @return Number of blocks whose weights are merged into another block
+*/
+inline size_t MergeEquivalentBlocks(const wabt::Func& func, Graph& gr)
+{
+	if ((gr.m_head == nullptr) || gr.m_head->m_isLoopHead)
+	{
+		return 0;
+	}
+
+	LoopNest nest;
+	BuildLoopNest(func.exprs, nullptr, nest);
+
+	// # successors of each reachable block, with loop heads flowing to the
+	//   exits of their loops;
+	//   nullptr stands for leaving the function
+	std::unordered_map<const wabt::Expr*, std::vector<Block*> > loopExits;
+	for (const auto& blk : gr.m_storage.m_vec)
+	{
+		if (!blk->m_isReachable || blk->m_isLoopHead)
+		{
+			continue;
+		}
+		const wabt::Expr* blkLoop = GetBlockLoop(*blk, nest);
+
+		bool hasChild = false;
+		for (const auto& child : blk->m_children)
+		{
+			if (child.m_ptr == nullptr)
+			{
+				continue;
+			}
+			hasChild = true;
+
+			const wabt::Expr* childLoop = GetBlockLoop(*(child.m_ptr), nest);
+			for (const wabt::Expr* loop = blkLoop;
+				(loop != nullptr) && !nest.IsInside(childLoop, loop);
+				loop = nest.GetParent(loop))
+			{
+				loopExits[loop].push_back(child.m_ptr);
+			}
+		}
+		if (!hasChild)
+		{
+			for (const wabt::Expr* loop = blkLoop; loop != nullptr;
+				loop = nest.GetParent(loop))
+			{
+				loopExits[loop].push_back(nullptr);
+			}
+		}
+	}
+
+	auto getSuccs = [&](const Block& blk)
+	{
+		std::vector<Block*> succs;
+		if (blk.m_isLoopHead)
+		{
+			auto it = loopExits.find(GetBlockLoop(blk, nest));
+			if (it != loopExits.end())
+			{
+				succs = it->second;
+			}
+		}
+		else
+		{
+			for (const auto& child : blk.m_children)
+			{
+				if (child.m_ptr != nullptr)
+				{
+					succs.push_back(child.m_ptr);
+				}
+			}
+		}
+		std::sort(succs.begin(), succs.end());
+		succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+		if (succs.empty())
+		{
+			succs.push_back(nullptr);
+		}
+		return succs;
+	};
+
+	// # topological order of the blocks reachable from the head
+	std::unordered_map<const Block*, size_t> numPreds;
+	std::unordered_map<const Block*, std::vector<Block*> > succs;
+	std::vector<Block*> stack = { gr.m_head };
+	succs[gr.m_head] = getSuccs(*(gr.m_head));
+	while (stack.size() > 0)
+	{
+		Block* blk = stack.back();
+		stack.pop_back();
+		for (Block* succ : succs[blk])
+		{
+			if (succ == nullptr)
+			{
+				continue;
+			}
+			++numPreds[succ];
+			if (succs.find(succ) == succs.end())
+			{
+				succs[succ] = getSuccs(*succ);
+				stack.push_back(succ);
+			}
+		}
+	}
+	if (numPreds[gr.m_head] > 0)
+	{
+		// not acyclic, which the graph generation never produces
+		return 0;
+	}
+
+	std::vector<Block*> order;
+	std::unordered_map<const Block*, size_t> orderIdx;
+	stack = { gr.m_head };
+	while (stack.size() > 0)
+	{
+		Block* blk = stack.back();
+		stack.pop_back();
+		orderIdx[blk] = order.size();
+		order.push_back(blk);
+		for (Block* succ : succs[blk])
+		{
+			if ((succ != nullptr) && (--numPreds[succ] == 0))
+			{
+				stack.push_back(succ);
+			}
+		}
+	}
+	if (order.size() != succs.size())
+	{
+		// not acyclic, which the graph generation never produces
+		return 0;
+	}
+
+	// # dominators
+	std::vector<std::vector<size_t> > preds(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		for (Block* succ : succs[order[i]])
+		{
+			if (succ != nullptr)
+			{
+				preds[orderIdx[succ]].push_back(i);
+			}
+		}
+	}
+	std::vector<size_t> idom = CalcAcyclicDominators(preds);
+
+	// # post-dominators, on the reversed graph rooted at the function exit;
+	//   the exit is 0, and block i is (n - i)
+	size_t n = order.size();
+	std::vector<std::vector<size_t> > postPreds(n + 1);
+	for (size_t i = 0; i < n; ++i)
+	{
+		for (Block* succ : succs[order[i]])
+		{
+			postPreds[n - i].push_back(
+				succ == nullptr ? 0 : (n - orderIdx[succ]));
+		}
+	}
+	std::vector<size_t> ipdom = CalcAcyclicDominators(postPreds);
+
+	// # intervals of the post-dominator tree, so a post-dominance check
+	//   is just a comparison
+	std::vector<std::vector<size_t> > pdomChildren(n + 1);
+	for (size_t i = 1; i <= n; ++i)
+	{
+		pdomChildren[ipdom[i]].push_back(i);
+	}
+	std::vector<size_t> pdomIn(n + 1, 0);
+	std::vector<size_t> pdomOut(n + 1, 0);
+	size_t tick = 0;
+	std::vector<std::pair<size_t, size_t> > dfsStack = { { 0, 0 } };
+	pdomIn[0] = tick++;
+	while (dfsStack.size() > 0)
+	{
+		auto& top = dfsStack.back();
+		if (top.second < pdomChildren[top.first].size())
+		{
+			size_t child = pdomChildren[top.first][top.second++];
+			pdomIn[child] = tick++;
+			dfsStack.emplace_back(child, 0);
+		}
+		else
+		{
+			pdomOut[top.first] = tick++;
+			dfsStack.pop_back();
+		}
+	}
+	auto isPostDom = [&](size_t b, size_t a)
+	{
+		return (pdomIn[n - b] <= pdomIn[n - a]) &&
+			(pdomOut[n - a] <= pdomOut[n - b]);
+	};
+
+	// # merge each block into the first block of its class, i.e., the one
+	//   dominating all the others
+	std::vector<const wabt::Expr*> loops(n, nullptr);
+	for (size_t i = 0; i < n; ++i)
+	{
+		loops[i] = GetBlockLoop(*(order[i]), nest);
+	}
+	std::vector<size_t> rep(n, 0);
+	size_t numMerged = 0;
+	for (size_t i = 1; i < n; ++i)
+	{
+		rep[i] = i;
+		if (order[i]->m_isLoopHead)
+		{
+			// charged after the end of the loop, rather than at the head
+			continue;
+		}
+
+		// the nearest dominator directly in the same loop; if it's not
+		// post-dominated by this block, none of the farther ones is
+		size_t a = i;
+		do
+		{
+			a = idom[a];
+		} while ((a != 0) &&
+			(order[a]->m_isLoopHead || (loops[a] != loops[i])));
+		if (order[a]->m_isLoopHead || (loops[a] != loops[i]) ||
+			!isPostDom(i, a))
+		{
+			continue;
+		}
+		rep[i] = rep[a];
+
+		Block* from = order[i];
+		Block* to = order[rep[i]];
+		if (from->HasWeight())
+		{
+			for (size_t dim = 0; dim < from->m_weights.size(); ++dim)
+			{
+				to->m_weights[dim] += from->m_weights[dim];
+				from->m_weights[dim] = 0;
+			}
+			++numMerged;
+		}
+	}
+
+	return numMerged;
+}
+
+} // namespace DecentWasmCounter
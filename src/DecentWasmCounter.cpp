@@ -12,45 +12,49 @@
 #include <src/validator.h>
 
 #include "BlockGenerator.hpp"
+#include "BlockTable.hpp"
+#include "CallGraph.hpp"
 #include "CodeInjector.hpp"
+#include "CostSummary.hpp"
+#include "GraphExport.hpp"
+#include "IncrThunks.hpp"
+#include "InstrumentPasses.hpp"
+#include "MemoryLimit.hpp"
+#include "PassManager.hpp"
+#include "Reachability.hpp"
+#include "Repricing.hpp"
+#include "SupportCheck.hpp"
+#include "TrustedFuncs.hpp"
 #include "WeightCalculator.hpp"
+#include "WorkerPool.hpp"
 
 namespace DecentWasmCounter
 {
 
-static void InstrumentFunc(
-	wabt::Func& func,
-	const ImportFuncInfo& funcInfo,
-	const InjectedSymbolInfo& symInfo)
-{
-	// Generate block flow graph
-	Graph gr = GenerateGraph(func);
-
-	// Calculate weight for each block
-	WeightCalculator wCalc(GetDefaultExprWeightCalcMap(), 0);
-	wCalc.CalcWeight(gr.m_head, funcInfo);
-
-	// Inject counting code
-	InjectBlockCounter(gr.m_head, symInfo.m_funcIncrId);
-}
-
-static void PostValidateModule(const wabt::Module& mod)
+static bool ValidateInstrumentedModule(
+	const wabt::Module& mod,
+	std::string& errMsg)
 {
 	wabt::Features features;
+	// instrumented tail calls, exception handling, atomics, and memory64
+	// instructions are kept as they are, and the aggregate budget is flushed
+	// with atomics
+	features.enable_tail_call();
+	features.enable_exceptions();
+	features.enable_threads();
+	features.enable_memory64();
 	wabt::ValidateOptions options(features);
 	wabt::Errors errors;
 	wabt::Result result = wabt::ValidateModule(&mod, &errors, options);
 	if (!wabt::Succeeded(result))
 	{
-		std::string errMsg;
 		for (const auto& err : errors)
 		{
 			errMsg += (err.message + '\n');
 		}
-		throw Exception(
-			"Failed to validate the generated module:\n" +
-			errMsg);
+		return false;
 	}
+	return true;
 }
 
 static ImportFuncListType GetImportFuncList(
@@ -70,16 +74,444 @@ static ImportFuncListType GetImportFuncList(
 	return list;
 }
 
+static size_t GetInjectedSymbolSize(
+	const wabt::Module& mod,
+	const InjectedSymbolInfo& symInfo)
+{
+	// each global: type, mut, i64.const 0, end
+	size_t size = (symInfo.m_thrIds.size() + symInfo.m_ctrIds.size() +
+		symInfo.m_pendingIds.size()) * 5;
+
+	// increment function body and its end
+	for (const wabt::Expr& expr : mod.funcs[symInfo.m_funcIncrId]->exprs)
+	{
+		size += GetInjectedExprSize(expr);
+	}
+	size += 1;
+
+	// flush function local declaration, body, and its end
+	if (symInfo.m_funcFlushId != wabt::kInvalidIndex)
+	{
+		for (const wabt::Expr& expr : mod.funcs[symInfo.m_funcFlushId]->exprs)
+		{
+			size += GetInjectedExprSize(expr);
+		}
+		size += 3;
+	}
+
+	return size;
+}
+
+/**
+ * @brief The work that only depends on the configuration, so it can be
+ *        shared by all modules instrumented with the same configuration;
+ *        it's read-only once constructed
+*/
+struct InstrumentSetup
+{
+	explicit InstrumentSetup(const InstrumentConfig& config) :
+		m_config(config),
+		m_wCalc(config.m_costModels),
+		m_dynWeightMap(BuildDynamicWeightMap(config.m_costModels))
+	{}
+
+	const InstrumentConfig& m_config;
+	WeightCalculator m_wCalc;
+	DynamicWeightMapType m_dynWeightMap;
+}; // struct InstrumentSetup
+
+static void SumModuleStatistics(ModuleStatistics& stats)
+{
+	for (const FuncStatistics& funcStats : stats.m_funcs)
+	{
+		stats.m_numBlocks += funcStats.m_numBlocks;
+		stats.m_numEmptyBlocksDropped += funcStats.m_numEmptyBlocksDropped;
+		stats.m_numDeadBlocks += funcStats.m_numDeadBlocks;
+		stats.m_numExprsPruned += funcStats.m_numExprsPruned;
+		stats.m_numCountersInjected += funcStats.m_numCountersInjected;
+		stats.m_numBlocksMerged += funcStats.m_numBlocksMerged;
+		stats.m_numBytesAdded += funcStats.m_numBytesAdded;
+
+		if (stats.m_staticWeights.size() < funcStats.m_staticWeights.size())
+		{
+			stats.m_staticWeights.resize(funcStats.m_staticWeights.size(), 0);
+		}
+		for (size_t dim = 0; dim < funcStats.m_staticWeights.size(); ++dim)
+		{
+			stats.m_staticWeights[dim] += funcStats.m_staticWeights[dim];
+		}
+	}
+}
+
 } // namespace DecentWasmCounter
 
 void DecentWasmCounter::Instrument(wabt::Module& mod)
 {
+	Instrument(mod, InstrumentConfig());
+}
+
+void DecentWasmCounter::Instrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config)
+{
+	ModuleStatistics stats;
+	Instrument(mod, config, stats);
+}
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Record the block table of the module that has passed
+ *        CheckModuleSupport, without touching the function bodies
+*/
+static void EmitBlockTable(
+	wabt::Module& mod,
+	const InstrumentSetup& setup,
+	ModuleStatistics& stats)
+{
+	const InstrumentConfig& config = setup.m_config;
+	const WeightCalculator& wCalc = setup.m_wCalc;
+
+	auto start = PassManager::Clock::now();
+
+	stats = ModuleStatistics();
+	PassManager passMgr;
+
+	auto impFuncList = GetImportFuncList(mod.imports);
+	ImportFuncInfo funcInfo{ mod.func_bindings, impFuncList };
+
+	// Charge leaf functions at their call sites
+	if (config.m_elideLeafFuncCounters)
+	{
+		passMgr.RunModuleStep("LeafFuncSummary", PassKind::Analysis,
+			[&]()
+			{
+				// there is no injected function to skip
+				CalcLeafFuncSummaries(mod, BuildCallGraph(mod), wCalc,
+					wabt::kInvalidIndex, funcInfo);
+				return funcInfo.m_inModFuncWeights.size();
+			}
+		);
+	}
+
+	// Function passes
+	BlockTable table;
+	table.m_numDims = config.m_costModels.size();
+	passMgr.AddPass(Internal::make_unique<GraphGenPass>());
+	passMgr.AddPass(Internal::make_unique<ReachabilityPass>());
+	passMgr.AddPass(Internal::make_unique<WeightCalcPass>(wCalc, funcInfo));
+	passMgr.AddPass(Internal::make_unique<BlockTablePass>(
+		setup.m_dynWeightMap, table));
+
+	for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+	{
+		bool isCounted = funcInfo.m_inModFuncWeights.find(
+				static_cast<wabt::Index>(i)) ==
+			funcInfo.m_inModFuncWeights.end();
+
+		FuncPassContext ctx(
+			*(mod.funcs[i]), static_cast<wabt::Index>(i), isCounted);
+		passMgr.Run(ctx);
+
+		stats.m_funcs.emplace_back(std::move(ctx.m_stats));
+	}
+
+	// Block table section
+	passMgr.RunModuleStep("BlockTableSection", PassKind::Transform,
+		[&]()
+		{
+			mod.customs.emplace_back(wabt::Location(),
+				GetBlockTableSectionName(), EncodeBlockTable(table));
+			return table.m_funcs.size();
+		}
+	);
+
+	// the function bodies are untouched, so there is nothing to validate
+
+	SumModuleStatistics(stats);
+	stats.m_passes = passMgr.GetStatistics();
+
+	auto end = PassManager::Clock::now();
+	stats.m_wallTimeNs = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			end - start).count());
+}
+
+/**
+ * @brief What the module-level steps produce for the function passes
+*/
+struct ModuleInstrumentState
+{
+	ModuleInstrumentState() :
+		m_symInfo(),
+		m_funcInfo(),
+		m_trustedFuncs(),
+		m_isFuncReachable()
+	{}
+
+	InjectedSymbolInfo m_symInfo;
+	ImportFuncInfo m_funcInfo;
+	TrustedFuncMap m_trustedFuncs;
+
+	// One flag per function of the input module; empty if unreachable
+	// functions are instrumented as well
+	std::vector<bool> m_isFuncReachable;
+
+	wabt::Index GetCtrFuncIdx() const
+	{
+		return static_cast<wabt::Index>(m_symInfo.m_funcIncrId);
+	}
+
+	/**
+	 * @brief Whether the function body should go through the function
+	 *        passes; the injected functions, the bodies of trusted
+	 *        functions, and the functions that can never be executed are
+	 *        left as they are
+	*/
+	bool IsFuncInstrumented(size_t funcIdx) const
+	{
+		return !m_symInfo.IsInjectedFunc(funcIdx) &&
+			((funcIdx >= m_isFuncReachable.size()) ||
+				m_isFuncReachable[funcIdx]) &&
+			(m_trustedFuncs.find(static_cast<wabt::Index>(funcIdx)) ==
+				m_trustedFuncs.end());
+	}
+
+	/**
+	 * @brief Functions charged at their call sites don't need counters
+	*/
+	bool IsFuncCounted(size_t funcIdx) const
+	{
+		return m_funcInfo.m_inModFuncWeights.find(
+				static_cast<wabt::Index>(funcIdx)) ==
+			m_funcInfo.m_inModFuncWeights.end();
+	}
+}; // struct ModuleInstrumentState
+
+/**
+ * @brief Inject the counter and its functions, and resolve the costs
+ *        charged at call sites, before any function body is instrumented
+*/
+static void RunModulePrepSteps(
+	wabt::Module& mod,
+	const InstrumentSetup& setup,
+	PassManager& passMgr,
+	ModuleStatistics& stats,
+	ModuleInstrumentState& state)
+{
+	const InstrumentConfig& config = setup.m_config;
+
+	// Leave out the functions that can never be executed
+	if (config.m_unreachableFuncPolicy != UnreachableFuncPolicy::Instrument)
+	{
+		bool isStub =
+			config.m_unreachableFuncPolicy == UnreachableFuncPolicy::Stub;
+		passMgr.RunModuleStep("UnreachableFuncs",
+			isStub ? PassKind::Transform : PassKind::Analysis,
+			[&]()
+			{
+				state.m_isFuncReachable =
+					GetReachableFuncs(BuildCallGraph(mod));
+				for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+				{
+					if (!state.m_isFuncReachable[i])
+					{
+						++stats.m_numUnreachableFuncs;
+						if (isStub)
+						{
+							stats.m_numExprsPruned +=
+								StubUnreachableFunc(*(mod.funcs[i]));
+						}
+					}
+				}
+				return stats.m_numUnreachableFuncs;
+			}
+		);
+	}
+
 	// Inject counter and functions
-	auto symInfo = InjectCounterAndFunc(mod);
+	passMgr.RunModuleStep("InjectCounterAndFunc", PassKind::Transform,
+		[&]()
+		{
+			state.m_symInfo = InjectCounterAndFunc(mod,
+				config.m_costModels.size(), config.m_exceedPolicy,
+				config.m_aggregateBudget);
+			return mod.funcs[state.m_symInfo.m_funcIncrId]->exprs.size();
+		}
+	);
+	stats.m_numBytesAdded += GetInjectedSymbolSize(mod, state.m_symInfo);
+	wabt::Index ctrFuncIdx = state.GetCtrFuncIdx();
 
 	// Generate import function info
 	auto impFuncList = GetImportFuncList(mod.imports);
-	ImportFuncInfo funcInfo{ mod.func_bindings, impFuncList };
+	state.m_funcInfo = ImportFuncInfo{ mod.func_bindings, impFuncList };
+
+	// Charge trusted functions with their pre-assigned costs
+	if (!config.m_trustedFuncs.empty())
+	{
+		passMgr.RunModuleStep("TrustedFuncs", PassKind::Transform,
+			[&]()
+			{
+				state.m_trustedFuncs = ResolveTrustedFuncs(mod,
+					config.m_trustedFuncs, BuildCallGraph(mod),
+					config.m_costModels.size());
+
+				InjectionStats injStats;
+				for (const auto& item : state.m_trustedFuncs)
+				{
+					if (item.second.m_isChargedAtEntry)
+					{
+						InjectTrustedFuncEntryCharge(*(mod.funcs[item.first]),
+							item.second, ctrFuncIdx, injStats);
+					}
+					else
+					{
+						state.m_funcInfo.m_inModFuncWeights[item.first] =
+							item.second.m_weights;
+					}
+				}
+				stats.m_numCountersInjected += injStats.m_numCounters;
+				stats.m_numBytesAdded += injStats.m_numBytes;
+
+				return injStats.m_numExprs;
+			}
+		);
+	}
+
+	// Charge leaf functions at their call sites
+	if (config.m_elideLeafFuncCounters)
+	{
+		passMgr.RunModuleStep("LeafFuncSummary", PassKind::Analysis,
+			[&]()
+			{
+				CallGraph cg = BuildCallGraph(mod);
+				MarkTrustedFuncCallees(cg, state.m_trustedFuncs);
+				CalcLeafFuncSummaries(mod, cg, setup.m_wCalc,
+					ctrFuncIdx, state.m_funcInfo);
+				return state.m_funcInfo.m_inModFuncWeights.size();
+			}
+		);
+	}
+}
+
+/**
+ * @param repricingBuilder Records the counters if it's not null
+*/
+static void AddInstrumentFuncPasses(
+	PassManager& passMgr,
+	const wabt::Module& mod,
+	const InstrumentSetup& setup,
+	const ModuleInstrumentState& state,
+	RepricingInfoBuilder* repricingBuilder)
+{
+	const InstrumentConfig& config = setup.m_config;
+	wabt::Index ctrFuncIdx = state.GetCtrFuncIdx();
+
+	passMgr.AddPass(Internal::make_unique<GraphGenPass>());
+	passMgr.AddPass(Internal::make_unique<ReachabilityPass>());
+	passMgr.AddPass(Internal::make_unique<WeightCalcPass>(
+		setup.m_wCalc, state.m_funcInfo));
+	if (config.m_mergeEquivalentBlocks)
+	{
+		passMgr.AddPass(Internal::make_unique<BlockMergePass>());
+	}
+	if (repricingBuilder != nullptr)
+	{
+		passMgr.AddPass(Internal::make_unique<BlockCounterPass>(
+			ctrFuncIdx, state.m_funcInfo, *repricingBuilder));
+	}
+	else
+	{
+		passMgr.AddPass(Internal::make_unique<BlockCounterPass>(ctrFuncIdx));
+	}
+	if (config.m_pruneUnreachableCode)
+	{
+		passMgr.AddPass(Internal::make_unique<DeadBlockPrunePass>());
+	}
+	// functions charged at their call sites still need to charge their
+	// runtime-proportional cost by themselves
+	passMgr.AddPass(Internal::make_unique<DynamicCounterPass>(
+		mod, setup.m_dynWeightMap, ctrFuncIdx));
+	if (!state.m_trustedFuncs.empty())
+	{
+		passMgr.AddPass(Internal::make_unique<TrustedCallCounterPass>(
+			mod, state.m_trustedFuncs, ctrFuncIdx));
+	}
+}
+
+/**
+ * @brief Export the counter, threshold, and flush function, and wrap the
+ *        entry function, as configured
+*/
+static void RunHostInterfaceStep(
+	wabt::Module& mod,
+	const InstrumentConfig& config,
+	PassManager& passMgr,
+	const ModuleInstrumentState& state)
+{
+	bool isFlushExported = config.m_aggregateBudget.IsEnabled() &&
+		!config.m_aggregateBudget.m_flushExportName.empty();
+	if (!config.m_counterExportName.empty() ||
+		!config.m_thresholdExportName.empty() ||
+		!config.m_entryFuncName.empty() ||
+		isFlushExported)
+	{
+		passMgr.RunModuleStep("HostInterface", PassKind::Transform,
+			[&]()
+			{
+				ExportCounterAndThreshold(mod, state.m_symInfo,
+					config.m_counterExportName,
+					config.m_thresholdExportName);
+				if (!config.m_entryFuncName.empty())
+				{
+					InjectEntryWrapper(mod, state.m_symInfo,
+						config.m_entryFuncName, config.m_entryWrapperName);
+				}
+				if (isFlushExported)
+				{
+					AppendExport(mod, config.m_aggregateBudget.m_flushExportName,
+						wabt::ExternalKind::Func, state.m_symInfo.m_funcFlushId);
+				}
+				return 0;
+			}
+		);
+	}
+}
+
+/**
+ * @brief Instrument the module that has passed CheckModuleSupport
+ *
+ * @return false if the instrumented module failed the validation, and the
+ *         reason is written to `validationErr`
+*/
+static bool InstrumentModule(
+	wabt::Module& mod,
+	const InstrumentSetup& setup,
+	ModuleStatistics& stats,
+	std::string& validationErr)
+{
+	const InstrumentConfig& config = setup.m_config;
+
+	if (config.m_emitBlockTableOnly)
+	{
+		EmitBlockTable(mod, setup, stats);
+		return true;
+	}
+
+	auto start = PassManager::Clock::now();
+
+	stats = ModuleStatistics();
+	PassManager passMgr;
+
+	ModuleInstrumentState state;
+	RunModulePrepSteps(mod, setup, passMgr, stats, state);
+	wabt::Index ctrFuncIdx = state.GetCtrFuncIdx();
+
+	// Function passes
+	RepricingInfoBuilder repricingBuilder;
+	AddInstrumentFuncPasses(passMgr, mod, setup, state,
+		config.m_emitRepricingInfo ? &repricingBuilder : nullptr);
 
 	// Instrument code
 	size_t funcIdx = 0;
@@ -88,11 +520,16 @@ void DecentWasmCounter::Instrument(wabt::Module& mod)
 		switch (field.type())
 		{
 		case wabt::ModuleFieldType::Func:
-			if (funcIdx != symInfo.m_funcIncrId)
+			if (state.IsFuncInstrumented(funcIdx))
 			{
 				wabt::Func& func =
 					wabt::cast<wabt::FuncModuleField>(&field)->func;
-				InstrumentFunc(func, funcInfo, symInfo);
+
+				FuncPassContext ctx(func, static_cast<wabt::Index>(funcIdx),
+					state.IsFuncCounted(funcIdx));
+				passMgr.Run(ctx);
+
+				stats.m_funcs.emplace_back(std::move(ctx.m_stats));
 			}
 			++funcIdx;
 			break;
@@ -108,6 +545,577 @@ void DecentWasmCounter::Instrument(wabt::Module& mod)
 		}
 	}
 
+	// Share the most frequent counters through thunks
+	uint64_t numThunkBytesSaved = 0;
+	if (config.m_maxIncrThunks > 0)
+	{
+		passMgr.RunModuleStep("IncrThunks", PassKind::Transform,
+			[&]()
+			{
+				std::vector<std::vector<uint64_t> > thunkWeights =
+					SelectIncrThunkWeights(
+						BuildIncrWeightHistogram(mod, state.m_symInfo),
+						ctrFuncIdx, static_cast<wabt::Index>(mod.funcs.size()),
+						config.m_maxIncrThunks);
+				if (thunkWeights.empty())
+				{
+					return size_t(0);
+				}
+
+				// the thunks are appended after the existing functions, so
+				// they are not visited below
+				InjectionStats injStats;
+				IncrThunkMap thunks =
+					InjectIncrThunks(mod, thunkWeights, ctrFuncIdx, injStats);
+				stats.m_numIncrThunks = thunks.size();
+				stats.m_numBytesAdded += injStats.m_numBytes;
+
+				for (size_t i = mod.num_func_imports;
+					i < mod.funcs.size() - thunks.size(); ++i)
+				{
+					if (!state.m_symInfo.IsInjectedFunc(i))
+					{
+						numThunkBytesSaved += RewriteIncrSites(mod,
+							*(mod.funcs[i]), ctrFuncIdx,
+							config.m_costModels.size(), thunks,
+							stats.m_numIncrThunkSites);
+					}
+				}
+				return injStats.m_numExprs;
+			}
+		);
+	}
+
+	// Repricing info
+	if (config.m_emitRepricingInfo)
+	{
+		passMgr.RunModuleStep("RepricingInfo", PassKind::Transform,
+			[&]()
+			{
+				RepricingInfo info = repricingBuilder.Build(
+					mod, config.m_costModels.size(), ctrFuncIdx);
+				mod.customs.emplace_back(wabt::Location(),
+					GetRepricingSectionName(), EncodeRepricingInfo(info));
+				return info.m_funcSites.size();
+			}
+		);
+	}
+
+	// Host interfaces
+	RunHostInterfaceStep(mod, config, passMgr, state);
+
 	// validate generated module
-	PostValidateModule(mod);
+	bool isValid = false;
+	passMgr.RunModuleStep("PostValidate", PassKind::Analysis,
+		[&]()
+		{
+			isValid = ValidateInstrumentedModule(mod, validationErr);
+			return 0;
+		}
+	);
+
+	SumModuleStatistics(stats);
+	// the counters rewritten were added by the function passes
+	stats.m_numBytesAdded -= numThunkBytesSaved;
+	stats.m_passes = passMgr.GetStatistics();
+
+	auto end = PassManager::Clock::now();
+	stats.m_wallTimeNs = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			end - start).count());
+
+	return isValid;
+}
+
+static void InstrumentWithSetup(
+	wabt::Module& mod,
+	const InstrumentSetup& setup,
+	ModuleStatistics& stats)
+{
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+	MemoryLimitScope memScope(setup.m_config.m_memoryLimit);
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+	InstrumentResult res = CheckModuleSupport(mod, setup.m_config);
+	if (!res.IsSuccess())
+	{
+		throw Exception(res.m_message);
+	}
+
+	std::string validationErr;
+	if (!InstrumentModule(mod, setup, stats, validationErr))
+	{
+		throw Exception(
+			"Failed to validate the generated module:\n" +
+			validationErr);
+	}
+}
+
+static InstrumentResult TryInstrumentWithSetup(
+	wabt::Module& mod,
+	const InstrumentSetup& setup,
+	ModuleStatistics& stats)
+{
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+	MemoryLimitScope memScope(setup.m_config.m_memoryLimit);
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+	InstrumentResult res = CheckModuleSupport(mod, setup.m_config);
+	if (!res.IsSuccess())
+	{
+		return res;
+	}
+
+	std::string validationErr;
+	if (!InstrumentModule(mod, setup, stats, validationErr))
+	{
+		return InstrumentResult(ErrorCode::ValidationFailed,
+			"Failed to validate the generated module:\n" +
+			validationErr);
+	}
+
+	return res;
+}
+
+} // namespace DecentWasmCounter
+
+void DecentWasmCounter::Instrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config,
+	ModuleStatistics& stats)
+{
+	InstrumentSetup setup(config);
+	InstrumentWithSetup(mod, setup, stats);
+}
+
+DecentWasmCounter::InstrumentResult DecentWasmCounter::TryInstrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config) noexcept
+{
+	ModuleStatistics stats;
+	return TryInstrument(mod, config, stats);
+}
+
+DecentWasmCounter::InstrumentResult DecentWasmCounter::TryInstrument(
+	wabt::Module& mod,
+	const InstrumentConfig& config,
+	ModuleStatistics& stats) noexcept
+{
+	try
+	{
+		InstrumentSetup setup(config);
+		return TryInstrumentWithSetup(mod, setup, stats);
+	}
+	catch (const MemoryLimitExceeded& e)
+	{
+		// the scope has ended, so the result can be allocated
+		return InstrumentResult(ErrorCode::MemoryLimitExceeded, e.what());
+	}
+	catch (const std::exception& e)
+	{
+		// only reachable on internal errors (e.g., out of memory), since
+		// the unsupported cases are rejected by CheckModuleSupport
+		return InstrumentResult(ErrorCode::Internal, e.what());
+	}
+	catch (...)
+	{
+		return InstrumentResult(ErrorCode::Internal, "Unknown error");
+	}
+}
+
+struct DecentWasmCounter::Instrumenter::Impl
+{
+	explicit Impl(const InstrumentConfig& config) :
+		m_config(config),
+		m_setup(m_config)
+	{}
+
+	InstrumentConfig m_config;
+	// refers to m_config, so it must be constructed after it
+	InstrumentSetup m_setup;
+}; // struct DecentWasmCounter::Instrumenter::Impl
+
+DecentWasmCounter::Instrumenter::Instrumenter() :
+	Instrumenter(InstrumentConfig())
+{}
+
+DecentWasmCounter::Instrumenter::Instrumenter(
+	const InstrumentConfig& config) :
+	m_impl(Internal::make_unique<Impl>(config))
+{}
+
+DecentWasmCounter::Instrumenter::Instrumenter(
+	Instrumenter&& other) noexcept = default;
+
+DecentWasmCounter::Instrumenter::~Instrumenter() = default;
+
+DecentWasmCounter::Instrumenter&
+DecentWasmCounter::Instrumenter::operator=(
+	Instrumenter&& other) noexcept = default;
+
+const DecentWasmCounter::InstrumentConfig&
+DecentWasmCounter::Instrumenter::GetConfig() const
+{
+	return m_impl->m_config;
+}
+
+void DecentWasmCounter::Instrumenter::Instrument(wabt::Module& mod) const
+{
+	ModuleStatistics stats;
+	Instrument(mod, stats);
+}
+
+void DecentWasmCounter::Instrumenter::Instrument(
+	wabt::Module& mod,
+	ModuleStatistics& stats) const
+{
+	InstrumentWithSetup(mod, m_impl->m_setup, stats);
+}
+
+DecentWasmCounter::InstrumentResult
+DecentWasmCounter::Instrumenter::TryInstrument(
+	wabt::Module& mod) const noexcept
+{
+	ModuleStatistics stats;
+	return TryInstrument(mod, stats);
+}
+
+DecentWasmCounter::InstrumentResult
+DecentWasmCounter::Instrumenter::TryInstrument(
+	wabt::Module& mod,
+	ModuleStatistics& stats) const noexcept
+{
+	try
+	{
+		return TryInstrumentWithSetup(mod, m_impl->m_setup, stats);
+	}
+	catch (const MemoryLimitExceeded& e)
+	{
+		return InstrumentResult(ErrorCode::MemoryLimitExceeded, e.what());
+	}
+	catch (const std::exception& e)
+	{
+		return InstrumentResult(ErrorCode::Internal, e.what());
+	}
+	catch (...)
+	{
+		return InstrumentResult(ErrorCode::Internal, "Unknown error");
+	}
+}
+
+std::vector<DecentWasmCounter::InstrumentResult>
+DecentWasmCounter::Instrumenter::InstrumentAll(
+	const std::vector<wabt::Module*>& mods,
+	size_t numWorkers,
+	std::vector<ModuleStatistics>* stats) const
+{
+	std::vector<InstrumentResult> res(mods.size());
+	std::vector<ModuleStatistics> localStats;
+	std::vector<ModuleStatistics>& allStats =
+		(stats != nullptr) ? *stats : localStats;
+	allStats.assign(mods.size(), ModuleStatistics());
+
+	// each task only touches its own module, result, and statistics
+	RunOnWorkerPool(numWorkers, mods.size(),
+		[&](size_t i)
+		{
+			if (mods[i] == nullptr)
+			{
+				res[i] = InstrumentResult(ErrorCode::Internal,
+					"The module to instrument is null");
+				return;
+			}
+			res[i] = TryInstrument(*(mods[i]), allStats[i]);
+		}
+	);
+
+	return res;
+}
+
+struct DecentWasmCounter::PreparedModule::Impl
+{
+	Impl(wabt::Module& mod, const InstrumentSetup& setup) :
+		m_mod(mod),
+		m_ownedConfig(),
+		m_ownedSetup(),
+		m_setup(&setup),
+		m_state(),
+		m_numFuncs(0),
+		m_isPending()
+	{}
+
+	Impl(wabt::Module& mod, const InstrumentConfig& config) :
+		m_mod(mod),
+		m_ownedConfig(Internal::make_unique<InstrumentConfig>(config)),
+		m_ownedSetup(Internal::make_unique<InstrumentSetup>(*m_ownedConfig)),
+		m_setup(m_ownedSetup.get()),
+		m_state(),
+		m_numFuncs(0),
+		m_isPending()
+	{}
+
+	wabt::Module& m_mod;
+	// only kept if the module is not prepared by an Instrumenter
+	std::unique_ptr<InstrumentConfig> m_ownedConfig;
+	std::unique_ptr<InstrumentSetup> m_ownedSetup;
+	const InstrumentSetup* m_setup;
+
+	ModuleInstrumentState m_state;
+
+	// Number of functions before the host interfaces are added
+	// (e.g., the entry wrapper, which is not instrumented)
+	size_t m_numFuncs;
+	// One flag per function; each one is only written by the call
+	// instrumenting that function, so different functions can be
+	// instrumented concurrently
+	std::vector<uint8_t> m_isPending;
+
+	void Prepare()
+	{
+		const InstrumentConfig& config = m_setup->m_config;
+
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+		MemoryLimitScope memScope(config.m_memoryLimit);
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+		InstrumentResult res = CheckInstrumentConfig(m_mod, config);
+		if (!res.IsSuccess())
+		{
+			throw Exception(res.m_message);
+		}
+		if (config.m_emitRepricingInfo || config.m_emitBlockTableOnly ||
+			(config.m_maxIncrThunks > 0))
+		{
+			throw Exception("The repricing info, the block table, and the "
+				"increment thunks can't be used when functions are "
+				"instrumented on demand");
+		}
+
+		ModuleStatistics stats;
+		PassManager passMgr;
+		RunModulePrepSteps(m_mod, *m_setup, passMgr, stats, m_state);
+
+		m_numFuncs = m_mod.funcs.size();
+		m_isPending.assign(m_numFuncs, 0);
+		for (size_t i = m_mod.num_func_imports; i < m_numFuncs; ++i)
+		{
+			m_isPending[i] = m_state.IsFuncInstrumented(i) ? 1 : 0;
+		}
+
+		RunHostInterfaceStep(m_mod, config, passMgr, m_state);
+	}
+}; // struct DecentWasmCounter::PreparedModule::Impl
+
+DecentWasmCounter::PreparedModule::PreparedModule(
+	std::unique_ptr<Impl> impl) :
+	m_impl(std::move(impl))
+{}
+
+DecentWasmCounter::PreparedModule::PreparedModule(
+	PreparedModule&& other) noexcept = default;
+
+DecentWasmCounter::PreparedModule::~PreparedModule() = default;
+
+DecentWasmCounter::PreparedModule&
+DecentWasmCounter::PreparedModule::operator=(
+	PreparedModule&& other) noexcept = default;
+
+wabt::Module& DecentWasmCounter::PreparedModule::GetModule() const
+{
+	return m_impl->m_mod;
+}
+
+bool DecentWasmCounter::PreparedModule::IsPending(uint32_t funcIdx) const
+{
+	return (funcIdx < m_impl->m_isPending.size()) &&
+		(m_impl->m_isPending[funcIdx] != 0);
+}
+
+DecentWasmCounter::PreparedModule DecentWasmCounter::PrepareModule(
+	wabt::Module& mod,
+	const InstrumentConfig& config)
+{
+	auto impl = Internal::make_unique<PreparedModule::Impl>(mod, config);
+	impl->Prepare();
+	return PreparedModule(std::move(impl));
+}
+
+DecentWasmCounter::PreparedModule
+DecentWasmCounter::Instrumenter::PrepareModule(wabt::Module& mod) const
+{
+	auto impl = Internal::make_unique<PreparedModule::Impl>(
+		mod, m_impl->m_setup);
+	impl->Prepare();
+	return PreparedModule(std::move(impl));
+}
+
+DecentWasmCounter::FuncStatistics DecentWasmCounter::InstrumentFunction(
+	PreparedModule& prepared,
+	uint32_t funcIdx)
+{
+	PreparedModule::Impl& impl = *(prepared.m_impl);
+	wabt::Module& mod = impl.m_mod;
+
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+	// each call has its own scope, since functions can be instrumented
+	// concurrently on different threads
+	MemoryLimitScope memScope(impl.m_setup->m_config.m_memoryLimit);
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+	if ((funcIdx < mod.num_func_imports) || (funcIdx >= impl.m_numFuncs))
+	{
+		throw Exception(
+			"The function to instrument is not defined in the module");
+	}
+	if (impl.m_isPending[funcIdx] == 0)
+	{
+		// already instrumented, or left as it is
+		FuncStatistics stats;
+		stats.m_funcIdx = funcIdx;
+		stats.m_isCounted = impl.m_state.IsFuncCounted(funcIdx);
+		return stats;
+	}
+
+	wabt::Func& func = *(mod.funcs[funcIdx]);
+	InstrumentResult res = CheckFuncSupport(func, funcIdx);
+	if (!res.IsSuccess())
+	{
+		throw Exception(res.m_message);
+	}
+
+	// the passes only read the shared state, and only write to the
+	// function they run on
+	PassManager passMgr;
+	AddInstrumentFuncPasses(passMgr, mod, *(impl.m_setup), impl.m_state,
+		nullptr);
+
+	FuncPassContext ctx(func, static_cast<wabt::Index>(funcIdx),
+		impl.m_state.IsFuncCounted(funcIdx));
+	passMgr.Run(ctx);
+
+	impl.m_isPending[funcIdx] = 0;
+	return std::move(ctx.m_stats);
+}
+
+DecentWasmCounter::BlockTable DecentWasmCounter::GetBlockTable(
+	const wabt::Module& mod)
+{
+	for (const wabt::Custom& custom : mod.customs)
+	{
+		if (custom.name == GetBlockTableSectionName())
+		{
+			return DecodeBlockTable(custom.data);
+		}
+	}
+	throw Exception("The module doesn't have the block table section");
+}
+
+DecentWasmCounter::ModuleAnalysis DecentWasmCounter::Analyze(
+	const wabt::Module& mod)
+{
+	return Analyze(mod, { GetDefaultCostModel() });
+}
+
+DecentWasmCounter::ModuleAnalysis DecentWasmCounter::Analyze(
+	const wabt::Module& mod,
+	const std::vector<CostModel>& models)
+{
+	ModuleAnalysis res;
+
+	auto impFuncList = GetImportFuncList(mod.imports);
+	ImportFuncInfo funcInfo{ mod.func_bindings, impFuncList };
+
+	WeightCalculator wCalc(models);
+
+	for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+	{
+		// the graph only keeps iterators to the exprs, and nothing is
+		// written through them
+		wabt::Func& func = const_cast<wabt::Func&>(*(mod.funcs[i]));
+
+		Graph gr = GenerateGraph(func);
+		wCalc.CalcWeight(gr.m_head, funcInfo);
+
+		FuncAnalysis funcRes;
+		funcRes.m_funcIdx = static_cast<uint32_t>(i);
+		funcRes.m_numBlocks = gr.m_storage.m_vec.size();
+		funcRes.m_maxLoopDepth = CalcMaxLoopDepth(func.exprs);
+		funcRes.m_staticWeights.assign(models.size(), 0);
+		for (const auto& blk : gr.m_storage.m_vec)
+		{
+			if (blk->m_isLoopHead)
+			{
+				++funcRes.m_numLoops;
+			}
+			if (blk->m_isWeightCalc)
+			{
+				for (size_t dim = 0; dim < blk->m_weights.size(); ++dim)
+				{
+					funcRes.m_staticWeights[dim] += blk->m_weights[dim];
+				}
+			}
+		}
+
+		for (size_t dim = 0; dim < models.size(); ++dim)
+		{
+			std::unordered_map<const Block*, size_t> minMemo;
+			std::unordered_map<const Block*, size_t> maxMemo;
+			funcRes.m_minPathWeights.push_back(
+				CalcMinPathWeight(gr.m_head, dim, minMemo));
+			funcRes.m_maxPathWeights.push_back(
+				CalcMaxPathWeight(gr.m_head, dim, maxMemo));
+		}
+
+		res.m_funcs.emplace_back(std::move(funcRes));
+	}
+
+	return res;
+}
+
+std::string DecentWasmCounter::ExportGraph(
+	const wabt::Module& mod,
+	uint32_t funcIdx,
+	const std::vector<CostModel>& models,
+	GraphFormat format,
+	const std::vector<uint64_t>& hitCounts)
+{
+	if ((funcIdx < mod.num_func_imports) || (funcIdx >= mod.funcs.size()))
+	{
+		throw Exception("The function to export is not defined in the module");
+	}
+
+	auto impFuncList = GetImportFuncList(mod.imports);
+	ImportFuncInfo funcInfo{ mod.func_bindings, impFuncList };
+
+	WeightCalculator wCalc(models);
+
+	// the graph only keeps iterators to the exprs, and nothing is
+	// written through them
+	wabt::Func& func = const_cast<wabt::Func&>(*(mod.funcs[funcIdx]));
+
+	Graph gr = GenerateGraph(func);
+	MarkReachableBlocks(gr);
+	wCalc.CalcWeight(gr.m_head, funcInfo);
+
+	return ExportFuncGraph(func, funcIdx, gr, format, hitCounts);
+}
+
+void DecentWasmCounter::Reprice(
+	wabt::Module& mod,
+	const std::vector<CostModel>& models)
+{
+	const wabt::Custom* section = nullptr;
+	for (const wabt::Custom& custom : mod.customs)
+	{
+		if (custom.name == GetRepricingSectionName())
+		{
+			section = &custom;
+		}
+	}
+	if (section == nullptr)
+	{
+		throw Exception("The module doesn't have the repricing section");
+	}
+
+	RepriceModule(mod, DecodeRepricingInfo(section->data), models);
 }
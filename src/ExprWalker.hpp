@@ -0,0 +1,107 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Visit every expr in the given expr list in pre-order, including
+ *        the ones nested in block-like exprs (block, loop, if, try)
+ *
+ * @tparam _ExprListType wabt::ExprList or const wabt::ExprList
+ * @tparam _FuncType     callable as `void(expr)`
+*/
+template<typename _ExprListType, typename _FuncType>
+inline void WalkExprList(_ExprListType& exprList, _FuncType&& func)
+{
+	for (auto& expr : exprList)
+	{
+		func(expr);
+
+		switch (expr.type())
+		{
+		case wabt::ExprType::Block:
+			WalkExprList(wabt::cast<wabt::BlockExpr>(&expr)->block.exprs, func);
+			break;
+		case wabt::ExprType::Loop:
+			WalkExprList(wabt::cast<wabt::LoopExpr>(&expr)->block.exprs, func);
+			break;
+		case wabt::ExprType::If:
+		{
+			auto ifExpr = wabt::cast<wabt::IfExpr>(&expr);
+			WalkExprList(ifExpr->true_.exprs, func);
+			WalkExprList(ifExpr->false_, func);
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			auto tryExpr = wabt::cast<wabt::TryExpr>(&expr);
+			WalkExprList(tryExpr->block.exprs, func);
+			for (auto& catchBlk : tryExpr->catches)
+			{
+				WalkExprList(catchBlk.exprs, func);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Similar to WalkExprList, but the callable is given the expr list
+ *        and the iterator to the expr, so that new exprs can be inserted
+ *        before the visited one
+ *
+ * @tparam _FuncType callable as
+ *                   `void(wabt::ExprList&, wabt::ExprList::iterator)`
+*/
+template<typename _FuncType>
+inline void WalkExprListIterator(wabt::ExprList& exprList, _FuncType&& func)
+{
+	for (auto it = exprList.begin(); it != exprList.end(); ++it)
+	{
+		switch (it->type())
+		{
+		case wabt::ExprType::Block:
+			WalkExprListIterator(
+				wabt::cast<wabt::BlockExpr>(&(*it))->block.exprs, func);
+			break;
+		case wabt::ExprType::Loop:
+			WalkExprListIterator(
+				wabt::cast<wabt::LoopExpr>(&(*it))->block.exprs, func);
+			break;
+		case wabt::ExprType::If:
+		{
+			wabt::IfExpr* ifExpr = wabt::cast<wabt::IfExpr>(&(*it));
+			WalkExprListIterator(ifExpr->true_.exprs, func);
+			WalkExprListIterator(ifExpr->false_, func);
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			wabt::TryExpr* tryExpr = wabt::cast<wabt::TryExpr>(&(*it));
+			WalkExprListIterator(tryExpr->block.exprs, func);
+			for (auto& catchBlk : tryExpr->catches)
+			{
+				WalkExprListIterator(catchBlk.exprs, func);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		func(exprList, it);
+	}
+}
+
+} // namespace DecentWasmCounter
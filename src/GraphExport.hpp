@@ -0,0 +1,229 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include <src/ir.h>
+
+#include <DecentWasmCounter/Analysis.hpp>
+#include <DecentWasmCounter/Exceptions.hpp>
+
+#include "Block.hpp"
+#include "BlockTable.hpp"
+
+namespace DecentWasmCounter
+{
+
+inline const char* GetBrTypeName(BrType brType)
+{
+	switch (brType)
+	{
+	case BrType::Normal:
+		return "Normal";
+	case BrType::IntoLoop:
+		return "IntoLoop";
+	case BrType::OutOfLoop:
+		return "OutOfLoop";
+	case BrType::IntoHandler:
+		return "IntoHandler";
+	default:
+		return "Unknown";
+	}
+}
+
+struct ExportedBlock
+{
+	const Block* m_blk;
+	// Ordinals of the first and the last exprs of the block
+	// (see AssignExprOrdinals)
+	uint64_t m_firstExpr;
+	uint64_t m_lastExpr;
+}; // struct ExportedBlock
+
+/**
+ * @brief List the blocks of the graph to be exported; the reachable ones
+ *        come first, in the same order as the block table, followed by the
+ *        other ones (i.e., dead blocks, and loop heads that are only entered
+ *        by falling through)
+*/
+inline std::vector<ExportedBlock> GetExportedBlocks(
+	const wabt::Func& func,
+	const Graph& gr,
+	BlockIndexMap& blkIdx)
+{
+	ExprOrdinalMap ordinals;
+	uint64_t nextOrdinal = 0;
+	AssignExprOrdinals(func.exprs, ordinals, nextOrdinal);
+
+	std::vector<const Block*> blks = GetBlocksInCountOrder(gr, blkIdx);
+	for (const auto& blk : gr.m_storage.m_vec)
+	{
+		if (blkIdx.emplace(blk.get(), blks.size()).second)
+		{
+			blks.push_back(blk.get());
+		}
+	}
+
+	std::vector<ExportedBlock> res;
+	for (const Block* blk : blks)
+	{
+		res.push_back(ExportedBlock{ blk,
+			ordinals.at(&(*(blk->m_blkBegin))),
+			ordinals.at(&(*(blk->GetBlkLastExpr(1)))) });
+	}
+	return res;
+}
+
+inline std::string GetGraphWeightsStr(const Block& blk)
+{
+	std::string str;
+	for (size_t dim = 0; dim < blk.m_weights.size(); ++dim)
+	{
+		str += (dim > 0 ? "," : "") + std::to_string(blk.m_weights[dim]);
+	}
+	return str;
+}
+
+/**
+ * @brief Export the block-flow graph of a function, whose weights and
+ *        reachability must have been calculated
+ *
+ * @param hitCounts Number of times each reachable block is executed,
+ *                  indexed in the same order as FuncBlockTable::m_blocks;
+ *                  not exported if it's empty
+*/
+inline std::string ExportFuncGraph(
+	const wabt::Func& func,
+	uint32_t funcIdx,
+	const Graph& gr,
+	GraphFormat format,
+	const std::vector<uint64_t>& hitCounts)
+{
+	BlockIndexMap blkIdx;
+	std::vector<ExportedBlock> blks = GetExportedBlocks(func, gr, blkIdx);
+
+	// the ones reachable from the head are listed first
+	size_t numReachable = 0;
+	for (const ExportedBlock& blk : blks)
+	{
+		numReachable += (blk.m_blk->m_isReachable ? 1 : 0);
+	}
+	auto isDead = [](const Block& blk)
+	{
+		// same as GetDeadBlocks
+		return !blk.m_isReachable && !blk.m_isLoopHead;
+	};
+	auto hasCounter = [](const Block& blk)
+	{
+		return blk.m_isReachable && blk.HasWeight();
+	};
+
+	if (!hitCounts.empty() && (hitCounts.size() != numReachable))
+	{
+		throw Exception(
+			"The number of hit counts doesn't match the number of blocks");
+	}
+
+	std::string out;
+	if (format == GraphFormat::Dot)
+	{
+		// reachable blocks with weights have counters, loop heads have
+		// double borders, and dead blocks are dashed
+		out += "digraph \"func_" + std::to_string(funcIdx) + "\" {\n";
+		out += "\tnode [shape=box];\n";
+		for (size_t i = 0; i < blks.size(); ++i)
+		{
+			const Block& blk = *(blks[i].m_blk);
+
+			out += "\tb" + std::to_string(i) + " [label=\"#" +
+				std::to_string(i) + " [" +
+				std::to_string(blks[i].m_firstExpr) + ".." +
+				std::to_string(blks[i].m_lastExpr) + "]\\nw=" +
+				GetGraphWeightsStr(blk);
+			if (!hitCounts.empty() && (i < numReachable))
+			{
+				out += "\\nhits=" + std::to_string(hitCounts[i]);
+			}
+			out += "\"";
+			if (blk.m_isLoopHead)
+			{
+				out += ", peripheries=2";
+			}
+			if (isDead(blk))
+			{
+				out += ", style=dashed";
+			}
+			else if (hasCounter(blk))
+			{
+				out += ", style=bold";
+			}
+			out += "];\n";
+		}
+		for (size_t i = 0; i < blks.size(); ++i)
+		{
+			for (const auto& child : blks[i].m_blk->m_children)
+			{
+				if (child.m_ptr != nullptr)
+				{
+					out += "\tb" + std::to_string(i) + " -> b" +
+						std::to_string(blkIdx.at(child.m_ptr)) +
+						" [label=\"" + GetBrTypeName(child.m_brType) + "/" +
+						GetBrTypeName(child.m_cntType) + "\"];\n";
+				}
+			}
+		}
+		out += "}\n";
+	}
+	else
+	{
+		out += "{\"funcIdx\":" + std::to_string(funcIdx) + ",\"blocks\":[";
+		for (size_t i = 0; i < blks.size(); ++i)
+		{
+			const Block& blk = *(blks[i].m_blk);
+
+			out += (i > 0 ? "," : "");
+			out += "{\"id\":" + std::to_string(i);
+			out += ",\"firstExpr\":" + std::to_string(blks[i].m_firstExpr);
+			out += ",\"lastExpr\":" + std::to_string(blks[i].m_lastExpr);
+			out += std::string(",\"isLoopHead\":") +
+				(blk.m_isLoopHead ? "true" : "false");
+			out += std::string(",\"isDead\":") +
+				(isDead(blk) ? "true" : "false");
+			out += std::string(",\"hasCounter\":") +
+				(hasCounter(blk) ? "true" : "false");
+			out += ",\"weights\":[" + GetGraphWeightsStr(blk) + "]";
+			if (!hitCounts.empty() && (i < numReachable))
+			{
+				out += ",\"hits\":" + std::to_string(hitCounts[i]);
+			}
+			out += ",\"edges\":[";
+			bool isFirstEdge = true;
+			for (const auto& child : blk.m_children)
+			{
+				if (child.m_ptr != nullptr)
+				{
+					out += (isFirstEdge ? "" : ",");
+					out += "{\"to\":" +
+						std::to_string(blkIdx.at(child.m_ptr));
+					out += std::string(",\"brType\":\"") +
+						GetBrTypeName(child.m_brType) + "\"";
+					out += std::string(",\"cntType\":\"") +
+						GetBrTypeName(child.m_cntType) + "\"}";
+					isFirstEdge = false;
+				}
+			}
+			out += "]}";
+		}
+		out += "]}\n";
+	}
+	return out;
+}
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,266 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include "CodeInjector.hpp"
+#include "ExprWalker.hpp"
+#include "make_unique.hpp"
+
+namespace DecentWasmCounter
+{
+
+// One weight per cost dimension -> index of the thunk charging it
+using IncrThunkMap = std::map<std::vector<uint64_t>, wabt::Index>;
+
+// One weight per cost dimension -> number of increment sites charging it
+using IncrWeightHistogram = std::map<std::vector<uint64_t>, uint64_t>;
+
+/**
+ * @brief Check if the given call to the increment function has constant
+ *        weights, i.e., it's preceded by one `i64.const` per dimension
+ *
+ * @param weights The constant weights, if it's true
+*/
+inline bool GetConstIncrWeights(
+	wabt::ExprList& exprList,
+	wabt::ExprList::iterator callIt,
+	size_t numDims,
+	std::vector<uint64_t>& weights)
+{
+	weights.assign(numDims, 0);
+	auto it = callIt;
+	for (size_t i = numDims; i > 0; --i)
+	{
+		if (it == exprList.begin())
+		{
+			return false;
+		}
+		--it;
+
+		if (it->type() != wabt::ExprType::Const)
+		{
+			return false;
+		}
+		const wabt::Const& c =
+			wabt::cast<const wabt::ConstExpr>(&(*it))->const_;
+		if (c.type() != wabt::Type::I64)
+		{
+			return false;
+		}
+		weights[i - 1] = c.u64();
+	}
+	return true;
+}
+
+template<typename _FuncType>
+inline void ForEachConstIncrSite(
+	const wabt::Module& mod,
+	wabt::Func& func,
+	wabt::Index ctrFuncIdx,
+	size_t numDims,
+	_FuncType&& func2)
+{
+	std::vector<uint64_t> weights;
+	WalkExprListIterator(func.exprs,
+		[&](wabt::ExprList& exprList, wabt::ExprList::iterator exprIt)
+		{
+			if ((exprIt->type() == wabt::ExprType::Call) &&
+				(mod.GetFuncIndex(
+					wabt::cast<wabt::CallExpr>(&(*exprIt))->var) ==
+					ctrFuncIdx) &&
+				GetConstIncrWeights(exprList, exprIt, numDims, weights))
+			{
+				func2(weights, exprList, exprIt);
+			}
+		}
+	);
+}
+
+/**
+ * @brief Count the increment sites with constant weights, by their weights,
+ *        in the functions defined in the module, except the injected ones
+*/
+inline IncrWeightHistogram BuildIncrWeightHistogram(
+	wabt::Module& mod,
+	const InjectedSymbolInfo& symInfo)
+{
+	IncrWeightHistogram hist;
+	wabt::Index ctrFuncIdx = static_cast<wabt::Index>(symInfo.m_funcIncrId);
+	for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+	{
+		if (symInfo.IsInjectedFunc(i))
+		{
+			continue;
+		}
+		ForEachConstIncrSite(mod, *(mod.funcs[i]), ctrFuncIdx,
+			symInfo.m_ctrIds.size(),
+			[&](const std::vector<uint64_t>& weights,
+				wabt::ExprList&, wabt::ExprList::iterator)
+			{
+				++hist[weights];
+			}
+		);
+	}
+	return hist;
+}
+
+inline size_t GetConstIncrSize(
+	const std::vector<uint64_t>& weights,
+	wabt::Index ctrFuncIdx)
+{
+	// i64.const weight_0 ... i64.const weight_(K-1), call $incr
+	size_t size = 1 + GetULeb128Size(ctrFuncIdx);
+	for (uint64_t weight : weights)
+	{
+		size += 1 + GetSLeb128Size(static_cast<int64_t>(weight));
+	}
+	return size;
+}
+
+/**
+ * @brief Pick the weights worth a thunk, i.e., the ones whose sites save
+ *        more bytes than the thunk costs, the most saving first
+ *
+ * @param firstThunkIdx Index of the first thunk to be injected
+ * @param maxThunks     Maximum number of thunks
+*/
+inline std::vector<std::vector<uint64_t> > SelectIncrThunkWeights(
+	const IncrWeightHistogram& hist,
+	wabt::Index ctrFuncIdx,
+	wabt::Index firstThunkIdx,
+	size_t maxThunks)
+{
+	std::vector<std::pair<uint64_t, const std::vector<uint64_t>*> > savings;
+	for (const auto& item : hist)
+	{
+		size_t siteSize = GetConstIncrSize(item.first, ctrFuncIdx);
+		// call $incr_<w>, assuming the largest index it may get
+		size_t thunkCallSize =
+			1 + GetULeb128Size(firstThunkIdx + maxThunks);
+		// type index, body size, local declarations, body, and its end
+		size_t thunkSize = 3 + siteSize + 1;
+
+		if (siteSize <= thunkCallSize)
+		{
+			continue;
+		}
+		uint64_t saved = item.second * (siteSize - thunkCallSize);
+		if (saved > thunkSize)
+		{
+			savings.emplace_back(saved - thunkSize, &(item.first));
+		}
+	}
+	std::stable_sort(savings.begin(), savings.end(),
+		[](const std::pair<uint64_t, const std::vector<uint64_t>*>& a,
+			const std::pair<uint64_t, const std::vector<uint64_t>*>& b)
+		{
+			return a.first > b.first;
+		}
+	);
+
+	std::vector<std::vector<uint64_t> > res;
+	for (size_t i = 0; (i < savings.size()) && (i < maxThunks); ++i)
+	{
+		res.push_back(*(savings[i].second));
+	}
+	return res;
+}
+
+/**
+ * @brief Append one zero-argument thunk per weight vector, which calls the
+ *        increment function with the constant weights
+*/
+inline IncrThunkMap InjectIncrThunks(
+	wabt::Module& mod,
+	const std::vector<std::vector<uint64_t> >& thunkWeights,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
+{
+	IncrThunkMap thunks;
+	for (const std::vector<uint64_t>& weights : thunkWeights)
+	{
+		wabt::Index thunkIdx = static_cast<wabt::Index>(mod.funcs.size());
+		std::unique_ptr<wabt::FuncModuleField> thunk =
+			Internal::make_unique<wabt::FuncModuleField>();
+
+		// - -> i64.const weight_0
+		// - -> ...
+		// - -> i64.const weight_(K-1)
+		// - -> call $incr
+		for (uint64_t weight : weights)
+		{
+			thunk->func.exprs.push_back(
+				Internal::make_unique<wabt::ConstExpr>(
+					wabt::Const::I64(weight)));
+			stats.AddExpr(thunk->func.exprs.back());
+		}
+		thunk->func.exprs.push_back(
+			Internal::make_unique<wabt::CallExpr>(wabt::Var(ctrFuncIdx)));
+		stats.AddExpr(thunk->func.exprs.back());
+		// type index, body size, local declarations, and end
+		stats.m_numBytes += 4;
+
+		AddFuncTypeIfNotExist(thunk->func.decl.sig, mod);
+
+		mod.AppendField(std::move(thunk));
+
+		thunks.emplace(weights, thunkIdx);
+	}
+	return thunks;
+}
+
+/**
+ * @brief Replace each increment site whose weights have a thunk with a
+ *        single call to the thunk
+ *
+ * @param numSites Incremented by the number of sites rewritten
+ * @return Number of bytes saved
+*/
+inline size_t RewriteIncrSites(
+	wabt::Module& mod,
+	wabt::Func& func,
+	wabt::Index ctrFuncIdx,
+	size_t numDims,
+	const IncrThunkMap& thunks,
+	uint64_t& numSites)
+{
+	size_t numSaved = 0;
+	ForEachConstIncrSite(mod, func, ctrFuncIdx, numDims,
+		[&](const std::vector<uint64_t>& weights,
+			wabt::ExprList& exprList, wabt::ExprList::iterator exprIt)
+		{
+			auto itThunk = thunks.find(weights);
+			if (itThunk == thunks.end())
+			{
+				return;
+			}
+
+			numSaved += GetConstIncrSize(weights, ctrFuncIdx);
+			for (size_t i = 0; i < numDims; ++i)
+			{
+				auto constIt = exprIt;
+				exprList.erase(--constIt);
+			}
+			// the walker moves on from the call, so it's rewritten in place
+			wabt::cast<wabt::CallExpr>(&(*exprIt))->var =
+				wabt::Var(itThunk->second);
+			numSaved -= GetInjectedExprSize(*exprIt);
+			++numSites;
+		}
+	);
+	return numSaved;
+}
+
+} // namespace DecentWasmCounter
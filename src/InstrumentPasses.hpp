@@ -0,0 +1,371 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <unordered_map>
+
+#include <src/ir.h>
+
+#include "BlockGenerator.hpp"
+#include "BlockTable.hpp"
+#include "CodeInjector.hpp"
+#include "CounterMerge.hpp"
+#include "PassManager.hpp"
+#include "Reachability.hpp"
+#include "Repricing.hpp"
+#include "TrustedFuncs.hpp"
+#include "WeightCalculator.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Generate the block-flow graph of the function
+*/
+class GraphGenPass : public FuncPass
+{
+public:
+	GraphGenPass() :
+		FuncPass("GraphGen", PassKind::Analysis)
+	{}
+
+	virtual ~GraphGenPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		ctx.m_graph = GenerateGraph(ctx.m_func);
+
+		ctx.m_stats.m_numBlocks = ctx.m_graph.m_storage.m_vec.size();
+		ctx.m_stats.m_numEmptyBlocksDropped =
+			ctx.m_graph.m_storage.m_numEmptyDropped;
+
+		return ctx.m_graph.m_storage.m_numAllocs;
+	}
+}; // class GraphGenPass
+
+/**
+ * @brief Find blocks that can't be reached from the head of the graph
+*/
+class ReachabilityPass : public FuncPass
+{
+public:
+	ReachabilityPass() :
+		FuncPass("Reachability", PassKind::Analysis)
+	{}
+
+	virtual ~ReachabilityPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		MarkReachableBlocks(ctx.m_graph);
+		ctx.m_deadBlocks = GetDeadBlocks(ctx.m_graph);
+
+		ctx.m_stats.m_numDeadBlocks = ctx.m_deadBlocks.size();
+
+		return 0;
+	}
+}; // class ReachabilityPass
+
+/**
+ * @brief Calculate the weight of each block in the block-flow graph
+*/
+class WeightCalcPass : public FuncPass
+{
+public:
+	WeightCalcPass(
+		const WeightCalculator& wCalc,
+		const ImportFuncInfo& funcInfo) :
+		FuncPass("WeightCalc", PassKind::Analysis),
+		m_wCalc(wCalc),
+		m_funcInfo(funcInfo)
+	{}
+
+	virtual ~WeightCalcPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		m_wCalc.CalcWeight(ctx.m_graph.m_head, m_funcInfo);
+
+		// each block with weights calculated has a weight vector
+		size_t numAllocs = 0;
+		ctx.m_stats.m_staticWeights.assign(m_wCalc.GetNumOfDimensions(), 0);
+		for (const auto& blk : ctx.m_graph.m_storage.m_vec)
+		{
+			if (blk->m_isWeightCalc)
+			{
+				++numAllocs;
+				for (size_t dim = 0; dim < blk->m_weights.size(); ++dim)
+				{
+					ctx.m_stats.m_staticWeights[dim] += blk->m_weights[dim];
+				}
+			}
+		}
+
+		return numAllocs;
+	}
+
+private:
+	const WeightCalculator& m_wCalc;
+	const ImportFuncInfo& m_funcInfo;
+}; // class WeightCalcPass
+
+/**
+ * @brief Move the weights of blocks that always run together with an
+ *        earlier block to that block, so they don't need their own counters
+*/
+class BlockMergePass : public FuncPass
+{
+public:
+	BlockMergePass() :
+		FuncPass("BlockMerge", PassKind::Analysis)
+	{}
+
+	virtual ~BlockMergePass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		ctx.m_stats.m_numBlocksMerged =
+			MergeEquivalentBlocks(ctx.m_func, ctx.m_graph);
+
+		return 0;
+	}
+}; // class BlockMergePass
+
+/**
+ * @brief Inject a counter increment at the end of each block with weights
+*/
+class BlockCounterPass : public FuncPass
+{
+public:
+	BlockCounterPass(wabt::Index ctrFuncIdx) :
+		FuncPass("BlockCounter", PassKind::Transform),
+		m_ctrFuncIdx(ctrFuncIdx),
+		m_funcInfo(nullptr),
+		m_repricingBuilder(nullptr)
+	{}
+
+	/**
+	 * @brief Inject a counter for every reachable block, and record what
+	 *        each counter is charging in the given builder, so the module
+	 *        can be repriced later
+	*/
+	BlockCounterPass(
+		wabt::Index ctrFuncIdx,
+		const ImportFuncInfo& funcInfo,
+		RepricingInfoBuilder& repricingBuilder) :
+		FuncPass("BlockCounter", PassKind::Transform),
+		m_ctrFuncIdx(ctrFuncIdx),
+		m_funcInfo(&funcInfo),
+		m_repricingBuilder(&repricingBuilder)
+	{}
+
+	virtual ~BlockCounterPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		InjectionStats stats;
+		if (m_repricingBuilder == nullptr)
+		{
+			InjectBlockCounter(ctx.m_graph.m_head, m_ctrFuncIdx, stats);
+		}
+		else
+		{
+			// the histograms must be taken before the block ranges are
+			// changed by the injection
+			std::unordered_map<const Block*, CostHistogram> blkHists;
+			for (const auto& blk : ctx.m_graph.m_storage.m_vec)
+			{
+				if (blk->m_isReachable)
+				{
+					blkHists[blk.get()] =
+						CalcBlockCostHistogram(*blk, *m_funcInfo);
+				}
+			}
+
+			InjectBlockCounter(ctx.m_graph.m_head, m_ctrFuncIdx, stats, true,
+				[&](const Block& blk, const wabt::Expr& ctrCall)
+				{
+					m_repricingBuilder->AddSite(
+						&ctrCall, std::move(blkHists[&blk]));
+				}
+			);
+		}
+
+		ctx.m_stats.m_numCountersInjected += stats.m_numCounters;
+		ctx.m_stats.m_numBytesAdded += stats.m_numBytes;
+
+		return stats.m_numExprs;
+	}
+
+private:
+	wabt::Index m_ctrFuncIdx;
+	const ImportFuncInfo* m_funcInfo;
+	RepricingInfoBuilder* m_repricingBuilder;
+}; // class BlockCounterPass
+
+/**
+ * @brief Replace the code of dead blocks with `unreachable`;
+ *        this must be the last pass using the graph
+*/
+class DeadBlockPrunePass : public FuncPass
+{
+public:
+	DeadBlockPrunePass() :
+		FuncPass("DeadBlockPrune", PassKind::Transform)
+	{}
+
+	virtual ~DeadBlockPrunePass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		if (!ctx.m_isCounted)
+		{
+			return 0;
+		}
+
+		ctx.m_stats.m_numExprsPruned =
+			PruneDeadBlocks(ctx.m_func, ctx.m_deadBlocks);
+		ctx.m_deadBlocks.clear();
+
+		// only one `unreachable` is allocated for each pruned expr list
+		return 0;
+	}
+}; // class DeadBlockPrunePass
+
+/**
+ * @brief Inject runtime-proportional charges before size-dependent
+ *        instructions; this is needed even if the function is charged at
+ *        its call sites
+*/
+class DynamicCounterPass : public FuncPass
+{
+public:
+	DynamicCounterPass(
+		const wabt::Module& mod,
+		const DynamicWeightMapType& dynWeightMap,
+		wabt::Index ctrFuncIdx) :
+		FuncPass("DynamicCounter", PassKind::Transform),
+		m_mod(mod),
+		m_dynWeightMap(dynWeightMap),
+		m_ctrFuncIdx(ctrFuncIdx)
+	{}
+
+	virtual ~DynamicCounterPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		InjectionStats stats;
+		InjectDynamicCounter(m_mod, ctx.m_func, m_dynWeightMap,
+			m_ctrFuncIdx, stats);
+
+		ctx.m_stats.m_numCountersInjected += stats.m_numCounters;
+		ctx.m_stats.m_numBytesAdded += stats.m_numBytes;
+
+		return stats.m_numExprs;
+	}
+
+private:
+	const wabt::Module& m_mod;
+	const DynamicWeightMapType& m_dynWeightMap;
+	wabt::Index m_ctrFuncIdx;
+}; // class DynamicCounterPass
+
+/**
+ * @brief Inject the size charges before calls to trusted functions that are
+ *        charged at their call sites; like DynamicCounterPass, this is needed
+ *        even if the caller is charged at its call sites
+*/
+class TrustedCallCounterPass : public FuncPass
+{
+public:
+	TrustedCallCounterPass(
+		const wabt::Module& mod,
+		const TrustedFuncMap& trustedFuncs,
+		wabt::Index ctrFuncIdx) :
+		FuncPass("TrustedCallCounter", PassKind::Transform),
+		m_mod(mod),
+		m_trustedFuncs(trustedFuncs),
+		m_ctrFuncIdx(ctrFuncIdx)
+	{}
+
+	virtual ~TrustedCallCounterPass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		InjectionStats stats;
+		InjectTrustedCallCounter(ctx.m_func, m_mod, m_trustedFuncs,
+			m_ctrFuncIdx, stats);
+
+		ctx.m_stats.m_numCountersInjected += stats.m_numCounters;
+		ctx.m_stats.m_numBytesAdded += stats.m_numBytes;
+
+		return stats.m_numExprs;
+	}
+
+private:
+	const wabt::Module& m_mod;
+	const TrustedFuncMap& m_trustedFuncs;
+	wabt::Index m_ctrFuncIdx;
+}; // class TrustedCallCounterPass
+
+/**
+ * @brief Record the block-flow graph and the block weights of the function
+ *        in the block table, instead of injecting counters
+*/
+class BlockTablePass : public FuncPass
+{
+public:
+	BlockTablePass(
+		const DynamicWeightMapType& dynWeightMap,
+		BlockTable& table) :
+		FuncPass("BlockTable", PassKind::Analysis),
+		m_dynWeightMap(dynWeightMap),
+		m_table(table)
+	{}
+
+	virtual ~BlockTablePass() = default;
+
+	virtual size_t Run(FuncPassContext& ctx) const override
+	{
+		// the graph is empty if the function is not counted, but its
+		// runtime-proportional charges are still needed
+		m_table.m_funcs.emplace_back(BuildFuncBlockTable(
+			ctx.m_func, ctx.m_funcIdx, ctx.m_graph, m_dynWeightMap));
+
+		return m_table.m_funcs.back().m_blocks.size();
+	}
+
+private:
+	const DynamicWeightMapType& m_dynWeightMap;
+	BlockTable& m_table;
+}; // class BlockTablePass
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,81 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <new>
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Thrown by the allocator of the trusted library when the memory
+ *        limit is exceeded; it's a std::bad_alloc, so it can be thrown from
+ *        `operator new`
+*/
+class MemoryLimitExceeded : public std::bad_alloc
+{
+public:
+	MemoryLimitExceeded() = default;
+
+	virtual ~MemoryLimitExceeded() = default;
+
+	virtual const char* what() const noexcept override
+	{
+		return "The memory limit of the module is exceeded";
+	}
+}; // class MemoryLimitExceeded
+
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+
+/**
+ * @brief Limit the bytes allocated (and not yet freed) by the current thread
+ *        while the scope is alive; the allocations made in the scope are
+ *        recorded by the allocator of the trusted library
+*/
+class MemoryLimitScope
+{
+public:
+
+	/**
+	 * @param limit Unlimited if it's 0
+	*/
+	explicit MemoryLimitScope(uint64_t limit);
+
+	MemoryLimitScope(const MemoryLimitScope&) = delete;
+
+	~MemoryLimitScope();
+
+	MemoryLimitScope& operator=(const MemoryLimitScope&) = delete;
+
+	/**
+	 * @brief Charge an allocation to the current scope of this thread
+	 *
+	 * @exception MemoryLimitExceeded
+	 * @return ID of the scope to refund later; 0 if there is none
+	*/
+	static uint64_t Charge(size_t size);
+
+	/**
+	 * @brief Refund a freed allocation, if it's charged to the current scope
+	 *        of this thread
+	*/
+	static void Refund(uint64_t scopeId, size_t size) noexcept;
+
+private:
+
+	uint64_t m_id;
+	uint64_t m_limit;
+	uint64_t m_used;
+	MemoryLimitScope* m_prev;
+
+}; // class MemoryLimitScope
+
+#endif // DECENT_WASM_COUNTER_TRUSTED
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,224 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <src/ir.h>
+
+#include <DecentWasmCounter/Exceptions.hpp>
+#include <DecentWasmCounter/Statistics.hpp>
+
+#include "Block.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief The state shared by the passes run on the same function
+*/
+struct FuncPassContext
+{
+	FuncPassContext(
+		wabt::Func& func,
+		wabt::Index funcIdx,
+		bool isCounted) :
+		m_func(func),
+		m_funcIdx(funcIdx),
+		m_isCounted(isCounted),
+		m_graph(),
+		m_deadBlocks(),
+		m_stats()
+	{
+		m_stats.m_funcIdx = funcIdx;
+		m_stats.m_isCounted = isCounted;
+	}
+
+	wabt::Func& m_func;
+	wabt::Index m_funcIdx;
+
+	// false if the function doesn't need block counters
+	// (e.g., it's charged at its call sites)
+	bool m_isCounted;
+
+	Graph m_graph;
+
+	// blocks in m_graph that can't be reached
+	std::vector<Block*> m_deadBlocks;
+
+	FuncStatistics m_stats;
+}; // struct FuncPassContext
+
+class FuncPass
+{
+public:
+	FuncPass(std::string name, PassKind kind) :
+		m_name(std::move(name)),
+		m_kind(kind)
+	{}
+
+	virtual ~FuncPass() = default;
+
+	const std::string& GetName() const
+	{
+		return m_name;
+	}
+
+	PassKind GetKind() const
+	{
+		return m_kind;
+	}
+
+	/**
+	 * @brief Run the pass on the given function
+	 *
+	 * @return The number of objects allocated by this run
+	*/
+	virtual size_t Run(FuncPassContext& ctx) const = 0;
+
+private:
+	std::string m_name;
+	PassKind m_kind;
+}; // class FuncPass
+
+/**
+ * @brief Runs the registered passes in order, and keeps the wall time and
+ *        the number of allocations of each pass
+*/
+class PassManager
+{
+public:
+
+	using Clock = std::chrono::steady_clock;
+
+	PassManager() :
+		m_passes(),
+		m_stats(),
+		m_passStatIdx(),
+		m_hasTransform(false)
+	{}
+
+	virtual ~PassManager() = default;
+
+	/**
+	 * @brief Register a function pass; passes are run in the order they are
+	 *        registered. Analysis passes must be registered before any
+	 *        transform pass, since transforms may invalidate the results.
+	*/
+	void AddPass(std::unique_ptr<FuncPass> pass)
+	{
+		if (m_passStatIdx.size() > 0)
+		{
+			throw Exception("Passes can't be registered after they are run");
+		}
+
+		if (pass->GetKind() == PassKind::Transform)
+		{
+			m_hasTransform = true;
+		}
+		else if (m_hasTransform)
+		{
+			throw Exception(
+				"Analysis pass " + pass->GetName() +
+				" is registered after transform passes");
+		}
+
+		m_passes.emplace_back(std::move(pass));
+	}
+
+	/**
+	 * @brief Run all registered function passes on the given function
+	*/
+	void Run(FuncPassContext& ctx)
+	{
+		if (m_passStatIdx.size() != m_passes.size())
+		{
+			// first run, statistics are listed from here
+			for (const auto& pass : m_passes)
+			{
+				m_passStatIdx.push_back(m_stats.size());
+				m_stats.emplace_back(
+					NewPassStatistics(pass->GetName(), pass->GetKind()));
+			}
+		}
+
+		for (size_t i = 0; i < m_passes.size(); ++i)
+		{
+			auto start = Clock::now();
+			size_t numAllocs = m_passes[i]->Run(ctx);
+			auto end = Clock::now();
+
+			RecordRun(m_stats[m_passStatIdx[i]], end - start, numAllocs);
+		}
+	}
+
+	/**
+	 * @brief Run a module-level step, and record it as a pass
+	 *
+	 * @tparam _FuncType callable as `size_t()`, which returns the number of
+	 *                   objects allocated
+	*/
+	template<typename _FuncType>
+	void RunModuleStep(
+		const std::string& name,
+		PassKind kind,
+		_FuncType&& func)
+	{
+		m_stats.emplace_back(NewPassStatistics(name, kind));
+		size_t statIdx = m_stats.size() - 1;
+
+		auto start = Clock::now();
+		size_t numAllocs = func();
+		auto end = Clock::now();
+
+		RecordRun(m_stats[statIdx], end - start, numAllocs);
+	}
+
+	/**
+	 * @brief Get statistics of module-level steps and function passes,
+	 *        in the order they are first run
+	*/
+	const std::vector<PassStatistics>& GetStatistics() const
+	{
+		return m_stats;
+	}
+
+private:
+
+	static PassStatistics NewPassStatistics(
+		const std::string& name,
+		PassKind kind)
+	{
+		PassStatistics stats;
+		stats.m_name = name;
+		stats.m_kind = kind;
+		return stats;
+	}
+
+	static void RecordRun(
+		PassStatistics& stats,
+		Clock::duration duration,
+		size_t numAllocs)
+	{
+		++stats.m_numRuns;
+		stats.m_wallTimeNs += static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				duration).count());
+		stats.m_numAllocs += numAllocs;
+	}
+
+	std::vector<std::unique_ptr<FuncPass> > m_passes;
+	std::vector<PassStatistics> m_stats;
+	// index of each function pass in m_stats
+	std::vector<size_t> m_passStatIdx;
+	bool m_hasTransform;
+}; // class PassManager
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,272 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <unordered_set>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include "Block.hpp"
+#include "make_unique.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Mark all blocks that can be reached from the head of the graph
+ *
+ * @return Number of reachable blocks
+*/
+inline size_t MarkReachableBlocks(Graph& gr)
+{
+	size_t numReachable = 0;
+
+	std::vector<Block*> stack;
+	if (gr.m_head != nullptr)
+	{
+		stack.push_back(gr.m_head);
+	}
+
+	while (stack.size() > 0)
+	{
+		Block* blk = stack.back();
+		stack.pop_back();
+
+		if (blk->m_isReachable)
+		{
+			continue;
+		}
+		blk->m_isReachable = true;
+		++numReachable;
+
+		for (const auto& child : blk->m_children)
+		{
+			if ((child.m_ptr != nullptr) && !child.m_ptr->m_isReachable)
+			{
+				stack.push_back(child.m_ptr);
+			}
+		}
+	}
+
+	return numReachable;
+}
+
+/**
+ * @brief Get blocks that can't be reached, i.e., the ones following an
+ *        unconditional `br`/`return`/`unreachable` that nothing branches to.
+ *        MarkReachableBlocks must be called first.
+ *        NOTE: loop declaration blocks are never considered dead, since the
+ *        graph doesn't have edges for falling through into a loop.
+*/
+inline std::vector<Block*> GetDeadBlocks(const Graph& gr)
+{
+	std::vector<Block*> res;
+	for (const auto& blk : gr.m_storage.m_vec)
+	{
+		if (!blk->m_isReachable && !blk->m_isLoopHead)
+		{
+			res.push_back(blk.get());
+		}
+	}
+	return res;
+}
+
+inline bool IsUnconditionalBranchExpr(wabt::ExprType exprType)
+{
+	switch (exprType)
+	{
+	case wabt::ExprType::Br:
+	case wabt::ExprType::BrTable:
+	case wabt::ExprType::Return:
+	case wabt::ExprType::ReturnCall:
+	case wabt::ExprType::ReturnCallIndirect:
+	case wabt::ExprType::Throw:
+	case wabt::ExprType::Rethrow:
+	case wabt::ExprType::Unreachable:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Count the given expr and the exprs nested in it
+*/
+inline size_t CountExprs(const wabt::Expr& expr)
+{
+	size_t count = 1;
+
+	std::vector<const wabt::ExprList*> nested;
+	switch (expr.type())
+	{
+	case wabt::ExprType::Block:
+		nested.push_back(
+			&(wabt::cast<const wabt::BlockExpr>(&expr)->block.exprs));
+		break;
+	case wabt::ExprType::Loop:
+		nested.push_back(
+			&(wabt::cast<const wabt::LoopExpr>(&expr)->block.exprs));
+		break;
+	case wabt::ExprType::Try:
+	{
+		const wabt::TryExpr* tryExpr = wabt::cast<const wabt::TryExpr>(&expr);
+		nested.push_back(&(tryExpr->block.exprs));
+		for (const wabt::Catch& catchBlk : tryExpr->catches)
+		{
+			nested.push_back(&(catchBlk.exprs));
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	for (const wabt::ExprList* exprList : nested)
+	{
+		for (const wabt::Expr& e : *exprList)
+		{
+			count += CountExprs(e);
+		}
+	}
+
+	return count;
+}
+
+/**
+ * @brief Replace the body of a function that can never be executed with a
+ *        single `unreachable`, and drop its locals
+ *
+ * @return Number of exprs removed
+*/
+inline size_t StubUnreachableFunc(wabt::Func& func)
+{
+	size_t numRemoved = 0;
+	for (const wabt::Expr& expr : func.exprs)
+	{
+		numRemoved += CountExprs(expr);
+	}
+
+	func.exprs.clear();
+	func.exprs.push_back(Internal::make_unique<wabt::UnreachableExpr>());
+
+	// the names of the locals are dropped as well, while the ones of the
+	// parameters are kept
+	wabt::Index numParams = func.GetNumParams();
+	func.local_types.Set(wabt::TypeVector());
+	for (auto it = func.bindings.begin(); it != func.bindings.end();)
+	{
+		if (it->second.index >= numParams)
+		{
+			it = func.bindings.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	return numRemoved;
+}
+
+/**
+ * @brief Remove the dead tail of each expr list (replaced by `unreachable`
+ *        if necessary).
+ *        Once a block in an expr list is dead, everything after it in the
+ *        same list is dead as well, since it can only be entered by falling
+ *        through from the dead block.
+ *
+ * @param deadBegins The first expr of each dead block
+ *
+ * @return Number of exprs removed
+*/
+inline size_t PruneDeadExprs(
+	wabt::ExprList& exprList,
+	const std::unordered_set<const wabt::Expr*>& deadBegins)
+{
+	size_t numPruned = 0;
+	for (auto it = exprList.begin(); it != exprList.end(); ++it)
+	{
+		if (deadBegins.find(&(*it)) != deadBegins.end())
+		{
+			while (it != exprList.end())
+			{
+				auto toErase = it++;
+				numPruned += CountExprs(*toErase);
+				exprList.erase(toErase);
+			}
+
+			// the stack is already polymorphic after an unconditional
+			// branch, otherwise, (e.g., the whole list is dead),
+			// an `unreachable` is needed to keep the module valid
+			if (exprList.empty() ||
+				!IsUnconditionalBranchExpr(exprList.back().type()))
+			{
+				exprList.push_back(
+					Internal::make_unique<wabt::UnreachableExpr>());
+				--numPruned;
+			}
+			return numPruned;
+		}
+
+		switch (it->type())
+		{
+		case wabt::ExprType::Block:
+			numPruned += PruneDeadExprs(
+				wabt::cast<wabt::BlockExpr>(&(*it))->block.exprs, deadBegins);
+			break;
+		case wabt::ExprType::Loop:
+			numPruned += PruneDeadExprs(
+				wabt::cast<wabt::LoopExpr>(&(*it))->block.exprs, deadBegins);
+			break;
+		case wabt::ExprType::Try:
+		{
+			// handlers are dead if nothing in the body may throw
+			wabt::TryExpr* tryExpr = wabt::cast<wabt::TryExpr>(&(*it));
+			numPruned += PruneDeadExprs(tryExpr->block.exprs, deadBegins);
+			for (wabt::Catch& catchBlk : tryExpr->catches)
+			{
+				numPruned += PruneDeadExprs(catchBlk.exprs, deadBegins);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return numPruned;
+}
+
+/**
+ * @brief Replace the code of dead blocks with `unreachable`.
+ *        This must be the last step using the graph, since the dead blocks
+ *        refer to exprs that are removed.
+ *
+ * @return Number of exprs removed
+*/
+inline size_t PruneDeadBlocks(
+	wabt::Func& func,
+	const std::vector<Block*>& deadBlocks)
+{
+	std::unordered_set<const wabt::Expr*> deadBegins;
+	for (const Block* blk : deadBlocks)
+	{
+		if (!blk->IsEmpty())
+		{
+			deadBegins.insert(&(*(blk->m_blkBegin)));
+		}
+	}
+
+	if (deadBegins.empty())
+	{
+		return 0;
+	}
+
+	return PruneDeadExprs(func.exprs, deadBegins);
+}
+
+} // namespace DecentWasmCounter
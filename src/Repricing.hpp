@@ -0,0 +1,525 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include <DecentWasmCounter/CostModel.hpp>
+#include <DecentWasmCounter/Exceptions.hpp>
+
+#include "Block.hpp"
+#include "Classification.hpp"
+#include "ExprWalker.hpp"
+#include "WeightCalculator.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Name of the custom section that keeps what is needed to reprice
+ *        an instrumented module
+*/
+inline const char* GetRepricingSectionName()
+{
+	return "decent_wasm_counter.reprice";
+}
+
+enum class CostKeyKind : uint8_t
+{
+	// Priced by the expr type name and, if there is one, the mnemonic
+	Expr = 0,
+	// Priced by the weight of the imported function (module, field)
+	ImportCall = 1,
+}; // enum class CostKeyKind
+
+/**
+ * @brief Something that is priced by a cost model, e.g., `Binary/i32.add`;
+ *        the weight of a block is the sum of prices of its cost keys
+*/
+struct CostKey
+{
+	CostKeyKind m_kind;
+	std::string m_first;  // expr type name, or import module name
+	std::string m_second; // mnemonic (or empty), or import field name
+
+	bool operator<(const CostKey& rhs) const
+	{
+		return std::tie(m_kind, m_first, m_second) <
+			std::tie(rhs.m_kind, rhs.m_first, rhs.m_second);
+	}
+}; // struct CostKey
+
+// Number of occurrences of each cost key in a block
+using CostHistogram = std::map<CostKey, uint64_t>;
+
+/**
+ * @brief Get the cost keys of the given expr; this must agree with
+ *        BuildExprWeightCalcMap
+*/
+inline void AddExprCostKeys(
+	const wabt::Expr& expr,
+	const ImportFuncInfo& funcInfo,
+	CostHistogram& hist)
+{
+	wabt::ExprType exprType = expr.type();
+
+	CostKey key{ CostKeyKind::Expr, wabt::GetExprTypeName(exprType), "" };
+	if (HasExprOpcode(exprType))
+	{
+		key.m_second = GetExprOpcode(expr).GetName();
+	}
+	++hist[key];
+
+	const wabt::Var* calleeVar = nullptr;
+	if (exprType == wabt::ExprType::Call)
+	{
+		calleeVar = &(wabt::cast<const wabt::CallExpr>(&expr)->var);
+	}
+	else if (exprType == wabt::ExprType::ReturnCall)
+	{
+		calleeVar = &(wabt::cast<const wabt::ReturnCallExpr>(&expr)->var);
+	}
+
+	if (calleeVar != nullptr)
+	{
+		wabt::Index funcIdx = funcInfo.m_nameBinding.FindIndex(*calleeVar);
+		if (funcIdx < funcInfo.m_funcList.size())
+		{
+			const auto& impFuncName = funcInfo.m_funcList[funcIdx];
+			++hist[CostKey{ CostKeyKind::ImportCall,
+				impFuncName.first, impFuncName.second }];
+		}
+		else if (funcInfo.m_inModFuncWeights.find(funcIdx) !=
+			funcInfo.m_inModFuncWeights.end())
+		{
+			throw Exception(
+				"Calls charged with the callee's summary can't be repriced");
+		}
+	}
+}
+
+inline CostHistogram CalcBlockCostHistogram(
+	const Block& blk,
+	const ImportFuncInfo& funcInfo)
+{
+	CostHistogram hist;
+	for (auto it = blk.m_blkBegin; it != blk.m_blkEnd; ++it)
+	{
+		AddExprCostKeys(*it, funcInfo, hist);
+	}
+	return hist;
+}
+
+inline uint64_t GetCostKeyPrice(const CostKey& key, const CostModel& model)
+{
+	if (key.m_kind == CostKeyKind::ImportCall)
+	{
+		auto itMod = model.m_importFuncWeights.find(key.m_first);
+		if (itMod != model.m_importFuncWeights.cend())
+		{
+			auto itField = itMod->second.find(key.m_second);
+			if (itField != itMod->second.cend())
+			{
+				return itField->second;
+			}
+		}
+		return model.m_defaultImportFuncWeight;
+	}
+
+	auto itType = model.m_exprTypeWeights.find(key.m_first);
+	uint64_t typeWeight = itType != model.m_exprTypeWeights.cend() ?
+		itType->second :
+		model.m_defaultExprWeight;
+
+	return key.m_second.empty() ?
+		typeWeight :
+		GetOpcodeExprWeight(model, key.m_first, key.m_second, typeWeight);
+}
+
+/**
+ * @brief Visit each call to the increment function in the given function,
+ *        in the order that the sites are numbered
+ *
+ * @tparam _FuncType callable as
+ *                   `void(size_t ordinal, wabt::ExprList&, wabt::ExprList::iterator)`
+*/
+template<typename _FuncType>
+inline void ForEachCounterCall(
+	const wabt::Module& mod,
+	wabt::Func& func,
+	wabt::Index ctrFuncIdx,
+	_FuncType&& func2)
+{
+	size_t ordinal = 0;
+	WalkExprListIterator(func.exprs,
+		[&](wabt::ExprList& exprList, wabt::ExprList::iterator exprIt)
+		{
+			if ((exprIt->type() == wabt::ExprType::Call) &&
+				(mod.GetFuncIndex(
+					wabt::cast<wabt::CallExpr>(&(*exprIt))->var) ==
+					ctrFuncIdx))
+			{
+				func2(ordinal++, exprList, exprIt);
+			}
+		}
+	);
+}
+
+struct RepricingSite
+{
+	// Ordinal of the call to the increment function (including the ones for
+	// runtime-proportional cost) in the function, in code order
+	uint64_t m_ordinal;
+	// (key index, count)
+	std::vector<std::pair<uint64_t, uint64_t> > m_hist;
+}; // struct RepricingSite
+
+struct RepricingInfo
+{
+	RepricingInfo() :
+		m_numDims(0),
+		m_ctrFuncIdx(0),
+		m_keys(),
+		m_funcSites()
+	{}
+
+	uint64_t m_numDims;
+	uint64_t m_ctrFuncIdx;
+	std::vector<CostKey> m_keys;
+	// (function index, sites in the function)
+	std::vector<std::pair<uint64_t, std::vector<RepricingSite> > > m_funcSites;
+}; // struct RepricingInfo
+
+/**
+ * @brief Collects the histogram of each block counter during
+ *        instrumentation, and builds the repricing info afterwards
+*/
+class RepricingInfoBuilder
+{
+public:
+	RepricingInfoBuilder() :
+		m_siteHists()
+	{}
+
+	virtual ~RepricingInfoBuilder() = default;
+
+	/**
+	 * @param ctrCall The call to the increment function of the block counter
+	*/
+	void AddSite(const wabt::Expr* ctrCall, CostHistogram hist)
+	{
+		m_siteHists[ctrCall] = std::move(hist);
+	}
+
+	RepricingInfo Build(
+		wabt::Module& mod,
+		size_t numDims,
+		wabt::Index ctrFuncIdx) const
+	{
+		RepricingInfo info;
+		info.m_numDims = numDims;
+		info.m_ctrFuncIdx = ctrFuncIdx;
+
+		std::map<CostKey, uint64_t> keyIdx;
+
+		for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+		{
+			std::vector<RepricingSite> sites;
+			ForEachCounterCall(mod, *(mod.funcs[i]), ctrFuncIdx,
+				[&](size_t ordinal, wabt::ExprList&, wabt::ExprList::iterator it)
+				{
+					auto itHist = m_siteHists.find(&(*it));
+					if (itHist == m_siteHists.end())
+					{
+						// it's not a block counter
+						return;
+					}
+
+					RepricingSite site;
+					site.m_ordinal = ordinal;
+					for (const auto& item : itHist->second)
+					{
+						auto res = keyIdx.insert(
+							std::make_pair(item.first, info.m_keys.size()));
+						if (res.second)
+						{
+							info.m_keys.push_back(item.first);
+						}
+						site.m_hist.emplace_back(
+							res.first->second, item.second);
+					}
+					sites.emplace_back(std::move(site));
+				}
+			);
+
+			if (sites.size() > 0)
+			{
+				info.m_funcSites.emplace_back(i, std::move(sites));
+			}
+		}
+
+		return info;
+	}
+
+private:
+	std::unordered_map<const wabt::Expr*, CostHistogram> m_siteHists;
+}; // class RepricingInfoBuilder
+
+inline void WriteULeb128(uint64_t val, std::vector<uint8_t>& out)
+{
+	do
+	{
+		uint8_t byte = static_cast<uint8_t>(val & 0x7FU);
+		val >>= 7;
+		if (val != 0)
+		{
+			byte |= 0x80U;
+		}
+		out.push_back(byte);
+	} while (val != 0);
+}
+
+inline uint64_t ReadULeb128(const std::vector<uint8_t>& in, size_t& pos)
+{
+	uint64_t val = 0;
+	for (size_t shift = 0; shift < 64; shift += 7)
+	{
+		if (pos >= in.size())
+		{
+			throw Exception("The custom section is truncated");
+		}
+		uint8_t byte = in[pos++];
+		val |= (static_cast<uint64_t>(byte & 0x7FU) << shift);
+		if ((byte & 0x80U) == 0)
+		{
+			return val;
+		}
+	}
+	throw Exception("The custom section has an invalid LEB128 value");
+}
+
+inline void WriteSectionStr(const std::string& str, std::vector<uint8_t>& out)
+{
+	WriteULeb128(str.size(), out);
+	out.insert(out.end(), str.begin(), str.end());
+}
+
+inline std::string ReadSectionStr(const std::vector<uint8_t>& in, size_t& pos)
+{
+	uint64_t size = ReadULeb128(in, pos);
+	if (size > in.size() - pos)
+	{
+		throw Exception("The custom section is truncated");
+	}
+	std::string str(in.begin() + pos, in.begin() + pos + size);
+	pos += size;
+	return str;
+}
+
+/**
+ * @brief Encode the repricing info:
+ *        version, number of dimensions, increment function index,
+ *        keys (kind, first, second),
+ *        functions (index, sites (ordinal, histogram (key index, count)))
+*/
+inline std::vector<uint8_t> EncodeRepricingInfo(const RepricingInfo& info)
+{
+	std::vector<uint8_t> out;
+	WriteULeb128(1, out); // version
+	WriteULeb128(info.m_numDims, out);
+	WriteULeb128(info.m_ctrFuncIdx, out);
+
+	WriteULeb128(info.m_keys.size(), out);
+	for (const CostKey& key : info.m_keys)
+	{
+		out.push_back(static_cast<uint8_t>(key.m_kind));
+		WriteSectionStr(key.m_first, out);
+		WriteSectionStr(key.m_second, out);
+	}
+
+	WriteULeb128(info.m_funcSites.size(), out);
+	for (const auto& funcSites : info.m_funcSites)
+	{
+		WriteULeb128(funcSites.first, out);
+		WriteULeb128(funcSites.second.size(), out);
+		for (const RepricingSite& site : funcSites.second)
+		{
+			WriteULeb128(site.m_ordinal, out);
+			WriteULeb128(site.m_hist.size(), out);
+			for (const auto& item : site.m_hist)
+			{
+				WriteULeb128(item.first, out);
+				WriteULeb128(item.second, out);
+			}
+		}
+	}
+	return out;
+}
+
+inline RepricingInfo DecodeRepricingInfo(const std::vector<uint8_t>& in)
+{
+	RepricingInfo info;
+	size_t pos = 0;
+
+	if (ReadULeb128(in, pos) != 1)
+	{
+		throw Exception("Unsupported version of the repricing section");
+	}
+	info.m_numDims = ReadULeb128(in, pos);
+	info.m_ctrFuncIdx = ReadULeb128(in, pos);
+
+	uint64_t numKeys = ReadULeb128(in, pos);
+	for (uint64_t i = 0; i < numKeys; ++i)
+	{
+		if (pos >= in.size())
+		{
+			throw Exception("The repricing section is truncated");
+		}
+		CostKey key;
+		key.m_kind = static_cast<CostKeyKind>(in[pos++]);
+		key.m_first = ReadSectionStr(in, pos);
+		key.m_second = ReadSectionStr(in, pos);
+		info.m_keys.push_back(std::move(key));
+	}
+
+	uint64_t numFuncs = ReadULeb128(in, pos);
+	for (uint64_t i = 0; i < numFuncs; ++i)
+	{
+		uint64_t funcIdx = ReadULeb128(in, pos);
+		uint64_t numSites = ReadULeb128(in, pos);
+
+		std::vector<RepricingSite> sites;
+		for (uint64_t j = 0; j < numSites; ++j)
+		{
+			RepricingSite site;
+			site.m_ordinal = ReadULeb128(in, pos);
+			uint64_t numItems = ReadULeb128(in, pos);
+			for (uint64_t k = 0; k < numItems; ++k)
+			{
+				uint64_t keyIdx = ReadULeb128(in, pos);
+				uint64_t count = ReadULeb128(in, pos);
+				if (keyIdx >= info.m_keys.size())
+				{
+					throw Exception("The repricing section has an invalid key");
+				}
+				site.m_hist.emplace_back(keyIdx, count);
+			}
+			sites.emplace_back(std::move(site));
+		}
+		info.m_funcSites.emplace_back(funcIdx, std::move(sites));
+	}
+
+	return info;
+}
+
+/**
+ * @brief Set the weights of block counters recorded in the repricing info.
+ *        All the block counters are checked against the repricing info
+ *        before any of them is changed, so the module is left untouched if
+ *        it throws.
+*/
+inline void RepriceModule(
+	wabt::Module& mod,
+	const RepricingInfo& info,
+	const std::vector<CostModel>& models)
+{
+	if (models.size() != info.m_numDims)
+	{
+		throw Exception(
+			"The number of cost models doesn't match the instrumented module");
+	}
+	if (info.m_ctrFuncIdx >= mod.funcs.size())
+	{
+		throw Exception("The repricing section has an invalid function index");
+	}
+
+	// price of each key, one per dimension
+	std::vector<std::vector<uint64_t> > prices;
+	for (const CostKey& key : info.m_keys)
+	{
+		std::vector<uint64_t> keyPrices;
+		for (const CostModel& model : models)
+		{
+			keyPrices.push_back(GetCostKeyPrice(key, model));
+		}
+		prices.emplace_back(std::move(keyPrices));
+	}
+
+	// # find the weight constants of all sites, and their new values
+	std::vector<std::pair<wabt::ConstExpr*, uint64_t> > patches;
+	wabt::Index ctrFuncIdx = static_cast<wabt::Index>(info.m_ctrFuncIdx);
+	for (const auto& funcSites : info.m_funcSites)
+	{
+		if ((funcSites.first < mod.num_func_imports) ||
+			(funcSites.first >= mod.funcs.size()))
+		{
+			throw Exception(
+				"The repricing section has an invalid function index");
+		}
+
+		const std::vector<RepricingSite>& sites = funcSites.second;
+		size_t siteIdx = 0;
+		ForEachCounterCall(mod, *(mod.funcs[funcSites.first]), ctrFuncIdx,
+			[&](size_t ordinal, wabt::ExprList& exprList,
+				wabt::ExprList::iterator it)
+			{
+				if ((siteIdx >= sites.size()) ||
+					(sites[siteIdx].m_ordinal != ordinal))
+				{
+					return;
+				}
+				const RepricingSite& site = sites[siteIdx++];
+
+				// i64.const weight_0 ... i64.const weight_(K-1)
+				// call $incr
+				for (size_t i = info.m_numDims; i > 0; --i)
+				{
+					if (it == exprList.begin())
+					{
+						throw Exception("The block counter is malformed");
+					}
+					--it;
+					if (it->type() != wabt::ExprType::Const)
+					{
+						throw Exception("The block counter is malformed");
+					}
+
+					uint64_t weight = 0;
+					for (const auto& item : site.m_hist)
+					{
+						weight += prices[item.first][i - 1] * item.second;
+					}
+					patches.emplace_back(
+						wabt::cast<wabt::ConstExpr>(&(*it)), weight);
+				}
+			}
+		);
+
+		if (siteIdx != sites.size())
+		{
+			throw Exception(
+				"The block counters don't match the repricing section");
+		}
+	}
+
+	// # all sites are found, so nothing below can fail
+	for (const auto& patch : patches)
+	{
+		patch.first->const_ = wabt::Const::I64(patch.second);
+	}
+}
+
+} // namespace DecentWasmCounter
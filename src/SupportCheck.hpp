@@ -0,0 +1,437 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include <DecentWasmCounter/Config.hpp>
+#include <DecentWasmCounter/Result.hpp>
+
+#include "CallGraph.hpp"
+#include "Classification.hpp"
+#include "CodeInjector.hpp"
+#include "TrustedFuncs.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Whether the block-flow graph generation knows how to connect
+ *        blocks for the given control flow expr
+*/
+inline bool IsGraphSupportedCtrlFlowExpr(wabt::ExprType exprType) noexcept
+{
+	switch (exprType)
+	{
+	case wabt::ExprType::Block:
+	case wabt::ExprType::Loop:
+	case wabt::ExprType::Br:
+	case wabt::ExprType::BrIf:
+	case wabt::ExprType::Return:
+	case wabt::ExprType::ReturnCall:
+	case wabt::ExprType::ReturnCallIndirect:
+	case wabt::ExprType::Try:
+	case wabt::ExprType::Throw:
+	case wabt::ExprType::Rethrow:
+	case wabt::ExprType::Unreachable:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @param labels Labels of the enclosing blocks and loops, the innermost
+ *               one is the last
+*/
+inline bool IsBrTargetValid(
+	const std::vector<const std::string*>& labels,
+	const wabt::Var& var) noexcept
+{
+	if (var.is_index())
+	{
+		// the index equals to the number of labels, if it targets the
+		// function body
+		return var.index() <= labels.size();
+	}
+	else if (var.is_name())
+	{
+		for (auto it = labels.rbegin(); it != labels.rend(); ++it)
+		{
+			if (**it == var.name())
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Check if every expr in the given expr list can be instrumented,
+ *        without throwing
+ *
+ * @param offset Offset of the first expr in the list; it's advanced past
+ *               all exprs checked
+*/
+inline InstrumentResult CheckExprListSupport(
+	const wabt::ExprList& exprList,
+	std::vector<const std::string*>& labels,
+	uint32_t funcIdx,
+	uint64_t& offset)
+{
+	for (const wabt::Expr& expr : exprList)
+	{
+		uint64_t exprOffset = offset++;
+		wabt::ExprType exprType = expr.type();
+
+		ExprFlowKind kind = GetExprFlowKind(exprType);
+		if ((kind == ExprFlowKind::Unsupported) ||
+			((kind == ExprFlowKind::ControlFlow) &&
+				!IsGraphSupportedCtrlFlowExpr(exprType)))
+		{
+			return InstrumentResult(ErrorCode::UnsupportedExpr,
+				std::string("Unsupported expr ") +
+					wabt::GetExprTypeName(exprType),
+				funcIdx, exprOffset);
+		}
+
+		// (label, expr list) of each nested expr list
+		std::vector<std::pair<const std::string*, const wabt::ExprList*> >
+			nested;
+		const wabt::Var* brVar = nullptr;
+		switch (exprType)
+		{
+		case wabt::ExprType::Block:
+		{
+			const wabt::Block& blk =
+				wabt::cast<const wabt::BlockExpr>(&expr)->block;
+			nested.emplace_back(&(blk.label), &(blk.exprs));
+			break;
+		}
+		case wabt::ExprType::Loop:
+		{
+			const wabt::Block& blk =
+				wabt::cast<const wabt::LoopExpr>(&expr)->block;
+			nested.emplace_back(&(blk.label), &(blk.exprs));
+			break;
+		}
+		case wabt::ExprType::Try:
+		{
+			const wabt::TryExpr* tryExpr =
+				wabt::cast<const wabt::TryExpr>(&expr);
+			// the delegate target is one of the enclosing labels
+			if ((tryExpr->kind == wabt::TryKind::Delegate) &&
+				!IsBrTargetValid(labels, tryExpr->delegate_target))
+			{
+				return InstrumentResult(ErrorCode::InvalidBranch,
+					"Delegate target can't be resolved", funcIdx, exprOffset);
+			}
+			nested.emplace_back(&(tryExpr->block.label),
+				&(tryExpr->block.exprs));
+			for (const wabt::Catch& catchBlk : tryExpr->catches)
+			{
+				nested.emplace_back(&(tryExpr->block.label),
+					&(catchBlk.exprs));
+			}
+			break;
+		}
+		case wabt::ExprType::Br:
+			brVar = &(wabt::cast<const wabt::BrExpr>(&expr)->var);
+			break;
+		case wabt::ExprType::BrIf:
+			brVar = &(wabt::cast<const wabt::BrIfExpr>(&expr)->var);
+			break;
+		default:
+			break;
+		}
+
+		if ((brVar != nullptr) && !IsBrTargetValid(labels, *brVar))
+		{
+			return InstrumentResult(ErrorCode::InvalidBranch,
+				"Branch target can't be resolved", funcIdx, exprOffset);
+		}
+
+		for (const auto& nestedList : nested)
+		{
+			labels.push_back(nestedList.first);
+			InstrumentResult res = CheckExprListSupport(
+				*(nestedList.second), labels, funcIdx, offset);
+			labels.pop_back();
+			if (!res.IsSuccess())
+			{
+				return res;
+			}
+		}
+	}
+	return InstrumentResult();
+}
+
+inline InstrumentResult CheckFuncSupport(
+	const wabt::Func& func,
+	uint32_t funcIdx)
+{
+	std::vector<const std::string*> labels;
+	uint64_t offset = 0;
+	return CheckExprListSupport(func.exprs, labels, funcIdx, offset);
+}
+
+/**
+ * @brief Check the things that InjectCounterAndFunc,
+ *        ExportCounterAndThreshold, and InjectEntryWrapper would throw on
+*/
+inline InstrumentResult CheckInstrumentConfig(
+	const wabt::Module& mod,
+	const InstrumentConfig& config)
+{
+	if (config.m_costModels.empty())
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"At least one cost dimension is needed");
+	}
+#ifndef DECENT_WASM_COUNTER_TRUSTED
+	if (config.m_memoryLimit > 0)
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"The memory limit is only supported by the trusted library");
+	}
+#endif // !DECENT_WASM_COUNTER_TRUSTED
+	if (config.m_emitRepricingInfo && config.m_elideLeafFuncCounters)
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"Repricing info can't be emitted when leaf functions are "
+			"charged at their call sites");
+	}
+	if (config.m_emitRepricingInfo && (config.m_maxIncrThunks > 0))
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"Repricing info can't be emitted when counters are shared "
+			"through increment thunks");
+	}
+	if (config.m_emitRepricingInfo && config.m_mergeEquivalentBlocks)
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"Repricing info can't be emitted when blocks share counters");
+	}
+
+	if (config.m_emitBlockTableOnly &&
+		(config.m_pruneUnreachableCode ||
+		config.m_emitRepricingInfo ||
+		(config.m_unreachableFuncPolicy != UnreachableFuncPolicy::Instrument) ||
+		(config.m_maxIncrThunks > 0) ||
+		config.m_mergeEquivalentBlocks ||
+		config.m_aggregateBudget.IsEnabled() ||
+		!config.m_trustedFuncs.empty() ||
+		!config.m_counterExportName.empty() ||
+		!config.m_thresholdExportName.empty() ||
+		!config.m_entryFuncName.empty()))
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"Only leaf function summaries can be used when only the block "
+			"table is emitted");
+	}
+
+	const AggregateBudgetConfig& aggrBudget = config.m_aggregateBudget;
+	if (aggrBudget.IsEnabled())
+	{
+		if (aggrBudget.m_memoryIdx >= mod.memories.size())
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"The memory for the aggregate budget doesn't exist");
+		}
+		if ((aggrBudget.m_slotOffset % 8) != 0)
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"The aggregate budget slots must be 8-byte aligned");
+		}
+		uint64_t slotsSize = 16 * config.m_costModels.size();
+		if (!mod.memories[aggrBudget.m_memoryIdx]->page_limits.is_64 &&
+			(aggrBudget.m_slotOffset > (UINT64_C(0x100000000) - slotsSize)))
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"The aggregate budget slots are out of the 32-bit memory");
+		}
+	}
+
+	if (!config.m_trustedFuncs.empty() && config.m_emitRepricingInfo)
+	{
+		return InstrumentResult(ErrorCode::InvalidConfig,
+			"Repricing info can't be emitted when there are trusted "
+			"functions");
+	}
+	for (const auto& item : config.m_trustedFuncs)
+	{
+		wabt::Index funcIdx = FindFuncIndexByName(mod, item.first);
+		if ((funcIdx >= mod.funcs.size()) || (funcIdx < mod.num_func_imports))
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"Couldn't find the trusted function " + item.first +
+				" defined in the module");
+		}
+		if ((item.second.m_weights.size() > config.m_costModels.size()) ||
+			(item.second.m_sizeCosts.size() > config.m_costModels.size()))
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"The trusted function " + item.first +
+				" has more cost dimensions than the cost models");
+		}
+		if (HasSizeCost(item.second) &&
+			(GetSizeParamType(*(mod.funcs[funcIdx])) == wabt::Type::Void))
+		{
+			return InstrumentResult(ErrorCode::InvalidConfig,
+				"The last parameter of the trusted function " + item.first +
+				" must be an i32 or i64");
+		}
+	}
+
+	// nothing is injected for the block table, so the imports aren't needed
+	std::vector<std::string> exceedImports;
+	if ((config.m_exceedPolicy == ExceedPolicy::Notify) &&
+		!config.m_emitBlockTableOnly)
+	{
+		exceedImports.push_back("decent_wasm_counter_exceed");
+		if (config.m_aggregateBudget.IsEnabled())
+		{
+			exceedImports.push_back("decent_wasm_counter_aggregate_exceed");
+		}
+	}
+	for (const std::string& fieldName : exceedImports)
+	{
+		size_t numImports = 0;
+		for (const wabt::Import* im : mod.imports)
+		{
+			if (im->kind() == wabt::ExternalKind::Func &&
+				im->module_name == "env" &&
+				im->field_name == fieldName)
+			{
+				++numImports;
+			}
+		}
+		if (numImports == 0)
+		{
+			return InstrumentResult(ErrorCode::InvalidExceedImport,
+				"Couldn't find import to " + fieldName + " function");
+		}
+		else if (numImports > 1)
+		{
+			return InstrumentResult(ErrorCode::InvalidExceedImport,
+				"There are more than one import of " + fieldName +
+				" function");
+		}
+	}
+
+	std::unordered_set<std::string> newExports;
+	auto checkNewExport = [&](const std::string& name)
+	{
+		return !IsExportNameExist(mod, name) &&
+			newExports.insert(name).second;
+	};
+	for (size_t dim = 0; dim < config.m_costModels.size(); ++dim)
+	{
+		for (const std::string* name :
+			{ &config.m_counterExportName, &config.m_thresholdExportName })
+		{
+			if (!name->empty())
+			{
+				std::string expName = GetDimensionExportName(*name, dim);
+				if (!checkNewExport(expName))
+				{
+					return InstrumentResult(ErrorCode::ExportNameConflict,
+						"There is already an export named " + expName);
+				}
+			}
+		}
+	}
+
+	if (aggrBudget.IsEnabled() && !aggrBudget.m_flushExportName.empty() &&
+		!checkNewExport(aggrBudget.m_flushExportName))
+	{
+		return InstrumentResult(ErrorCode::ExportNameConflict,
+			"There is already an export named " +
+				aggrBudget.m_flushExportName);
+	}
+
+	if (!config.m_entryFuncName.empty())
+	{
+		bool isEntryFound = false;
+		for (const wabt::Export* exp : mod.exports)
+		{
+			isEntryFound = isEntryFound ||
+				((exp->name == config.m_entryFuncName) &&
+				(exp->kind == wabt::ExternalKind::Func));
+		}
+		if (!isEntryFound)
+		{
+			return InstrumentResult(ErrorCode::EntryFuncNotFound,
+				"Couldn't find the exported function " +
+					config.m_entryFuncName);
+		}
+		if (!checkNewExport(config.m_entryWrapperName))
+		{
+			return InstrumentResult(ErrorCode::ExportNameConflict,
+				"There is already an export named " +
+					config.m_entryWrapperName);
+		}
+	}
+
+	return InstrumentResult();
+}
+
+/**
+ * @brief Check if the module can be instrumented with the given config,
+ *        before anything is modified, so bad modules can be rejected
+ *        without throwing
+*/
+inline InstrumentResult CheckModuleSupport(
+	const wabt::Module& mod,
+	const InstrumentConfig& config)
+{
+	InstrumentResult res = CheckInstrumentConfig(mod, config);
+	if (!res.IsSuccess())
+	{
+		return res;
+	}
+
+	// the bodies of trusted functions are not instrumented
+	std::unordered_set<wabt::Index> trustedFuncIds;
+	for (const auto& item : config.m_trustedFuncs)
+	{
+		trustedFuncIds.insert(FindFuncIndexByName(mod, item.first));
+	}
+
+	// the functions that can never be executed are not instrumented either
+	std::vector<bool> isFuncReachable;
+	if (config.m_unreachableFuncPolicy != UnreachableFuncPolicy::Instrument)
+	{
+		isFuncReachable = GetReachableFuncs(BuildCallGraph(mod));
+	}
+
+	for (size_t i = mod.num_func_imports; i < mod.funcs.size(); ++i)
+	{
+		if ((trustedFuncIds.count(static_cast<wabt::Index>(i)) > 0) ||
+			((i < isFuncReachable.size()) && !isFuncReachable[i]))
+		{
+			continue;
+		}
+		res = CheckFuncSupport(*(mod.funcs[i]), static_cast<uint32_t>(i));
+		if (!res.IsSuccess())
+		{
+			return res;
+		}
+	}
+
+	return res;
+}
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,318 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Only built into the trusted library, which replaces the global allocation
+// functions, so every allocation (including the ones made by WABT) goes
+// through the allocator hooks, and is charged to the memory limit
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <atomic>
+#include <new>
+
+#include <DecentWasmCounter/Allocator.hpp>
+
+#include "MemoryLimit.hpp"
+
+namespace DecentWasmCounter
+{
+
+static void* DefaultAlloc(size_t size, void*)
+{
+	return std::malloc(size);
+}
+
+static void DefaultFree(void* ptr, void*)
+{
+	std::free(ptr);
+}
+
+static AllocatorHooks gs_hooks = { &DefaultAlloc, &DefaultFree, nullptr };
+
+static thread_local MemoryLimitScope* gs_curScope = nullptr;
+
+static std::atomic<uint64_t> gs_nextScopeId(1);
+
+/**
+ * @brief Kept right before each allocation, so it can be refunded to the
+ *        scope it's charged to, and freed from where the hook allocated it
+*/
+struct alignas(std::max_align_t) AllocHeader
+{
+	size_t m_size;
+	uint64_t m_scopeId;
+	// Returned by the hook; the header is right after it, unless the
+	// allocation is over-aligned
+	void* m_base;
+}; // struct AllocHeader
+
+static void* HookedAlloc(size_t size)
+{
+	uint64_t scopeId = MemoryLimitScope::Charge(size);
+
+	void* ptr = gs_hooks.m_alloc(
+		sizeof(AllocHeader) + size, gs_hooks.m_userData);
+	if (ptr == nullptr)
+	{
+		MemoryLimitScope::Refund(scopeId, size);
+		throw std::bad_alloc();
+	}
+
+	AllocHeader* header = static_cast<AllocHeader*>(ptr);
+	header->m_size = size;
+	header->m_scopeId = scopeId;
+	header->m_base = ptr;
+	return header + 1;
+}
+
+/**
+ * @brief The hooks only align for any scalar type, so an over-aligned
+ *        allocation is padded, and the header is put right before the
+ *        aligned address
+*/
+static void* HookedAlignedAlloc(size_t size, size_t align)
+{
+	if (align <= alignof(AllocHeader))
+	{
+		return HookedAlloc(size);
+	}
+
+	uint64_t scopeId = MemoryLimitScope::Charge(size);
+
+	void* ptr = gs_hooks.m_alloc(
+		sizeof(AllocHeader) + align + size, gs_hooks.m_userData);
+	if (ptr == nullptr)
+	{
+		MemoryLimitScope::Refund(scopeId, size);
+		throw std::bad_alloc();
+	}
+
+	// align is a power of 2, and a multiple of alignof(AllocHeader)
+	uintptr_t addr = reinterpret_cast<uintptr_t>(ptr) + sizeof(AllocHeader);
+	addr = (addr + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+
+	AllocHeader* header = reinterpret_cast<AllocHeader*>(addr) - 1;
+	header->m_size = size;
+	header->m_scopeId = scopeId;
+	header->m_base = ptr;
+	return header + 1;
+}
+
+static void HookedFree(void* ptr) noexcept
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+
+	AllocHeader* header = static_cast<AllocHeader*>(ptr) - 1;
+	MemoryLimitScope::Refund(header->m_scopeId, header->m_size);
+	gs_hooks.m_free(header->m_base, gs_hooks.m_userData);
+}
+
+} // namespace DecentWasmCounter
+
+void DecentWasmCounter::SetAllocatorHooks(const AllocatorHooks& hooks) noexcept
+{
+	if ((hooks.m_alloc != nullptr) && (hooks.m_free != nullptr))
+	{
+		gs_hooks = hooks;
+	}
+	else
+	{
+		gs_hooks = AllocatorHooks{ &DefaultAlloc, &DefaultFree, nullptr };
+	}
+}
+
+DecentWasmCounter::MemoryLimitScope::MemoryLimitScope(uint64_t limit) :
+	m_id(gs_nextScopeId.fetch_add(1)),
+	m_limit(limit),
+	m_used(0),
+	m_prev(gs_curScope)
+{
+	gs_curScope = this;
+}
+
+DecentWasmCounter::MemoryLimitScope::~MemoryLimitScope()
+{
+	gs_curScope = m_prev;
+}
+
+uint64_t DecentWasmCounter::MemoryLimitScope::Charge(size_t size)
+{
+	MemoryLimitScope* scope = gs_curScope;
+	if (scope == nullptr)
+	{
+		return 0;
+	}
+
+	if ((scope->m_limit > 0) && (size > (scope->m_limit - scope->m_used)))
+	{
+		throw MemoryLimitExceeded();
+	}
+	scope->m_used += size;
+	return scope->m_id;
+}
+
+void DecentWasmCounter::MemoryLimitScope::Refund(
+	uint64_t scopeId,
+	size_t size) noexcept
+{
+	MemoryLimitScope* scope = gs_curScope;
+	if ((scopeId != 0) && (scope != nullptr) && (scope->m_id == scopeId))
+	{
+		scope->m_used -= size;
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	return DecentWasmCounter::HookedAlloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return DecentWasmCounter::HookedAlloc(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return DecentWasmCounter::HookedAlloc(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return DecentWasmCounter::HookedAlloc(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void* ptr) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+#ifdef __cpp_aligned_new
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+	return DecentWasmCounter::HookedAlignedAlloc(
+		size, static_cast<std::size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+	return DecentWasmCounter::HookedAlignedAlloc(
+		size, static_cast<std::size_t>(align));
+}
+
+void* operator new(
+	std::size_t size,
+	std::align_val_t align,
+	const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return DecentWasmCounter::HookedAlignedAlloc(
+			size, static_cast<std::size_t>(align));
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](
+	std::size_t size,
+	std::align_val_t align,
+	const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return DecentWasmCounter::HookedAlignedAlloc(
+			size, static_cast<std::size_t>(align));
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete(
+	void* ptr,
+	std::align_val_t,
+	const std::nothrow_t&) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+void operator delete[](
+	void* ptr,
+	std::align_val_t,
+	const std::nothrow_t&) noexcept
+{
+	DecentWasmCounter::HookedFree(ptr);
+}
+
+#endif // __cpp_aligned_new
@@ -0,0 +1,262 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <src/cast.h>
+#include <src/ir.h>
+
+#include <DecentWasmCounter/Config.hpp>
+#include <DecentWasmCounter/Exceptions.hpp>
+
+#include "CallGraph.hpp"
+#include "CodeInjector.hpp"
+#include "ExprWalker.hpp"
+#include "WeightCalculator.hpp"
+#include "make_unique.hpp"
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Look for the function by its export name first, and then by its
+ *        name (e.g., `$sha256`)
+ *
+ * @return wabt::kInvalidIndex if it's not found
+*/
+inline wabt::Index FindFuncIndexByName(
+	const wabt::Module& mod,
+	const std::string& name)
+{
+	for (const wabt::Export* exp : mod.exports)
+	{
+		if ((exp->kind == wabt::ExternalKind::Func) && (exp->name == name))
+		{
+			return mod.GetFuncIndex(exp->var);
+		}
+	}
+	return mod.func_bindings.FindIndex(name);
+}
+
+inline bool HasSizeCost(const TrustedFuncCost& cost)
+{
+	for (const DynamicCost& sizeCost : cost.m_sizeCosts)
+	{
+		if (sizeCost.m_perUnit > 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Get the type of the parameter that the size cost is charged by,
+ *        i.e., the last one
+ *
+ * @return wabt::Type::Void if it's not an i32 or i64
+*/
+inline wabt::Type GetSizeParamType(const wabt::Func& func)
+{
+	wabt::Index numParams = func.GetNumParams();
+	if (numParams == 0)
+	{
+		return wabt::Type::Void;
+	}
+	wabt::Type type = func.GetParamType(numParams - 1);
+	return ((type == wabt::Type::I32) || (type == wabt::Type::I64)) ?
+		type : wabt::Type(wabt::Type::Void);
+}
+
+struct TrustedFuncInfo
+{
+	// Whether the cost is charged at the entry of the function, since it can
+	// be entered without a direct `call`; otherwise, it's charged at each
+	// call site
+	bool m_isChargedAtEntry;
+
+	// Flat weights of all cost dimensions
+	std::vector<size_t> m_weights;
+
+	// Size costs of all cost dimensions; empty if there is none
+	std::vector<DynamicCost> m_sizeCosts;
+	wabt::Type m_sizeType;
+}; // struct TrustedFuncInfo
+
+using TrustedFuncMap = std::unordered_map<wabt::Index, TrustedFuncInfo>;
+
+/**
+ * @brief Find the trusted functions in the module, and decide where their
+ *        costs are charged
+*/
+inline TrustedFuncMap ResolveTrustedFuncs(
+	const wabt::Module& mod,
+	const std::unordered_map<std::string, TrustedFuncCost>& trustedFuncs,
+	const CallGraph& cg,
+	size_t numDims)
+{
+	TrustedFuncMap res;
+	for (const auto& item : trustedFuncs)
+	{
+		wabt::Index funcIdx = FindFuncIndexByName(mod, item.first);
+		if ((funcIdx >= mod.funcs.size()) || cg.IsImport(funcIdx))
+		{
+			throw Exception(
+				"Couldn't find the trusted function " + item.first);
+		}
+
+		const TrustedFuncCost& cost = item.second;
+		if ((cost.m_weights.size() > numDims) ||
+			(cost.m_sizeCosts.size() > numDims))
+		{
+			throw Exception("The trusted function " + item.first +
+				" has more cost dimensions than the cost models");
+		}
+
+		TrustedFuncInfo info;
+		info.m_isChargedAtEntry = cg.m_isEntry[funcIdx];
+		info.m_weights.assign(numDims, 0);
+		for (size_t dim = 0; dim < cost.m_weights.size(); ++dim)
+		{
+			info.m_weights[dim] = static_cast<size_t>(cost.m_weights[dim]);
+		}
+		info.m_sizeType = wabt::Type::Void;
+		if (HasSizeCost(cost))
+		{
+			info.m_sizeType = GetSizeParamType(*(mod.funcs[funcIdx]));
+			if (info.m_sizeType == wabt::Type::Void)
+			{
+				throw Exception("The last parameter of the trusted function " +
+					item.first + " must be an i32 or i64");
+			}
+			info.m_sizeCosts = cost.m_sizeCosts;
+			info.m_sizeCosts.resize(numDims);
+		}
+
+		res[funcIdx] = std::move(info);
+	}
+
+	// the bodies of trusted functions are not instrumented, so a trusted
+	// function called by another one must be charged at its entry, too
+	for (const auto& item : res)
+	{
+		for (wabt::Index callee : cg.m_callees[item.first])
+		{
+			auto it = res.find(callee);
+			if (it != res.end())
+			{
+				it->second.m_isChargedAtEntry = true;
+			}
+		}
+	}
+	return res;
+}
+
+/**
+ * @brief The bodies of trusted functions are not instrumented, so the
+ *        functions called by them must count their own cost
+*/
+inline void MarkTrustedFuncCallees(
+	CallGraph& cg,
+	const TrustedFuncMap& trustedFuncs)
+{
+	for (const auto& item : trustedFuncs)
+	{
+		for (wabt::Index callee : cg.m_callees[item.first])
+		{
+			if (callee < cg.m_isEntry.size())
+			{
+				cg.m_isEntry[callee] = true;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Charge the whole cost of a trusted function at its entry
+*/
+inline void InjectTrustedFuncEntryCharge(
+	wabt::Func& func,
+	const TrustedFuncInfo& info,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
+{
+	auto beginIt = func.exprs.begin();
+
+	// i64.const weight_0
+	// ...
+	// i64.const weight_(K-1)
+	// call $incr
+	InjectBlockCounterExpr(func.exprs, beginIt, info.m_weights,
+		ctrFuncIdx, stats);
+
+	if (!info.m_sizeCosts.empty())
+	{
+		// local.get <last param>
+		// <size charge>
+		// drop
+		wabt::Index sizeIdx = func.GetNumParams() - 1;
+		ScratchLocals scratch(func);
+
+		stats.AddExpr(*func.exprs.insert(beginIt,
+			Internal::make_unique<wabt::LocalGetExpr>(wabt::Var(sizeIdx))));
+		InjectDynamicCounterExpr(func.exprs, beginIt, info.m_sizeCosts,
+			info.m_sizeType, scratch.Get(info.m_sizeType), ctrFuncIdx, stats);
+		stats.AddExpr(*func.exprs.insert(beginIt,
+			Internal::make_unique<wabt::DropExpr>()));
+	}
+}
+
+/**
+ * @brief Inject the size charge before each call to a trusted function that
+ *        is charged at its call sites; the flat weights are charged as part
+ *        of the caller's block weight
+*/
+inline void InjectTrustedCallCounter(
+	wabt::Func& func,
+	const wabt::Module& mod,
+	const TrustedFuncMap& trustedFuncs,
+	wabt::Index ctrFuncIdx,
+	InjectionStats& stats)
+{
+	ScratchLocals scratch(func);
+
+	WalkExprListIterator(func.exprs,
+		[&](wabt::ExprList& exprList, wabt::ExprList::iterator exprIt)
+		{
+			const wabt::Var* calleeVar = nullptr;
+			if (exprIt->type() == wabt::ExprType::Call)
+			{
+				calleeVar = &(wabt::cast<wabt::CallExpr>(&(*exprIt))->var);
+			}
+			else if (exprIt->type() == wabt::ExprType::ReturnCall)
+			{
+				calleeVar =
+					&(wabt::cast<wabt::ReturnCallExpr>(&(*exprIt))->var);
+			}
+			if (calleeVar == nullptr)
+			{
+				return;
+			}
+
+			auto it = trustedFuncs.find(mod.GetFuncIndex(*calleeVar));
+			if ((it != trustedFuncs.cend()) &&
+				!it->second.m_isChargedAtEntry &&
+				!it->second.m_sizeCosts.empty())
+			{
+				// the size is the last argument, on the top of the stack
+				InjectDynamicCounterExpr(exprList, exprIt,
+					it->second.m_sizeCosts, it->second.m_sizeType,
+					scratch.Get(it->second.m_sizeType), ctrFuncIdx, stats);
+			}
+		}
+	);
+}
+
+} // namespace DecentWasmCounter
@@ -3,11 +3,19 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#pragma once
+
 #include <functional>
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <DecentWasmCounter/CostModel.hpp>
+
 #include "Block.hpp"
+#include "Classification.hpp"
 
 namespace DecentWasmCounter
 {
@@ -17,6 +25,10 @@ struct ImportFuncInfo
 {
 	wabt::BindingHash m_nameBinding;
 	ImportFuncListType m_funcList;
+	// Weights (one per cost dimension) to be charged at call sites of
+	// in-module functions
+	// (e.g., worst-case cost of leaf functions whose counters are elided)
+	std::unordered_map<wabt::Index, std::vector<size_t> > m_inModFuncWeights;
 }; // struct ImportFuncInfo
 
 using ExprWeightCalcFunc = std::function<size_t(
@@ -51,33 +63,30 @@ inline constexpr size_t RetConstCallWeight(
 	return _weight;
 }
 
-inline const ImportFuncWeightMap& GetDefaultFuncWeightCalcMap()
-{
-	static const ImportFuncWeightMap m =
-	{
-		{ "env",
-			{
-				{ "decent_wasm_test_log", RetConstCallWeight<10> },
-			}
-		},
-	};
-	return m;
-}
-
-template<size_t _defaultWeight>
-inline size_t RetDefaultCallWeight(
+inline size_t RetCallWeight(
 	wabt::ExprList::iterator exprIt,
 	const Block* blk,
-	const ImportFuncInfo& funcInfo)
+	const ImportFuncInfo& funcInfo,
+	const ImportFuncWeightMap& impFuncWgtMap,
+	size_t defaultWeight,
+	size_t dim)
 {
 	const wabt::Expr& expr = *exprIt;
-	const auto& impFuncWgtMap = GetDefaultFuncWeightCalcMap();
 
+	const wabt::Var* calleeVar = nullptr;
 	if (expr.type() == wabt::ExprType::Call)
 	{
-		const wabt::CallExpr* callExpr =
-			wabt::cast<const wabt::CallExpr>(&expr);
-		wabt::Index funcIdx = funcInfo.m_nameBinding.FindIndex(callExpr->var);
+		calleeVar = &(wabt::cast<const wabt::CallExpr>(&expr)->var);
+	}
+	else if (expr.type() == wabt::ExprType::ReturnCall)
+	{
+		// a tail call is charged the same as a call
+		calleeVar = &(wabt::cast<const wabt::ReturnCallExpr>(&expr)->var);
+	}
+
+	if (calleeVar != nullptr)
+	{
+		wabt::Index funcIdx = funcInfo.m_nameBinding.FindIndex(*calleeVar);
 		if (funcIdx < funcInfo.m_funcList.size())
 		{
 			const auto& impFuncName = funcInfo.m_funcList[funcIdx];
@@ -93,12 +102,15 @@ inline size_t RetDefaultCallWeight(
 			}
 
 			// weight is not found in the map
-			return _defaultWeight;
+			return defaultWeight;
 		}
 		else
 		{
 			// It's calling in-module func
-			return 0;
+			// by default, the callee is counting its own cost
+			auto itInMod = funcInfo.m_inModFuncWeights.find(funcIdx);
+			return itInMod != funcInfo.m_inModFuncWeights.cend() ?
+				itInMod->second[dim] : 0;
 		}
 	}
 	else
@@ -107,14 +119,267 @@ inline size_t RetDefaultCallWeight(
 	}
 }
 
-inline const WeightMapType& GetDefaultExprWeightCalcMap()
+inline ImportFuncWeightMap BuildImportFuncWeightMap(const CostModel& model)
+{
+	ImportFuncWeightMap m;
+	for (const auto& modItem : model.m_importFuncWeights)
+	{
+		for (const auto& fieldItem : modItem.second)
+		{
+			size_t weight = static_cast<size_t>(fieldItem.second);
+			m[modItem.first][fieldItem.first] =
+				[weight](wabt::ExprList::iterator, const Block*)
+				{
+					return weight;
+				};
+		}
+	}
+	return m;
+}
+
+/**
+ * @brief Get the number of lanes a SIMD instruction works on, by the shape
+ *        prefix of its mnemonic (e.g., 4 for `i32x4.add`);
+ *        `v128.*` instructions count as one lane
+ *
+ * @return 0 if the instruction is not a SIMD instruction
+*/
+inline size_t GetSimdLaneCount(const std::string& mnemonic)
 {
-	static const WeightMapType m =
+	static const std::pair<const char*, size_t> sk_shapes[] =
 	{
-		{ wabt::ExprType::Binary,  RetConstExprWeight<1> },
-		{ wabt::ExprType::Compare, RetConstExprWeight<1> },
-		{ wabt::ExprType::Call,    RetDefaultCallWeight<2> },
+		{ "i8x16.", 16 },
+		{ "i16x8.", 8 },
+		{ "i32x4.", 4 },
+		{ "f32x4.", 4 },
+		{ "i64x2.", 2 },
+		{ "f64x2.", 2 },
+		{ "v128.",  1 },
 	};
+	for (const auto& shape : sk_shapes)
+	{
+		if (mnemonic.rfind(shape.first, 0) == 0)
+		{
+			return shape.second;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Get the weight of an instruction that carries an opcode
+ *
+ * @param typeWeight Weight of its expression type
+*/
+inline uint64_t GetOpcodeExprWeight(
+	const CostModel& model,
+	const std::string& exprTypeName,
+	const std::string& mnemonic,
+	uint64_t typeWeight)
+{
+	auto itOpWeight = model.m_opcodeWeights.find(mnemonic);
+	if (itOpWeight != model.m_opcodeWeights.cend())
+	{
+		return itOpWeight->second;
+	}
+
+	size_t numLanes = GetSimdLaneCount(mnemonic);
+	if (numLanes > 0)
+	{
+		auto itLaneWeight = model.m_simdLaneWeights.find(exprTypeName);
+		if (itLaneWeight != model.m_simdLaneWeights.cend())
+		{
+			return itLaneWeight->second * numLanes;
+		}
+	}
+
+	return typeWeight;
+}
+
+/**
+ * @brief The parts of a cost model that price instructions by their opcode,
+ *        keyed by opcode, so instructions can be priced without looking up
+ *        their mnemonics
+*/
+struct OpcodeWeightTable
+{
+	// Weights given in CostModel::m_opcodeWeights
+	std::unordered_map<wabt::Opcode::Enum, uint64_t> m_opcodeWeights;
+	// Number of lanes of SIMD instructions (see GetSimdLaneCount);
+	// only filled if the model has SIMD lane weights
+	std::unordered_map<wabt::Opcode::Enum, size_t> m_simdLaneCounts;
+}; // struct OpcodeWeightTable
+
+inline OpcodeWeightTable BuildOpcodeWeightTable(const CostModel& model)
+{
+	OpcodeWeightTable table;
+	if (model.m_opcodeWeights.empty() && model.m_simdLaneWeights.empty())
+	{
+		return table;
+	}
+
+	// mnemonics are only looked up once per opcode here
+	for (uint32_t i = 0; i < static_cast<uint32_t>(wabt::Opcode::Invalid); ++i)
+	{
+		wabt::Opcode::Enum opcode = static_cast<wabt::Opcode::Enum>(i);
+		std::string mnemonic = wabt::Opcode(opcode).GetName();
+
+		auto itOpWeight = model.m_opcodeWeights.find(mnemonic);
+		if (itOpWeight != model.m_opcodeWeights.cend())
+		{
+			table.m_opcodeWeights[opcode] = itOpWeight->second;
+		}
+
+		size_t numLanes = GetSimdLaneCount(mnemonic);
+		if ((numLanes > 0) && !model.m_simdLaneWeights.empty())
+		{
+			table.m_simdLaneCounts[opcode] = numLanes;
+		}
+	}
+	return table;
+}
+
+/**
+ * @param dim The index of the cost dimension that the model is for
+*/
+inline WeightMapType BuildExprWeightCalcMap(
+	const CostModel& model,
+	size_t dim)
+{
+	WeightMapType m;
+
+	auto impFuncWgtMap = std::make_shared<const ImportFuncWeightMap>(
+		BuildImportFuncWeightMap(model));
+	size_t defImpFuncWeight =
+		static_cast<size_t>(model.m_defaultImportFuncWeight);
+	auto opcodeTable = std::make_shared<const OpcodeWeightTable>(
+		BuildOpcodeWeightTable(model));
+
+	for (int i = static_cast<int>(wabt::ExprType::First);
+		i <= static_cast<int>(wabt::ExprType::Last); ++i)
+	{
+		wabt::ExprType exprType = static_cast<wabt::ExprType>(i);
+
+		auto itTypeWeight =
+			model.m_exprTypeWeights.find(wabt::GetExprTypeName(exprType));
+		size_t typeWeight = static_cast<size_t>(
+			itTypeWeight != model.m_exprTypeWeights.cend() ?
+				itTypeWeight->second :
+				model.m_defaultExprWeight);
+
+		if ((exprType == wabt::ExprType::Call) ||
+			(exprType == wabt::ExprType::ReturnCall))
+		{
+			m[exprType] =
+				[typeWeight, impFuncWgtMap, defImpFuncWeight, dim](
+					wabt::ExprList::iterator exprIt,
+					const Block* blk,
+					const ImportFuncInfo& funcInfo)
+				{
+					return typeWeight + RetCallWeight(exprIt, blk, funcInfo,
+						*impFuncWgtMap, defImpFuncWeight, dim);
+				};
+		}
+		else if (HasExprOpcode(exprType) &&
+			(!opcodeTable->m_opcodeWeights.empty() ||
+				(model.m_simdLaneWeights.count(wabt::GetExprTypeName(exprType)) > 0)))
+		{
+			// same as GetOpcodeExprWeight, but keyed by opcode
+			auto itLaneWeight =
+				model.m_simdLaneWeights.find(wabt::GetExprTypeName(exprType));
+			bool hasLaneWeight =
+				(itLaneWeight != model.m_simdLaneWeights.cend());
+			size_t laneWeight = hasLaneWeight ?
+				static_cast<size_t>(itLaneWeight->second) : 0;
+			m[exprType] =
+				[typeWeight, hasLaneWeight, laneWeight, opcodeTable](
+					wabt::ExprList::iterator exprIt,
+					const Block*,
+					const ImportFuncInfo&)
+				{
+					wabt::Opcode::Enum opcode = GetExprOpcode(*exprIt);
+
+					auto itOpWeight =
+						opcodeTable->m_opcodeWeights.find(opcode);
+					if (itOpWeight != opcodeTable->m_opcodeWeights.cend())
+					{
+						return static_cast<size_t>(itOpWeight->second);
+					}
+
+					if (hasLaneWeight)
+					{
+						auto itLanes =
+							opcodeTable->m_simdLaneCounts.find(opcode);
+						if (itLanes != opcodeTable->m_simdLaneCounts.cend())
+						{
+							return laneWeight * itLanes->second;
+						}
+					}
+
+					return typeWeight;
+				};
+		}
+		else if (typeWeight != model.m_defaultExprWeight)
+		{
+			m[exprType] =
+				[typeWeight](
+					wabt::ExprList::iterator,
+					const Block*,
+					const ImportFuncInfo&)
+				{
+					return typeWeight;
+				};
+		}
+	}
+
+	return m;
+}
+
+// Runtime-proportional cost of an instruction, one per cost dimension
+// (m_perUnit is 0 for dimensions that don't charge it)
+using DynamicWeightMapType =
+	std::unordered_map<wabt::ExprType, std::vector<DynamicCost> >;
+
+/**
+ * @brief Instructions that can have runtime-proportional cost, and their
+ *        mnemonics used as the key in CostModel::m_dynamicCosts
+*/
+inline const std::vector<std::pair<wabt::ExprType, std::string> >&
+GetDynamicCostExprTypes()
+{
+	static const std::vector<std::pair<wabt::ExprType, std::string> > l =
+	{
+		{ wabt::ExprType::MemoryCopy, "memory.copy" },
+		{ wabt::ExprType::MemoryFill, "memory.fill" },
+		{ wabt::ExprType::MemoryInit, "memory.init" },
+		{ wabt::ExprType::MemoryGrow, "memory.grow" },
+		{ wabt::ExprType::TableCopy,  "table.copy" },
+		{ wabt::ExprType::TableInit,  "table.init" },
+		{ wabt::ExprType::TableFill,  "table.fill" },
+		{ wabt::ExprType::TableGrow,  "table.grow" },
+	};
+	return l;
+}
+
+inline DynamicWeightMapType BuildDynamicWeightMap(
+	const std::vector<CostModel>& models)
+{
+	DynamicWeightMapType m;
+	for (size_t dim = 0; dim < models.size(); ++dim)
+	{
+		const CostModel& model = models[dim];
+		for (const auto& item : GetDynamicCostExprTypes())
+		{
+			auto it = model.m_dynamicCosts.find(item.second);
+			if ((it != model.m_dynamicCosts.cend()) &&
+				(it->second.m_perUnit > 0))
+			{
+				auto& costs = m[item.first];
+				costs.resize(models.size());
+				costs[dim] = it->second;
+			}
+		}
+	}
 	return m;
 }
 
@@ -123,32 +388,63 @@ class WeightCalculator
 public:
 
 	WeightCalculator(const WeightMapType& m, size_t defWeight):
-		m_weightMap(m),
-		m_defaultWeight(defWeight)
-	{}
+		m_dims()
+	{
+		m_dims.push_back({ m, defWeight });
+	}
+
+	/**
+	 * @brief Construct a calculator with one cost dimension per cost model
+	*/
+	explicit WeightCalculator(const std::vector<CostModel>& models) :
+		m_dims()
+	{
+		for (size_t dim = 0; dim < models.size(); ++dim)
+		{
+			m_dims.push_back({
+				BuildExprWeightCalcMap(models[dim], dim),
+				static_cast<size_t>(models[dim].m_defaultExprWeight)
+			});
+		}
+	}
 
 	virtual ~WeightCalculator() = default;
 
+	size_t GetNumOfDimensions() const
+	{
+		return m_dims.size();
+	}
+
+	/**
+	 * @brief Calculate weights of all cost dimensions for every block,
+	 *        in a single sweep over the block-flow graph
+	*/
 	void CalcWeight(Block* head, const ImportFuncInfo& funcInfo) const
 	{
 		if ((head != nullptr) && !head->m_isWeightCalc)
 		{
 			// Calculate weight for this block
 			head->m_isWeightCalc = true;
-			head->m_weight = 0;
+			head->m_weights.assign(m_dims.size(), 0);
 			for (auto it = head->m_blkBegin; it != head->m_blkEnd; ++it)
 			{
 				const auto& expr = *it;
 				auto exprType = expr.type();
 
-				auto itWeight = m_weightMap.find(exprType);
-				if (itWeight != m_weightMap.cend())
+				for (size_t dim = 0; dim < m_dims.size(); ++dim)
 				{
-					head->m_weight += itWeight->second(it, head, funcInfo);
-				}
-				else
-				{
-					head->m_weight += m_defaultWeight;
+					const Dimension& dimCalc = m_dims[dim];
+
+					auto itWeight = dimCalc.m_weightMap.find(exprType);
+					if (itWeight != dimCalc.m_weightMap.cend())
+					{
+						head->m_weights[dim] +=
+							itWeight->second(it, head, funcInfo);
+					}
+					else
+					{
+						head->m_weights[dim] += dimCalc.m_defaultWeight;
+					}
 				}
 			}
 
@@ -161,8 +457,14 @@ public:
 	}
 
 private:
-	WeightMapType m_weightMap;
-	size_t m_defaultWeight;
+
+	struct Dimension
+	{
+		WeightMapType m_weightMap;
+		size_t m_defaultWeight;
+	}; // struct Dimension
+
+	std::vector<Dimension> m_dims;
 
 }; // class WeightCalculator
 
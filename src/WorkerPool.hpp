@@ -0,0 +1,80 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#ifndef DECENT_WASM_COUNTER_TRUSTED
+#include <thread>
+#endif // !DECENT_WASM_COUNTER_TRUSTED
+
+namespace DecentWasmCounter
+{
+
+/**
+ * @brief Run the given task for each index in [0, numTasks) on a fixed
+ *        number of worker threads; the tasks are picked up in order
+ *
+ * @param numWorkers Number of worker threads; the number of hardware threads
+ *                   if it's 0.
+ *                   The trusted library can't create threads, so the tasks
+ *                   always run on the calling thread.
+ * @param task       callable as `void(size_t)`; it must not throw
+*/
+inline void RunOnWorkerPool(
+	size_t numWorkers,
+	size_t numTasks,
+	const std::function<void(size_t)>& task)
+{
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+	(void)numWorkers;
+	for (size_t i = 0; i < numTasks; ++i)
+	{
+		task(i);
+	}
+#else
+	if (numWorkers == 0)
+	{
+		numWorkers = std::thread::hardware_concurrency();
+	}
+	if (numWorkers > numTasks)
+	{
+		numWorkers = numTasks;
+	}
+
+	std::atomic<size_t> nextTask(0);
+	auto worker = [&nextTask, numTasks, &task]()
+	{
+		for (size_t i = nextTask.fetch_add(1);
+			i < numTasks;
+			i = nextTask.fetch_add(1))
+		{
+			task(i);
+		}
+	};
+
+	if (numWorkers <= 1)
+	{
+		worker();
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(numWorkers);
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+#endif // DECENT_WASM_COUNTER_TRUSTED
+}
+
+} // namespace DecentWasmCounter
@@ -0,0 +1,102 @@
+// Copyright 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <gtest/gtest.h>
+
+#include <DecentWasmCounter/CostTable.hpp>
+
+using namespace DecentWasmCounter;
+
+namespace DecentWasmCounter_Test
+{
+	extern size_t g_numOfTestFile;
+}
+
+GTEST_TEST(TestCostTable, CountTestFile)
+{
+	static auto tmp = ++DecentWasmCounter_Test::g_numOfTestFile;
+}
+
+GTEST_TEST(TestCostTable, ParseCostTable)
+{
+	CostModel model = ParseCostTable(
+		"# calibrated\n"
+		"type Binary 3\n"
+		"opcode i64.div_u 40  # slow\n"
+		"\n"
+		"default 1\n"
+		"import env decent_wasm_test_log 10\n"
+		"default_import 2\n"
+		"dynamic memory.copy 1 3\n");
+
+	EXPECT_EQ(model.m_exprTypeWeights.at("Binary"), 3);
+	EXPECT_EQ(model.m_opcodeWeights.at("i64.div_u"), 40);
+	EXPECT_EQ(model.m_defaultExprWeight, 1);
+	EXPECT_EQ(model.m_importFuncWeights.at("env").at("decent_wasm_test_log"),
+		10);
+	EXPECT_EQ(model.m_defaultImportFuncWeight, 2);
+	EXPECT_EQ(model.m_dynamicCosts.at("memory.copy").m_perUnit, 1);
+	EXPECT_EQ(model.m_dynamicCosts.at("memory.copy").m_unitShift, 3);
+
+	EXPECT_THROW(ParseCostTable("type Binary\n"), Exception);
+	EXPECT_THROW(ParseCostTable("type Binary -1\n"), Exception);
+	EXPECT_THROW(ParseCostTable("weight Binary 1\n"), Exception);
+}
+
+GTEST_TEST(TestCostTable, WriteCostTable)
+{
+	const CostModel& model = GetDefaultCostModel();
+
+	std::string table = WriteCostTable(model);
+	EXPECT_EQ(WriteCostTable(ParseCostTable(table)), table);
+
+	CostModel parsed = ParseCostTable(table);
+	EXPECT_EQ(parsed.m_exprTypeWeights, model.m_exprTypeWeights);
+	EXPECT_EQ(parsed.m_importFuncWeights, model.m_importFuncWeights);
+	EXPECT_EQ(parsed.m_defaultImportFuncWeight,
+		model.m_defaultImportFuncWeight);
+	EXPECT_EQ(parsed.m_dynamicCosts.size(), model.m_dynamicCosts.size());
+}
+
+GTEST_TEST(TestCostTable, FitCostModel)
+{
+	const CostModel& defModel = GetDefaultCostModel();
+
+	CostModel model = FitCostModel(
+		{
+			{ "i32.add",   "Binary",  true,  4.0 },
+			{ "i64.div_u", "Binary",  true,  40.4 },
+			{ "i32.eq",    "Compare", true,  0.2 },
+			{ "call $nop", "Call",    false, 20.0 },
+		},
+		defModel);
+
+	// measured entries are overwritten
+	EXPECT_EQ(model.m_opcodeWeights.at("i32.add"), 4);
+	EXPECT_EQ(model.m_opcodeWeights.at("i64.div_u"), 40);
+	EXPECT_EQ(model.m_opcodeWeights.at("i32.eq"), 1);
+	EXPECT_EQ(model.m_opcodeWeights.count("call $nop"), 0);
+	EXPECT_EQ(model.m_exprTypeWeights.at("Binary"), 22);
+	EXPECT_EQ(model.m_exprTypeWeights.at("Compare"), 1);
+	EXPECT_EQ(model.m_exprTypeWeights.at("Call"), 20);
+
+	// the rest is kept from the default cost model
+	EXPECT_EQ(model.m_exprTypeWeights.at("AtomicRmw"), 1);
+	EXPECT_EQ(model.m_exprTypeWeights.at("AtomicRmwCmpxchg"), 1);
+	EXPECT_EQ(model.m_exprTypeWeights.at("AtomicNotify"), 10);
+	EXPECT_EQ(model.m_exprTypeWeights.at("AtomicWait"), 50);
+	EXPECT_EQ(model.m_simdLaneWeights, defModel.m_simdLaneWeights);
+	EXPECT_EQ(model.m_importFuncWeights, defModel.m_importFuncWeights);
+	EXPECT_EQ(model.m_dynamicCosts.size(), defModel.m_dynamicCosts.size());
+
+	// and the calibrated table is loaded back as it is
+	std::string table = WriteCostTable(model);
+	CostModel parsed = ParseCostTable(table);
+	EXPECT_EQ(parsed.m_exprTypeWeights, model.m_exprTypeWeights);
+	EXPECT_EQ(parsed.m_opcodeWeights, model.m_opcodeWeights);
+	EXPECT_EQ(parsed.m_simdLaneWeights, model.m_simdLaneWeights);
+	EXPECT_EQ(parsed.m_importFuncWeights, model.m_importFuncWeights);
+	EXPECT_EQ(WriteCostTable(parsed), table);
+}
@@ -3,10 +3,24 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <cstdint>
+#include <cstdlib>
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+
 #include <gtest/gtest.h>
 
 #include <DecentWasmWat/WasmWat.h>
 
+#include <src/error.h>
+#include <src/feature.h>
+#include <src/result.h>
+#include <src/wast-lexer.h>
+#include <src/wast-parser.h>
+
+#include <DecentWasmCounter/Allocator.hpp>
 #include <DecentWasmCounter/DecentWasmCounter.hpp>
 
 #include "Common.hpp"
@@ -18,6 +32,30 @@ namespace DecentWasmCounter_Test
 	extern size_t g_numOfTestFile;
 }
 
+/**
+ * @brief Parse a test input that needs features not enabled by
+ *        DecentWasmWat::Wat2Mod (e.g., memory64, exceptions, tail calls)
+*/
+static std::unique_ptr<wabt::Module> Wat2ModWithFeatures(
+	const std::string& wat,
+	const wabt::Features& features)
+{
+	auto lexer = wabt::WastLexer::CreateBufferLexer(
+		"filename.wat", wat.data(), wat.size());
+
+	wabt::WastParseOptions options(features);
+	wabt::Errors errors;
+	std::unique_ptr<wabt::Module> mod;
+	wabt::Result result =
+		wabt::ParseWatModule(lexer.get(), &mod, &errors, &options);
+	if (!wabt::Succeeded(result))
+	{
+		throw std::runtime_error("Failed to parse the test WAT");
+	}
+
+	return mod;
+}
+
 GTEST_TEST(TestInstrumentation, CountTestFile)
 {
 	static auto tmp = ++DecentWasmCounter_Test::g_numOfTestFile;
@@ -76,3 +114,993 @@ GTEST_TEST(TestInstrumentation, TestInput_03)
 
 	EXPECT_EQ(testOutWatStr_03, testInWatStr_03_nopt);
 }
+
+GTEST_TEST(TestInstrumentation, TestInput_04_LeafFunc)
+{
+	auto testInWatStr_04 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-04.in.wat");
+	auto testInWatStr_04_leaf =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-04.out.leaf.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_04, DecentWasmWat::Wat2WasmConfig());
+
+	InstrumentConfig config;
+	config.m_elideLeafFuncCounters = true;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_04 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	EXPECT_EQ(testOutWatStr_04, testInWatStr_04_leaf);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_05_DynamicCost)
+{
+	auto testInWatStr_05 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-05.in.wat");
+	auto testInWatStr_05_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-05.out.nopt.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_05, DecentWasmWat::Wat2WasmConfig());
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr)));
+
+	auto testOutWatStr_05 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	EXPECT_EQ(testOutWatStr_05, testInWatStr_05_nopt);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_19_Memory64DynamicCost)
+{
+	auto testInWatStr_19 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-19.in.wat");
+	auto testInWatStr_19_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-19.out.nopt.wat");
+
+	wabt::Features features;
+	features.enable_memory64();
+	auto mod = Wat2ModWithFeatures(testInWatStr_19, features);
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*mod));
+
+	auto testOutWatStr_19 =
+		DecentWasmWat::Mod2Wat(*mod, DecentWasmWat::Wasm2WatConfig());
+
+	EXPECT_EQ(testOutWatStr_19, testInWatStr_19_nopt);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_06_MultiDimension)
+{
+	auto testInWatStr_06 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-06.in.wat");
+	auto testInWatStr_06_dims =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-06.out.dims.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_06, DecentWasmWat::Wat2WasmConfig());
+
+	// 2nd dimension only counts calls to the host
+	DecentWasmCounter::CostModel hostCallModel;
+	hostCallModel.m_defaultImportFuncWeight = 1;
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_costModels.push_back(hostCallModel);
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_06 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// one combined increment call, with one weight per dimension, and the
+	// dimension exceeded is reported to the runtime
+	EXPECT_EQ(testOutWatStr_06, testInWatStr_06_dims);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_01_Statistics)
+{
+	auto testInWatStr_01 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-01.in.wat");
+	auto testInWatStr_01_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-01.out.nopt.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::ModuleStatistics stats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+		*(mod.m_ptr), DecentWasmCounter::InstrumentConfig(), stats));
+
+	// collecting statistics doesn't change the output
+	auto testOutWatStr_01 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_EQ(testOutWatStr_01, testInWatStr_01_nopt);
+
+	ASSERT_GT(stats.m_funcs.size(), 0);
+	EXPECT_GT(stats.m_numBlocks, 0);
+	EXPECT_GT(stats.m_numCountersInjected, 0);
+	EXPECT_GT(stats.m_numBytesAdded, 0);
+	ASSERT_EQ(stats.m_staticWeights.size(), 1);
+	EXPECT_GT(stats.m_staticWeights[0], 0);
+
+	// module steps and function passes, in the order they are run
+	std::vector<std::string> passNames;
+	for (const auto& pass : stats.m_passes)
+	{
+		passNames.push_back(pass.m_name);
+	}
+	std::vector<std::string> expPassNames = {
+		"InjectCounterAndFunc",
+		"GraphGen",
+		"Reachability",
+		"WeightCalc",
+		"BlockCounter",
+		"DynamicCounter",
+		"PostValidate",
+	};
+	EXPECT_EQ(passNames, expPassNames);
+	EXPECT_EQ(stats.m_passes[1].m_numRuns, stats.m_funcs.size());
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_07_DeadBlockPrune)
+{
+	auto testInWatStr_07 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-07.in.wat");
+	auto testInWatStr_07_prune =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-07.out.prune.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_07, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_pruneUnreachableCode = true;
+
+	DecentWasmCounter::ModuleStatistics stats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config, stats));
+
+	auto testOutWatStr_07 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// code after return and unreachable is removed, and `unreachable` is
+	// only appended after the block that always returns
+	EXPECT_EQ(stats.m_numDeadBlocks, 3);
+	EXPECT_EQ(stats.m_numExprsPruned, 8);
+	EXPECT_EQ(testOutWatStr_07, testInWatStr_07_prune);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_08_HostInterface)
+{
+	auto testInWatStr_08 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-08.in.wat");
+	auto testInWatStr_08_host =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-08.out.host.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_08, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_counterExportName = "decent_wasm_counter";
+	config.m_thresholdExportName = "decent_wasm_threshold";
+	config.m_entryFuncName = "_entry_function";
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_08 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// the wrapper takes the entry function's params, then the threshold,
+	// which is set before the entry function is called with its params
+	EXPECT_EQ(testOutWatStr_08, testInWatStr_08_host);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_08_HostInterfaceNameConflict)
+{
+	auto testInWatStr_08 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-08.in.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_08, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_entryFuncName = "_entry_function";
+	config.m_entryWrapperName = "_entry_function";
+
+	EXPECT_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_09_TrapOnExceed)
+{
+	auto testInWatStr_09 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-09.in.wat");
+	auto testInWatStr_09_trap =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-09.out.trap.wat");
+
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_09, DecentWasmWat::Wat2WasmConfig());
+
+		// notification function must be imported
+		EXPECT_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr)),
+			DecentWasmCounter::Exception);
+	}
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_09, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_exceedPolicy = DecentWasmCounter::ExceedPolicy::Trap;
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_09 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// block counter calls the increment function (index 1), which updates
+	// the counter global first, and then traps in the guest
+	EXPECT_EQ(testOutWatStr_09, testInWatStr_09_trap);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_01_Reprice)
+{
+	auto testInWatStr_01 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-01.in.wat");
+
+	DecentWasmCounter::CostModel newModel =
+		DecentWasmCounter::GetDefaultCostModel();
+	newModel.m_exprTypeWeights["Binary"] = 5;
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_emitRepricingInfo = true;
+
+	// instrumented with the old model, and then repriced
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+	EXPECT_NO_THROW(DecentWasmCounter::Reprice(*(mod.m_ptr), { newModel }));
+
+	// instrumented with the new model
+	auto expMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	config.m_costModels = { newModel };
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(expMod.m_ptr), config));
+
+	EXPECT_EQ(
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig()),
+		DecentWasmWat::Mod2Wat(*(expMod.m_ptr), DecentWasmWat::Wasm2WatConfig()));
+
+	// the number of dimensions must match
+	EXPECT_THROW(
+		DecentWasmCounter::Reprice(*(mod.m_ptr), { newModel, newModel }),
+		DecentWasmCounter::Exception);
+
+	// the module is left untouched if any of the block counters doesn't
+	// match the repricing info, even if the ones before it do
+	auto badMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::InstrumentConfig badConfig;
+	badConfig.m_emitRepricingInfo = true;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(badMod.m_ptr), badConfig));
+	// drop the last `call $incr` of $main_func
+	badMod.m_ptr->funcs[2]->exprs.pop_back();
+	auto badWatStr =
+		DecentWasmWat::Mod2Wat(*(badMod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_THROW(DecentWasmCounter::Reprice(*(badMod.m_ptr), { newModel }),
+		DecentWasmCounter::Exception);
+	EXPECT_EQ(
+		DecentWasmWat::Mod2Wat(*(badMod.m_ptr), DecentWasmWat::Wasm2WatConfig()),
+		badWatStr);
+
+	// modules without repricing info can't be repriced
+	auto noInfoMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(noInfoMod.m_ptr)));
+	EXPECT_THROW(DecentWasmCounter::Reprice(*(noInfoMod.m_ptr), { newModel }),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_10_Analyze)
+{
+	auto testInWatStr_10 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-10.in.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_10, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::ModuleAnalysis res;
+	EXPECT_NO_THROW(res = DecentWasmCounter::Analyze(*(mod.m_ptr)));
+
+	// the module is not modified
+	auto testOutWatStr_10 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_EQ(testOutWatStr_10.find("call"), std::string::npos);
+
+	ASSERT_EQ(res.m_funcs.size(), 2);
+
+	const auto& nested = res.m_funcs[0];
+	EXPECT_EQ(nested.m_funcIdx, 0);
+	EXPECT_EQ(nested.m_numBlocks, 5);
+	EXPECT_EQ(nested.m_numLoops, 2);
+	EXPECT_EQ(nested.m_maxLoopDepth, 2);
+	// inner loop iteration: i32.add + i32.lt_u
+	EXPECT_EQ(nested.m_minPathWeights, std::vector<uint64_t>({ 2 }));
+	// leaving the inner loop: one more i32.lt_u
+	EXPECT_EQ(nested.m_maxPathWeights, std::vector<uint64_t>({ 3 }));
+	EXPECT_EQ(nested.m_staticWeights, std::vector<uint64_t>({ 3 }));
+
+	const auto& straight = res.m_funcs[1];
+	EXPECT_EQ(straight.m_funcIdx, 1);
+	EXPECT_EQ(straight.m_numBlocks, 1);
+	EXPECT_EQ(straight.m_numLoops, 0);
+	EXPECT_EQ(straight.m_maxLoopDepth, 0);
+	EXPECT_EQ(straight.m_minPathWeights, std::vector<uint64_t>({ 1 }));
+	EXPECT_EQ(straight.m_maxPathWeights, std::vector<uint64_t>({ 1 }));
+	EXPECT_EQ(straight.m_staticWeights, std::vector<uint64_t>({ 1 }));
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_11_TryInstrument)
+{
+	auto testInWatStr_11 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-11.in.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_11, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentResult res;
+	EXPECT_NO_THROW(res = DecentWasmCounter::TryInstrument(
+		*(mod.m_ptr), DecentWasmCounter::InstrumentConfig()));
+
+	// `if` in the 2nd function, after `local.get`
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::UnsupportedExpr);
+	EXPECT_EQ(res.m_funcIdx, 2);
+	EXPECT_EQ(res.m_exprOffset, 1);
+
+	// the module is rejected before it's modified
+	auto testOutWatStr_11 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_EQ(testOutWatStr_11.find("global"), std::string::npos);
+
+	// the throwing API reports the same failure
+	EXPECT_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr)),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_09_TryInstrument)
+{
+	auto testInWatStr_09 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-09.in.wat");
+	auto testInWatStr_09_trap =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-09.out.trap.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_09, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+
+	// notification function must be imported
+	auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidExceedImport);
+	EXPECT_EQ(res.m_funcIdx, DecentWasmCounter::InstrumentResult::sk_noFunc);
+
+	config.m_exceedPolicy = DecentWasmCounter::ExceedPolicy::Trap;
+	res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+	EXPECT_TRUE(res.IsSuccess());
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_12_Simd)
+{
+	auto testInWatStr_12 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-12.in.wat");
+	auto testInWatStr_12_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-12.out.nopt.wat");
+	auto testInWatStr_12_lane =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-12.out.lane.wat");
+
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_12, DecentWasmWat::Wat2WasmConfig());
+
+		EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr)));
+
+		auto testOutWatStr_12 = DecentWasmWat::Mod2Wat(
+			*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+		// i32x4.add (4) + i8x16.add (16) + i32x4.mul (4)
+		EXPECT_EQ(testOutWatStr_12, testInWatStr_12_nopt);
+	}
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_12, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::CostModel model =
+		DecentWasmCounter::GetDefaultCostModel();
+	model.m_simdLaneWeights["SimdLaneOp"] = 3;
+	model.m_simdLaneWeights["LoadSplat"] = 5;
+	// a specific instruction overrides the lane weights
+	model.m_opcodeWeights["i8x16.add"] = 2;
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_costModels = { model };
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_12 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// 4 + 2 + v128.load32_splat (5) + 4 + i32x4.extract_lane (3 * 4)
+	EXPECT_EQ(testOutWatStr_12, testInWatStr_12_lane);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_20_ExceptionsTailCalls)
+{
+	auto testInWatStr_20 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-20.in.wat");
+	auto testInWatStr_20_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-20.out.nopt.wat");
+
+	wabt::Features features;
+	features.enable_exceptions();
+	features.enable_tail_call();
+	auto mod = Wat2ModWithFeatures(testInWatStr_20, features);
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*mod));
+
+	auto testOutWatStr_20 =
+		DecentWasmWat::Mod2Wat(*mod, DecentWasmWat::Wasm2WatConfig());
+
+	EXPECT_EQ(testOutWatStr_20, testInWatStr_20_nopt);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_13_AggregateBudget)
+{
+	auto testInWatStr_13 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-13.in.wat");
+	auto testInWatStr_13_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-13.out.nopt.wat");
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_aggregateBudget.m_flushInterval = 1000;
+
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_13, DecentWasmWat::Wat2WasmConfig());
+
+		// the slots must be 8-byte aligned, and in an existing memory
+		config.m_aggregateBudget.m_slotOffset = 4;
+		auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+		EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+
+		config.m_aggregateBudget.m_slotOffset = 64;
+		config.m_aggregateBudget.m_memoryIdx = 1;
+		res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+		EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+	}
+
+	config.m_aggregateBudget.m_memoryIdx = 0;
+	{
+		// the aggregate budget is notified through its own import
+		std::string noAggrImport = testInWatStr_13;
+		const std::string aggrImport = "(import \"env\" "
+			"\"decent_wasm_counter_aggregate_exceed\"";
+		noAggrImport.replace(noAggrImport.find(aggrImport),
+			aggrImport.size(), "(import \"env\" \"other_func\"");
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", noAggrImport, DecentWasmWat::Wat2WasmConfig());
+
+		auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+		EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidExceedImport);
+	}
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_13, DecentWasmWat::Wat2WasmConfig());
+
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	auto testOutWatStr_13 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// the counter is still per-instance, and the batched charges are
+	// flushed to the slot at address 64, where $aggr_exceed is called
+	// instead of $ctr_exceed
+	EXPECT_EQ(testOutWatStr_13, testInWatStr_13_nopt);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_14_TrustedFuncs)
+{
+	auto testInWatStr_14 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-14.in.wat");
+	auto testInWatStr_14_nopt =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-14.out.nopt.wat");
+
+	DecentWasmCounter::TrustedFuncCost hashCost;
+	hashCost.m_weights = { 500 };
+	hashCost.m_sizeCosts = { DecentWasmCounter::DynamicCost(3, 0) };
+	DecentWasmCounter::TrustedFuncCost stampCost;
+	stampCost.m_weights = { 40 };
+	DecentWasmCounter::TrustedFuncCost wrapCost;
+	wrapCost.m_weights = { 20 };
+	DecentWasmCounter::TrustedFuncCost mixCost;
+	mixCost.m_weights = { 60 };
+
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_14, DecentWasmWat::Wat2WasmConfig());
+
+		// the trusted function must exist, and its cost can't have more
+		// dimensions than the cost models
+		DecentWasmCounter::InstrumentConfig config;
+		config.m_trustedFuncs["$missing"] = stampCost;
+		auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+		EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+
+		config.m_trustedFuncs.clear();
+		config.m_trustedFuncs["stamp"].m_weights = { 40, 1 };
+		res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+		EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+	}
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_14, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_trustedFuncs["$hash"] = hashCost;
+	config.m_trustedFuncs["stamp"] = stampCost;
+	config.m_trustedFuncs["$wrap"] = wrapCost;
+	config.m_trustedFuncs["$mix"] = mixCost;
+	DecentWasmCounter::ModuleStatistics stats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config, stats));
+
+	// only $main goes through the function passes
+	ASSERT_EQ(stats.m_funcs.size(), 1);
+	EXPECT_EQ(stats.m_funcs[0].m_funcIdx, 3);
+
+	auto testOutWatStr_14 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+
+	// $hash and $wrap are charged in $main's block, plus 3 per unit of
+	// $hash's last argument; $stamp and $mix are charged at their entries
+	EXPECT_EQ(testOutWatStr_14, testInWatStr_14_nopt);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_15_BlockTable)
+{
+	auto testInWatStr_15 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-15.in.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_15, DecentWasmWat::Wat2WasmConfig());
+	auto expMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_15, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_emitBlockTableOnly = true;
+
+	// the code can't be changed
+	config.m_pruneUnreachableCode = true;
+	auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+	config.m_pruneUnreachableCode = false;
+
+	// decent_wasm_counter_exceed doesn't need to be imported
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config));
+
+	// the function bodies are untouched
+	EXPECT_EQ(
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig()),
+		DecentWasmWat::Mod2Wat(*(expMod.m_ptr), DecentWasmWat::Wasm2WatConfig()));
+
+	DecentWasmCounter::BlockTable table;
+	EXPECT_NO_THROW(table = DecentWasmCounter::GetBlockTable(*(mod.m_ptr)));
+	EXPECT_EQ(table.m_numDims, 1);
+	ASSERT_EQ(table.m_funcs.size(), 1);
+
+	const DecentWasmCounter::FuncBlockTable& func = table.m_funcs[0];
+	EXPECT_EQ(func.m_funcIdx, 0);
+
+	ASSERT_GT(func.m_blocks.size(), 1);
+	EXPECT_EQ(func.m_blocks[0].m_exprOrdinal, 3);
+	EXPECT_FALSE(func.m_blocks[0].m_isChargedBefore);
+	EXPECT_EQ(func.m_blocks[0].m_weights, std::vector<uint64_t>({ 1 }));
+	EXPECT_GT(func.m_blocks[0].m_edges.size(), 0);
+
+	bool isBrIfFound = false;
+	for (const auto& blk : func.m_blocks)
+	{
+		if (blk.m_exprOrdinal == 6)
+		{
+			isBrIfFound = true;
+			EXPECT_TRUE(blk.m_isChargedBefore);
+			EXPECT_EQ(blk.m_weights, std::vector<uint64_t>({ 0 }));
+		}
+	}
+	EXPECT_TRUE(isBrIfFound);
+
+	ASSERT_EQ(func.m_dynCharges.size(), 1);
+	EXPECT_EQ(func.m_dynCharges[0].m_exprOrdinal, 10);
+	ASSERT_EQ(func.m_dynCharges[0].m_costs.size(), 1);
+	EXPECT_EQ(func.m_dynCharges[0].m_costs[0].m_perUnit, 1);
+	EXPECT_EQ(func.m_dynCharges[0].m_costs[0].m_unitShift, 3);
+
+	// modules without the block table
+	EXPECT_THROW(DecentWasmCounter::GetBlockTable(*(expMod.m_ptr)),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_15_ExportGraph)
+{
+	auto testInWatStr_15 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-15.in.wat");
+	auto testOutJsonStr_15 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-15.out.graph.json");
+	auto testOutDotStr_15 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-15.out.hits.dot");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_15, DecentWasmWat::Wat2WasmConfig());
+	std::vector<DecentWasmCounter::CostModel> models = {
+		DecentWasmCounter::GetDefaultCostModel() };
+
+	std::string json;
+	EXPECT_NO_THROW(json = DecentWasmCounter::ExportGraph(*(mod.m_ptr), 0,
+		models, DecentWasmCounter::GraphFormat::Json));
+	// there are no hit counts without a profile
+	EXPECT_EQ(json, testOutJsonStr_15);
+
+	// hit counts are indexed in the same order as the block table
+	auto tableMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_15, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_emitBlockTableOnly = true;
+	DecentWasmCounter::Instrument(*(tableMod.m_ptr), config);
+	auto table = DecentWasmCounter::GetBlockTable(*(tableMod.m_ptr));
+	ASSERT_EQ(table.m_funcs.size(), 1);
+
+	std::vector<uint64_t> hitCounts(table.m_funcs[0].m_blocks.size(), 7);
+	std::string dot;
+	EXPECT_NO_THROW(dot = DecentWasmCounter::ExportGraph(*(mod.m_ptr), 0,
+		models, DecentWasmCounter::GraphFormat::Dot, hitCounts));
+	EXPECT_EQ(dot, testOutDotStr_15);
+
+	hitCounts.push_back(7);
+	EXPECT_THROW(DecentWasmCounter::ExportGraph(*(mod.m_ptr), 0,
+		models, DecentWasmCounter::GraphFormat::Dot, hitCounts),
+		DecentWasmCounter::Exception);
+
+	// only functions defined in the module can be exported
+	EXPECT_THROW(DecentWasmCounter::ExportGraph(*(mod.m_ptr), 1,
+		models, DecentWasmCounter::GraphFormat::Json),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, Instrumenter_InstrumentAll)
+{
+	const std::vector<std::string> names = { "01", "02", "03" };
+
+	std::vector<DecentWasmWat::ModWrapper> mods;
+	std::vector<wabt::Module*> modPtrs;
+	mods.reserve(names.size() + 1);
+	for (const std::string& name : names)
+	{
+		auto testInWatStr = ReadFile2Buffer<std::string>(
+			"../../test/test_wats/test-" + name + ".in.wat");
+		mods.emplace_back(DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr, DecentWasmWat::Wat2WasmConfig()));
+		modPtrs.push_back(mods.back().m_ptr);
+	}
+	// the same module can be listed more than once, as long as the copies
+	// are different objects
+	auto testInWatStr_01 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-01.in.wat");
+	mods.emplace_back(DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig()));
+	modPtrs.push_back(mods.back().m_ptr);
+
+	const DecentWasmCounter::Instrumenter instrumenter;
+	std::vector<DecentWasmCounter::ModuleStatistics> stats;
+	auto res = instrumenter.InstrumentAll(modPtrs, 4, &stats);
+	ASSERT_EQ(res.size(), modPtrs.size());
+	ASSERT_EQ(stats.size(), modPtrs.size());
+
+	// same outputs as the ones instrumented one by one
+	for (size_t i = 0; i < modPtrs.size(); ++i)
+	{
+		const std::string& name = i < names.size() ? names[i] : names[0];
+		auto testInWatStr_nopt = ReadFile2Buffer<std::string>(
+			"../../test/test_wats/test-" + name + ".out.nopt.wat");
+
+		EXPECT_TRUE(res[i].IsSuccess());
+		EXPECT_GT(stats[i].m_numCountersInjected, 0);
+		EXPECT_EQ(
+			DecentWasmWat::Mod2Wat(*(modPtrs[i]), DecentWasmWat::Wasm2WatConfig()),
+			testInWatStr_nopt);
+	}
+
+	// failures are reported per module
+	auto badMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", "(module)", DecentWasmWat::Wat2WasmConfig());
+	res = instrumenter.InstrumentAll({ badMod.m_ptr, nullptr });
+	ASSERT_EQ(res.size(), 2);
+	EXPECT_EQ(res[0].m_code, DecentWasmCounter::ErrorCode::InvalidExceedImport);
+	EXPECT_EQ(res[1].m_code, DecentWasmCounter::ErrorCode::Internal);
+}
+
+GTEST_TEST(TestInstrumentation, MemoryLimit)
+{
+	auto testInWatStr_01 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-01.in.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_memoryLimit = 64;
+
+#ifdef DECENT_WASM_COUNTER_TRUSTED
+	// the hooks below are compatible with the default ones, so they can be
+	// replaced after things have been allocated
+	static size_t numAllocs = 0;
+	DecentWasmCounter::SetAllocatorHooks(DecentWasmCounter::AllocatorHooks{
+		[](size_t size, void*) -> void*
+		{
+			++numAllocs;
+			return std::malloc(size);
+		},
+		[](void* ptr, void*)
+		{
+			std::free(ptr);
+		},
+		nullptr });
+
+	auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::MemoryLimitExceeded);
+	EXPECT_GT(numAllocs, 0);
+
+	auto modOk = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	config.m_memoryLimit = 64 * 1024 * 1024;
+	EXPECT_TRUE(DecentWasmCounter::TryInstrument(
+		*(modOk.m_ptr), config).IsSuccess());
+
+	// the limit applies to preparing the module, and to instrumenting each
+	// function on demand
+	auto modLazy = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	config.m_memoryLimit = 64;
+	EXPECT_THROW(DecentWasmCounter::PrepareModule(*(modLazy.m_ptr), config),
+		std::bad_alloc);
+
+	auto modLazyOk = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_01, DecentWasmWat::Wat2WasmConfig());
+	config.m_memoryLimit = 64 * 1024 * 1024;
+	auto prepared = DecentWasmCounter::PrepareModule(
+		*(modLazyOk.m_ptr), config);
+	for (uint32_t i = 0; i < modLazyOk.m_ptr->funcs.size(); ++i)
+	{
+		if (prepared.IsPending(i))
+		{
+			EXPECT_NO_THROW(
+				DecentWasmCounter::InstrumentFunction(prepared, i));
+		}
+	}
+
+	// over-aligned allocations go through the hooks as well
+	struct alignas(64) OverAligned
+	{
+		uint8_t m_data[64];
+	};
+	size_t numAllocsBefore = numAllocs;
+	std::unique_ptr<OverAligned> overAligned(new OverAligned());
+	EXPECT_EQ(numAllocs, numAllocsBefore + 1);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(overAligned.get()) % 64, 0);
+	overAligned.reset();
+
+	DecentWasmCounter::SetAllocatorHooks(
+		DecentWasmCounter::AllocatorHooks{ nullptr, nullptr, nullptr });
+#else
+	// only the trusted library can enforce the limit
+	auto res = DecentWasmCounter::TryInstrument(*(mod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+	EXPECT_THROW(DecentWasmCounter::PrepareModule(*(mod.m_ptr), config),
+		DecentWasmCounter::Exception);
+#endif // DECENT_WASM_COUNTER_TRUSTED
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_04_LazyFuncs)
+{
+	auto testInWatStr_04 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-04.in.wat");
+	auto testInWatStr_04_leaf =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-04.out.leaf.wat");
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_04, DecentWasmWat::Wat2WasmConfig());
+
+	InstrumentConfig config;
+	config.m_elideLeafFuncCounters = true;
+	auto prepared = DecentWasmCounter::PrepareModule(*(mod.m_ptr), config);
+
+	// imports and injected functions are not instrumented
+	EXPECT_FALSE(prepared.IsPending(0));
+	EXPECT_FALSE(prepared.IsPending(1));
+	EXPECT_TRUE(prepared.IsPending(2));
+	EXPECT_TRUE(prepared.IsPending(3));
+	EXPECT_FALSE(prepared.IsPending(4));
+
+	// in any order, the result is the same as instrumenting them at once
+	auto stats = DecentWasmCounter::InstrumentFunction(prepared, 3);
+	EXPECT_TRUE(stats.m_isCounted);
+	EXPECT_FALSE(prepared.IsPending(3));
+	stats = DecentWasmCounter::InstrumentFunction(prepared, 2);
+	EXPECT_FALSE(stats.m_isCounted);
+
+	EXPECT_EQ(
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig()),
+		testInWatStr_04_leaf);
+
+	// instrumenting a function again does nothing
+	stats = DecentWasmCounter::InstrumentFunction(prepared, 3);
+	EXPECT_EQ(stats.m_numCountersInjected, 0);
+	EXPECT_EQ(
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig()),
+		testInWatStr_04_leaf);
+
+	EXPECT_THROW(DecentWasmCounter::InstrumentFunction(prepared, 0),
+		DecentWasmCounter::Exception);
+	EXPECT_THROW(DecentWasmCounter::InstrumentFunction(prepared, 100),
+		DecentWasmCounter::Exception);
+
+	// the repricing info needs the whole module
+	auto repricingMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_04, DecentWasmWat::Wat2WasmConfig());
+	InstrumentConfig repricingConfig;
+	repricingConfig.m_emitRepricingInfo = true;
+	EXPECT_THROW(DecentWasmCounter::PrepareModule(
+		*(repricingMod.m_ptr), repricingConfig),
+		DecentWasmCounter::Exception);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_16_UnreachableFuncs)
+{
+	auto testInWatStr_16 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-16.in.wat");
+	auto testInWatStr_16_skip =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-16.out.skip.wat");
+	auto testInWatStr_16_stub =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-16.out.stub.wat");
+
+	// all functions are instrumented by default
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_16, DecentWasmWat::Wat2WasmConfig());
+		DecentWasmCounter::ModuleStatistics stats;
+		EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+			*(mod.m_ptr), DecentWasmCounter::InstrumentConfig(), stats));
+		EXPECT_EQ(stats.m_numUnreachableFuncs, 0);
+		EXPECT_EQ(stats.m_funcs.size(), 5);
+	}
+
+	// $dead and $dead_callee are left as they are
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_16, DecentWasmWat::Wat2WasmConfig());
+		DecentWasmCounter::InstrumentConfig config;
+		config.m_unreachableFuncPolicy =
+			DecentWasmCounter::UnreachableFuncPolicy::Skip;
+		DecentWasmCounter::ModuleStatistics stats;
+		EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+			*(mod.m_ptr), config, stats));
+		EXPECT_EQ(stats.m_numUnreachableFuncs, 2);
+		ASSERT_EQ(stats.m_funcs.size(), 3);
+		EXPECT_EQ(stats.m_funcs[0].m_funcIdx, 1);
+		EXPECT_EQ(stats.m_funcs[1].m_funcIdx, 2);
+		EXPECT_EQ(stats.m_funcs[2].m_funcIdx, 5);
+
+		auto testOutWatStr_16 =
+			DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+		EXPECT_EQ(testOutWatStr_16, testInWatStr_16_skip);
+	}
+
+	// $dead and $dead_callee are replaced by `unreachable`, where the
+	// local of $dead is dropped, while the names of the params are kept
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"filename.wat", testInWatStr_16, DecentWasmWat::Wat2WasmConfig());
+		DecentWasmCounter::InstrumentConfig config;
+		config.m_unreachableFuncPolicy =
+			DecentWasmCounter::UnreachableFuncPolicy::Stub;
+		DecentWasmCounter::ModuleStatistics stats;
+		EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+			*(mod.m_ptr), config, stats));
+		EXPECT_EQ(stats.m_numUnreachableFuncs, 2);
+		EXPECT_EQ(stats.m_funcs.size(), 3);
+
+		auto testOutWatStr_16 =
+			DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+		EXPECT_EQ(testOutWatStr_16, testInWatStr_16_stub);
+	}
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_17_IncrThunks)
+{
+	auto testInWatStr_17 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-17.in.wat");
+	auto testInWatStr_17_thunks =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-17.out.thunks.wat");
+
+	auto plainMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_17, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::ModuleStatistics plainStats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+		*(plainMod.m_ptr), DecentWasmCounter::InstrumentConfig(), plainStats));
+	EXPECT_EQ(plainStats.m_numIncrThunks, 0);
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_17, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_maxIncrThunks = 1;
+	DecentWasmCounter::ModuleStatistics stats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config, stats));
+
+	// the same counters are placed, but most of them go through the thunk
+	EXPECT_EQ(stats.m_numIncrThunks, 1);
+	EXPECT_GE(stats.m_numIncrThunkSites, 12);
+	EXPECT_EQ(stats.m_numCountersInjected, plainStats.m_numCountersInjected);
+	EXPECT_LT(stats.m_numBytesAdded, plainStats.m_numBytesAdded);
+
+	// all the counters charge the same weight, so each of them calls the
+	// thunk, which is the only one left with an `i64.const` weight
+	auto testOutWatStr_17 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_EQ(testOutWatStr_17, testInWatStr_17_thunks);
+
+	// the repricing info needs the constant weights of each counter
+	auto repricingMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_17, DecentWasmWat::Wat2WasmConfig());
+	config.m_emitRepricingInfo = true;
+	auto res = DecentWasmCounter::TryInstrument(*(repricingMod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+}
+
+GTEST_TEST(TestInstrumentation, TestInput_18_MergeBlocks)
+{
+	auto testInWatStr_18 =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-18.in.wat");
+	auto testInWatStr_18_merge =
+		ReadFile2Buffer<std::string>("../../test/test_wats/test-18.out.merge.wat");
+
+	auto plainMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_18, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::ModuleStatistics plainStats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(
+		*(plainMod.m_ptr), DecentWasmCounter::InstrumentConfig(), plainStats));
+	EXPECT_EQ(plainStats.m_numBlocksMerged, 0);
+
+	auto mod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_18, DecentWasmWat::Wat2WasmConfig());
+	DecentWasmCounter::InstrumentConfig config;
+	config.m_mergeEquivalentBlocks = true;
+	DecentWasmCounter::ModuleStatistics stats;
+	EXPECT_NO_THROW(DecentWasmCounter::Instrument(*(mod.m_ptr), config, stats));
+
+	// the code after the `block` and after the `loop` is charged together
+	// with the code before them, so the total weights stay the same;
+	// in $skip, the code after the inner `block` isn't charged with the
+	// code before the inner `block`, since the `br_if` to $out can skip it
+	EXPECT_GE(stats.m_numBlocksMerged, 2);
+	EXPECT_EQ(stats.m_numCountersInjected + stats.m_numBlocksMerged,
+		plainStats.m_numCountersInjected);
+	EXPECT_EQ(stats.m_staticWeights, plainStats.m_staticWeights);
+
+	auto testOutWatStr_18 =
+		DecentWasmWat::Mod2Wat(*(mod.m_ptr), DecentWasmWat::Wasm2WatConfig());
+	EXPECT_EQ(testOutWatStr_18, testInWatStr_18_merge);
+
+	// the repricing info needs one counter per block
+	auto repricingMod = DecentWasmWat::Wat2Mod(
+		"filename.wat", testInWatStr_18, DecentWasmWat::Wat2WasmConfig());
+	config.m_emitRepricingInfo = true;
+	auto res = DecentWasmCounter::TryInstrument(*(repricingMod.m_ptr), config);
+	EXPECT_EQ(res.m_code, DecentWasmCounter::ErrorCode::InvalidConfig);
+}
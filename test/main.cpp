@@ -12,7 +12,7 @@ namespace DecentWasmCounter_Test
 
 int main(int argc, char** argv)
 {
-	constexpr size_t EXPECTED_NUM_OF_TEST_FILE = 1;
+	constexpr size_t EXPECTED_NUM_OF_TEST_FILE = 2;
 
 	std::cout << "===== SimpleObjects test program =====" << std::endl;
 	std::cout << std::endl;
@@ -0,0 +1,26 @@
+(module
+  (import "env" "decent_wasm_test_log" (func $log (param i32)))
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  ;; loop-free, recursion-free, only called directly
+  ;; -> charged at call sites
+  (func $add_one (param $x i32) (result i32)
+    local.get $x
+    i32.const 1
+    i32.add ;; w = 1
+  )
+
+  (func $main_func
+    (local $i i32)
+
+    local.get $i
+    call $add_one ;; w = 1
+    call $add_one ;; w = 1
+    local.set $i
+    local.get $i
+    call $log ;; w = 10
+    ;; total_w = 12
+  )
+
+  (start 3)
+)
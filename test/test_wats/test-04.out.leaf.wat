@@ -0,0 +1,37 @@
+(module
+  (import "env" "decent_wasm_test_log" (func $log (param i32)))
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $add_one (param $x i32) (result i32)
+    local.get 0
+    i32.const 1
+    i32.add)
+  (func $main_func
+    (local $i i32)
+    local.get 0
+    call 2
+    call 2
+    local.set 0
+    local.get 0
+    call 0
+    i64.const 12
+    call 4)
+  (start 3)
+  (type (;0;) (func (param i32)))
+  (type (;1;) (func (param i64)))
+  (type (;2;) (func (param i32) (result i32)))
+  (type (;3;) (func))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;4;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 1
+    end))
@@ -0,0 +1,15 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (memory 1)
+
+  (func $fill_func (param $len i32)
+    i32.const 0
+    i32.const 0
+    local.get $len
+    ;; charged 1 per 8 bytes at run time
+    memory.fill
+  )
+
+  (export "fill_func" (func $fill_func))
+)
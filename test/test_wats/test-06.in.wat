@@ -0,0 +1,15 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64 i32)))
+  (import "env" "decent_wasm_test_log" (func $test_log (param i32)))
+
+  (func $log_sum (param $a i32) (param $b i32)
+    local.get $a
+    local.get $b
+    ;; CPU dimension: 1; host call dimension: 0
+    i32.add
+    ;; CPU dimension: 10; host call dimension: 1
+    call $test_log
+  )
+
+  (export "log_sum" (func $log_sum))
+)
@@ -0,0 +1,47 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64 i32)))
+  (import "env" "decent_wasm_test_log" (func $test_log (param i32)))
+  (func $log_sum (param $a i32) (param $b i32)
+    local.get 0
+    local.get 1
+    i32.add
+    call 1
+    i64.const 11
+    i64.const 1
+    call 3)
+  (export "log_sum" (func 2))
+  (type (;0;) (func (param i64 i32)))
+  (type (;1;) (func (param i32)))
+  (type (;2;) (func (param i32 i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (global (;2;) (mut i64) (i64.const 0))
+  (global (;3;) (mut i64) (i64.const 0))
+  (type (;3;) (func (param i64 i64)))
+  (func (;3;) (param i64 i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    local.get 1
+    global.get 3
+    i64.add
+    global.set 3
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      i32.const 0
+      call 0
+    end
+    block  ;; label = @1
+      global.get 3
+      global.get 2
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 3
+      i32.const 1
+      call 0
+    end))
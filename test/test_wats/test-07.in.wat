@@ -0,0 +1,41 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (func $dead_tail (param $a i32) (result i32)
+    block
+      local.get $a
+      br_if 0
+      local.get $a
+      i32.const 1
+      i32.add
+      return
+      ;; dead code after return
+      local.get $a
+      i32.const 2
+      i32.mul
+      drop
+    end
+    local.get $a
+    i32.const 3
+    i32.add
+    ;; dead code after unreachable
+    unreachable
+    i32.const 4
+    i32.add
+  )
+
+  (func $dead_after_block (param $a i32) (result i32)
+    block
+      local.get $a
+      return
+    end
+    ;; dead code after a block that always returns, where an `unreachable`
+    ;; is needed, since the block doesn't end the list
+    local.get $a
+    i32.const 5
+    i32.add
+  )
+
+  (export "dead_tail" (func $dead_tail))
+  (export "dead_after_block" (func $dead_after_block))
+)
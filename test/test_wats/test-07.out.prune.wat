@@ -0,0 +1,44 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $dead_tail (param $a i32) (result i32)
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      i64.const 1
+      call 3
+      return
+    end
+    local.get 0
+    i32.const 3
+    i32.add
+    i64.const 1
+    call 3
+    unreachable)
+  (func $dead_after_block (param $a i32) (result i32)
+    block  ;; label = @1
+      local.get 0
+      return
+    end
+    unreachable)
+  (export "dead_tail" (func 1))
+  (export "dead_after_block" (func 2))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;3;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
@@ -0,0 +1,11 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (func $entry (param $msg i32) (param $len i64) (result i32)
+    local.get $msg
+    i32.const 1
+    i32.add
+  )
+
+  (export "_entry_function" (func $entry))
+)
@@ -0,0 +1,36 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $entry (param $msg i32) (param $len i64) (result i32)
+    local.get 0
+    i32.const 1
+    i32.add
+    i64.const 1
+    call 2)
+  (export "_entry_function" (func 1))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32 i64) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;2;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end)
+  (export "decent_wasm_counter" (global 1))
+  (export "decent_wasm_threshold" (global 0))
+  (type (;2;) (func (param i32 i64 i64) (result i32)))
+  (func (;3;) (param i32 i64 i64) (result i32)
+    local.get 2
+    global.set 0
+    local.get 0
+    local.get 1
+    call 1)
+  (export "decent_entry_function" (func 3)))
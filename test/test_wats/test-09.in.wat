@@ -0,0 +1,11 @@
+(module
+  ;; decent_wasm_counter_exceed is not imported
+
+  (func $add (param $a i32) (param $b i32) (result i32)
+    local.get $a
+    local.get $b
+    i32.add
+  )
+
+  (export "add" (func $add))
+)
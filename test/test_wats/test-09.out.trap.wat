@@ -0,0 +1,24 @@
+(module
+  (func $add (param $a i32) (param $b i32) (result i32)
+    local.get 0
+    local.get 1
+    i32.add
+    i64.const 1
+    call 1)
+  (export "add" (func 0))
+  (type (;0;) (func (param i32 i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (type (;1;) (func (param i64)))
+  (func (;1;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      unreachable
+    end))
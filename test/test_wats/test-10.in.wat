@@ -0,0 +1,31 @@
+(module
+  (func $nested_loops (param $n i32) (result i32)
+    (local $i i32)
+    loop $outer
+      loop $inner
+        local.get $i
+        i32.const 1
+        i32.add
+        local.set $i
+        local.get $i
+        local.get $n
+        i32.lt_u
+        br_if $inner
+      end
+      local.get $i
+      local.get $n
+      i32.lt_u
+      br_if $outer
+    end
+    local.get $i
+  )
+
+  (func $straight (param $a i32) (result i32)
+    local.get $a
+    i32.const 1
+    i32.add
+  )
+
+  (export "nested_loops" (func $nested_loops))
+  (export "straight" (func $straight))
+)
@@ -0,0 +1,25 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (func $supported (param $a i32) (result i32)
+    block
+      local.get $a
+      br_if 1
+    end
+    local.get $a
+    i32.const 1
+    i32.add
+  )
+
+  (func $unsupported (param $a i32) (result i32)
+    local.get $a
+    if (result i32)
+      i32.const 1
+    else
+      i32.const 2
+    end
+  )
+
+  (export "supported" (func $supported))
+  (export "unsupported" (func $unsupported))
+)
@@ -0,0 +1,17 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (memory 1)
+
+  (func $simd (param $a v128) (param $b v128) (result i32)
+    local.get $a
+    local.get $b
+    i32x4.add
+    local.get $b
+    i8x16.add
+    i32.const 0
+    v128.load32_splat
+    i32x4.mul
+    i32x4.extract_lane 0
+  )
+)
@@ -0,0 +1,32 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (memory (;0;) 1)
+  (func $simd (param $a v128) (param $b v128) (result i32)
+    local.get 0
+    local.get 1
+    i32x4.add
+    local.get 1
+    i8x16.add
+    i32.const 0
+    v128.load32_splat
+    i32x4.mul
+    i32x4.extract_lane 0
+    i64.const 27
+    call 2)
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param v128 v128) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;2;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
@@ -0,0 +1,16 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (import "env" "decent_wasm_counter_aggregate_exceed" (func $aggr_exceed (param i64)))
+
+  (memory 1)
+
+  (func $worker (param $a i32) (result i32)
+    local.get $a
+    i32.const 1
+    i32.add ;; w = 1
+    i32.const 2
+    i32.mul ;; w = 1
+  )
+
+  (export "worker" (func $worker))
+)
@@ -0,0 +1,63 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (import "env" "decent_wasm_counter_aggregate_exceed" (func $aggr_exceed (param i64)))
+  (memory (;0;) 1)
+  (func $worker (param $a i32) (result i32)
+    local.get 0
+    i32.const 1
+    i32.add
+    i32.const 2
+    i32.mul
+    i64.const 2
+    call 3)
+  (export "worker" (func 2))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (global (;2;) (mut i64) (i64.const 0))
+  (func (;3;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    local.get 0
+    global.get 2
+    i64.add
+    global.set 2
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end
+    block  ;; label = @1
+      global.get 2
+      i64.const 1000
+      i64.lt_u
+      br_if 0 (;@1;)
+      call 4
+    end)
+  (type (;2;) (func))
+  (func (;4;)
+    (local i64)
+    i32.const 64
+    global.get 2
+    i64.atomic.rmw.add
+    global.get 2
+    i64.add
+    local.set 0
+    i64.const 0
+    global.set 2
+    block  ;; label = @1
+      local.get 0
+      i32.const 64
+      i64.atomic.load offset=8
+      i64.le_u
+      br_if 0 (;@1;)
+      local.get 0
+      call 1
+    end)
+  (export "decent_wasm_counter_flush" (func 4)))
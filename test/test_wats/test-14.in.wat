@@ -0,0 +1,48 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  ;; trusted, only called directly
+  ;; -> w = 500 + 3 * $len, charged at call sites
+  (func $hash (param $ptr i32) (param $len i32) (result i32)
+    local.get $ptr
+    local.get $len
+    i32.add
+  )
+
+  ;; trusted, exported
+  ;; -> w = 40, charged at its entry
+  (func $stamp (param $x i32) (result i32)
+    local.get $x
+    i32.const 1
+    i32.add
+  )
+
+  (func $main (param $a i32) (result i32)
+    local.get $a
+    local.get $a
+    call $hash ;; w = 500
+    call $stamp ;; w = 0
+    call $wrap ;; w = 20
+    i32.const 7
+    i32.mul ;; w = 1
+    ;; total_w = 521
+  )
+
+  ;; trusted, only called directly
+  ;; -> w = 20, charged at call sites
+  (func $wrap (param $x i32) (result i32)
+    local.get $x
+    call $mix
+  )
+
+  ;; trusted, only called by the trusted $wrap, whose body isn't instrumented
+  ;; -> w = 60, charged at its entry
+  (func $mix (param $x i32) (result i32)
+    local.get $x
+    i32.const 3
+    i32.xor
+  )
+
+  (export "stamp" (func $stamp))
+  (export "main" (func $main))
+)
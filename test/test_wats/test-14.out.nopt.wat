@@ -0,0 +1,58 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $hash (param $ptr i32) (param $len i32) (result i32)
+    local.get 0
+    local.get 1
+    i32.add)
+  (func $stamp (param $x i32) (result i32)
+    i64.const 40
+    call 6
+    local.get 0
+    i32.const 1
+    i32.add)
+  (func $main (param $a i32) (result i32)
+    (local i32)
+    local.get 0
+    local.get 0
+    local.tee 1
+    local.get 1
+    i64.extend_i32_u
+    i64.const 3
+    i64.mul
+    call 6
+    call 1
+    call 2
+    call 4
+    i32.const 7
+    i32.mul
+    i64.const 521
+    call 6)
+  (func $wrap (param $x i32) (result i32)
+    local.get 0
+    call 5)
+  (func $mix (param $x i32) (result i32)
+    i64.const 60
+    call 6
+    local.get 0
+    i32.const 3
+    i32.xor)
+  (export "stamp" (func 2))
+  (export "main" (func 3))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32 i32) (result i32)))
+  (type (;2;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;6;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
@@ -0,0 +1,24 @@
+(module
+  (memory 1)
+
+  (func $main (param $n i32)
+    local.get $n ;; #0
+    i32.const 1 ;; #1
+    i32.add ;; #2, w = 1
+    local.set $n ;; #3
+    ;; total_w = 1, charged after #3
+
+    block $blk_1 ;; #4
+      local.get $n ;; #5
+      br_if $blk_1 ;; #6
+      ;; total_w = 0, charged before #6
+
+      i32.const 0 ;; #7
+      i32.const 0 ;; #8
+      local.get $n ;; #9
+      memory.fill ;; #10, w = $n >> 3
+    end
+  )
+
+  (export "main" (func $main))
+)
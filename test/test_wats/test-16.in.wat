@@ -0,0 +1,47 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (table 1 funcref)
+  (elem (i32.const 0) $in_table)
+
+  ;; called by $main
+  (func $used (param $x i32) (result i32)
+    local.get $x
+    i32.const 1
+    i32.add
+  )
+
+  ;; only reachable through the table
+  (func $in_table (param $x i32) (result i32)
+    local.get $x
+    i32.const 2
+    i32.mul
+  )
+
+  ;; never called
+  (func $dead (param $x i32) (result i32)
+    (local $y i32)
+    local.get $x
+    call $dead_callee
+    local.set $y
+    local.get $y
+    i32.const 3
+    i32.add
+  )
+
+  ;; only called by $dead
+  (func $dead_callee (param $x i32) (result i32)
+    local.get $x
+    i32.const 4
+    i32.sub
+  )
+
+  (func $main (param $x i32) (result i32)
+    local.get $x
+    call $used
+    i32.const 0
+    call_indirect (param i32) (result i32)
+  )
+
+  (export "main" (func $main))
+)
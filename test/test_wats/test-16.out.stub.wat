@@ -0,0 +1,43 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (table (;0;) 1 funcref)
+  (elem (;0;) (i32.const 0) func 2)
+  (func $used (param $x i32) (result i32)
+    local.get 0
+    i32.const 1
+    i32.add
+    i64.const 1
+    call 6)
+  (func $in_table (param $x i32) (result i32)
+    local.get 0
+    i32.const 2
+    i32.mul
+    i64.const 1
+    call 6)
+  (func $dead (param $x i32) (result i32)
+    unreachable)
+  (func $dead_callee (param $x i32) (result i32)
+    unreachable)
+  (func $main (param $x i32) (result i32)
+    local.get 0
+    call 1
+    i32.const 0
+    call_indirect 0 (type 1))
+  (export "main" (func 5))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;6;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
@@ -0,0 +1,106 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  ;; the same block repeated, so most counters charge the same weights
+  (func $main (param $x i32) (result i32)
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    local.get $x
+  )
+
+  (export "main" (func $main))
+)
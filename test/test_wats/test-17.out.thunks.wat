@@ -0,0 +1,134 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $main (param $x i32) (result i32)
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      call 3
+    end
+    local.get 0)
+  (export "main" (func 1))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;2;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end)
+  (type (;2;) (func))
+  (func (;3;)
+    i64.const 1
+    call 2))
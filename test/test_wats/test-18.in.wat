@@ -0,0 +1,63 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  ;; the code after each `block` and after the `loop` always runs once
+  ;; whenever the code before it does
+  (func $main (param $x i32) (result i32)
+    local.get $x
+    i32.const 2
+    i32.mul
+    local.set $x
+    block
+      local.get $x
+      br_if 0
+      local.get $x
+      i32.const 1
+      i32.add
+      local.set $x
+    end
+    local.get $x
+    i32.const 3
+    i32.mul
+    local.set $x
+    loop
+      local.get $x
+      i32.const 1
+      i32.sub
+      local.tee $x
+      br_if 0
+    end
+    local.get $x
+    i32.const 5
+    i32.add
+  )
+
+  ;; the code after the inner `block` is skipped when `br_if $out` is taken,
+  ;; so it's not merged with the code before the inner `block`
+  (func $skip (param $x i32) (result i32)
+    local.get $x
+    i32.const 2
+    i32.mul
+    local.set $x
+    block $out
+      block
+        local.get $x
+        br_if $out
+        local.get $x
+        i32.const 1
+        i32.add
+        local.set $x
+      end
+      local.get $x
+      i32.const 3
+      i32.mul
+      local.set $x
+    end
+    local.get $x
+    i32.const 5
+    i32.add
+  )
+
+  (export "main" (func $main))
+  (export "skip" (func $skip))
+)
@@ -0,0 +1,80 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (func $main (param $x i32) (result i32)
+    local.get 0
+    i32.const 2
+    i32.mul
+    local.set 0
+    i64.const 3
+    call 3
+    block  ;; label = @1
+      local.get 0
+      br_if 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      local.set 0
+      i64.const 1
+      call 3
+    end
+    local.get 0
+    i32.const 3
+    i32.mul
+    local.set 0
+    loop  ;; label = @1
+      local.get 0
+      i32.const 1
+      i32.sub
+      local.tee 0
+      i64.const 1
+      call 3
+      br_if 0 (;@1;)
+    end
+    local.get 0
+    i32.const 5
+    i32.add)
+  (func $skip (param $x i32) (result i32)
+    local.get 0
+    i32.const 2
+    i32.mul
+    local.set 0
+    i64.const 2
+    call 3
+    block $out
+      block  ;; label = @2
+        local.get 0
+        br_if 1 (;@1;)
+        local.get 0
+        i32.const 1
+        i32.add
+        local.set 0
+        i64.const 2
+        call 3
+      end
+      local.get 0
+      i32.const 3
+      i32.mul
+      local.set 0
+    end
+    local.get 0
+    i32.const 5
+    i32.add)
+  (export "main" (func 1))
+  (export "skip" (func 2))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i32) (result i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;3;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
@@ -0,0 +1,30 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (memory i64 1)
+
+  (data $seg "0123456789abcdef")
+
+  (func $mem64_func (param $dst i64) (param $len i64) (param $segLen i32)
+    ;; sizes of memory64 instructions are i64
+    local.get $dst
+    i32.const 0
+    local.get $len
+    memory.fill
+    local.get $dst
+    i64.const 0
+    local.get $len
+    memory.copy
+    ;; the length of memory.init is an offset into the segment, so it's
+    ;; always i32
+    local.get $dst
+    i32.const 0
+    local.get $segLen
+    memory.init $seg
+    i64.const 1
+    memory.grow
+    drop
+  )
+
+  (export "mem64_func" (func $mem64_func))
+)
@@ -0,0 +1,66 @@
+(module
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (memory (;0;) i64 1)
+  (data $seg "0123456789abcdef")
+  (func $mem64_func (param $dst i64) (param $len i64) (param $segLen i32)
+    (local i64 i32)
+    local.get 0
+    i32.const 0
+    local.get 1
+    local.tee 3
+    local.get 3
+    i64.const 3
+    i64.shr_u
+    i64.const 1
+    i64.mul
+    call 2
+    memory.fill
+    local.get 0
+    i64.const 0
+    local.get 1
+    local.tee 3
+    local.get 3
+    i64.const 3
+    i64.shr_u
+    i64.const 1
+    i64.mul
+    call 2
+    memory.copy
+    local.get 0
+    i32.const 0
+    local.get 2
+    local.tee 4
+    local.get 4
+    i64.extend_i32_u
+    i64.const 3
+    i64.shr_u
+    i64.const 1
+    i64.mul
+    call 2
+    memory.init 0
+    i64.const 1
+    local.tee 3
+    local.get 3
+    i64.const 8192
+    i64.mul
+    call 2
+    memory.grow
+    drop)
+  (export "mem64_func" (func 1))
+  (type (;0;) (func (param i64)))
+  (type (;1;) (func (param i64 i64 i32)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;2;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 0
+    end))
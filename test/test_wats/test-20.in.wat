@@ -0,0 +1,63 @@
+(module
+  (import "env" "decent_wasm_test_log" (func $log (param i32)))
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+
+  (tag $err (param i32))
+
+  (func $try_catch (param $v i32)
+    try
+      local.get $v
+      i32.const 1
+      i32.add ;; w = 1
+      ;; may throw, so the block ends here and flows to the handlers
+      call $log ;; w = 10
+      local.get $v
+      throw $err
+    catch $err
+      i32.const 1
+      i32.add ;; w = 1
+      call $log ;; w = 10
+    catch_all
+      local.get $v
+      call $log ;; w = 10
+    end
+    local.get $v
+    i32.const 1
+    i32.add ;; w = 1
+    drop
+  )
+
+  (func $try_delegate (param $v i32)
+    try $outer
+      try
+        ;; exceptions go to the handler of $outer
+        local.get $v
+        call $log ;; w = 10
+      delegate $outer
+      local.get $v
+      i32.const 1
+      i32.add ;; w = 1
+      drop
+    catch_all
+      local.get $v
+      call $log ;; w = 10
+    end
+  )
+
+  (func $tail_call (param $v i32)
+    local.get $v
+    i32.const 1
+    i32.add ;; w = 1
+    ;; ends the function like return
+    return_call $sink
+  )
+
+  (func $sink (param $v i32)
+    local.get $v
+    call $log ;; w = 10
+  )
+
+  (export "try_catch" (func $try_catch))
+  (export "try_delegate" (func $try_delegate))
+  (export "tail_call" (func $tail_call))
+)
@@ -0,0 +1,84 @@
+(module
+  (import "env" "decent_wasm_test_log" (func $log (param i32)))
+  (import "env" "decent_wasm_counter_exceed" (func $ctr_exceed (param i64)))
+  (tag $err (param i32))
+  (func $try_catch (param $v i32)
+    try  ;; label = @1
+      local.get 0
+      i32.const 1
+      i32.add
+      i64.const 11
+      call 6
+      call 0
+      local.get 0
+      throw 0
+    catch 0
+      i32.const 1
+      i32.add
+      call 0
+      i64.const 11
+      call 6
+    catch_all
+      local.get 0
+      call 0
+      i64.const 10
+      call 6
+    end
+    local.get 0
+    i32.const 1
+    i32.add
+    drop
+    i64.const 1
+    call 6)
+  (func $try_delegate (param $v i32)
+    try $outer
+      try  ;; label = @2
+        local.get 0
+        i64.const 10
+        call 6
+        call 0
+      delegate 0 (;@1;)
+      local.get 0
+      i32.const 1
+      i32.add
+      drop
+      i64.const 1
+      call 6
+    catch_all
+      local.get 0
+      call 0
+      i64.const 10
+      call 6
+    end)
+  (func $tail_call (param $v i32)
+    local.get 0
+    i32.const 1
+    i32.add
+    i64.const 1
+    call 6
+    return_call 5)
+  (func $sink (param $v i32)
+    local.get 0
+    call 0
+    i64.const 10
+    call 6)
+  (export "try_catch" (func 2))
+  (export "try_delegate" (func 3))
+  (export "tail_call" (func 4))
+  (type (;0;) (func (param i32)))
+  (type (;1;) (func (param i64)))
+  (global (;0;) (mut i64) (i64.const 0))
+  (global (;1;) (mut i64) (i64.const 0))
+  (func (;6;) (param i64)
+    local.get 0
+    global.get 1
+    i64.add
+    global.set 1
+    block  ;; label = @1
+      global.get 1
+      global.get 0
+      i64.le_u
+      br_if 0 (;@1;)
+      global.get 1
+      call 1
+    end))
@@ -0,0 +1,98 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include <atomic>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#else
+#	include <unistd.h>
+#endif
+
+namespace DecentWasmCounterTool
+{
+
+inline std::string GetTempFileSuffix()
+{
+	static std::atomic<uint64_t> s_counter(0);
+
+	uint64_t pid =
+#ifdef _WIN32
+		static_cast<uint64_t>(GetCurrentProcessId());
+#else
+		static_cast<uint64_t>(getpid());
+#endif
+
+	return ".tmp." + std::to_string(pid) + "." +
+		std::to_string(s_counter.fetch_add(1));
+}
+
+/**
+ * @brief Write the content to a temporary file next to the destination,
+ *        and then rename it to the destination, so readers never see a
+ *        partially written file
+*/
+inline void WriteFileAtomic(
+	const std::filesystem::path& path,
+	const void* data,
+	size_t size)
+{
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path());
+	}
+
+	std::filesystem::path tmpPath = path;
+	tmpPath += GetTempFileSuffix();
+
+	FILE* file = fopen(tmpPath.string().c_str(), "wb");
+	if (file == nullptr)
+	{
+		throw std::runtime_error(
+			"Failed to open file " + tmpPath.string() + " for writing");
+	}
+
+	size_t writeSize = (size > 0) ? fwrite(data, 1, size, file) : 0;
+	bool isFlushed = (fflush(file) == 0);
+#ifndef _WIN32
+	isFlushed = isFlushed && (fsync(fileno(file)) == 0);
+#endif
+	fclose(file);
+
+	if ((writeSize < size) || !isFlushed)
+	{
+		std::remove(tmpPath.string().c_str());
+		throw std::runtime_error(
+			"Failed to write file " + tmpPath.string());
+	}
+
+#ifdef _WIN32
+	bool isRenamed = MoveFileExA(tmpPath.string().c_str(),
+		path.string().c_str(),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool isRenamed =
+		(std::rename(tmpPath.string().c_str(), path.string().c_str()) == 0);
+#endif
+	if (!isRenamed)
+	{
+		std::remove(tmpPath.string().c_str());
+		throw std::runtime_error(
+			"Failed to rename " + tmpPath.string() + " to " + path.string());
+	}
+}
+
+} // namespace DecentWasmCounterTool
@@ -0,0 +1,165 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace DecentWasmCounterTool
+{
+
+/**
+ * @brief A read-only memory mapping of a whole file
+*/
+class MappedFile
+{
+public:
+
+	explicit MappedFile(const std::string& path) :
+#ifdef _WIN32
+		m_file(INVALID_HANDLE_VALUE),
+		m_mapping(nullptr),
+#endif
+		m_data(nullptr),
+		m_size(0)
+	{
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("Failed to open file " + path);
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+		{
+			Close();
+			throw std::runtime_error("Failed to get the size of file " + path);
+		}
+		m_size = static_cast<size_t>(size.QuadPart);
+
+		if (m_size > 0)
+		{
+			m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY,
+				0, 0, nullptr);
+			if (m_mapping == nullptr)
+			{
+				Close();
+				throw std::runtime_error("Failed to map file " + path);
+			}
+
+			m_data = static_cast<const uint8_t*>(
+				MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+			if (m_data == nullptr)
+			{
+				Close();
+				throw std::runtime_error("Failed to map file " + path);
+			}
+		}
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			throw std::runtime_error("Failed to open file " + path);
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			throw std::runtime_error("Failed to get the size of file " + path);
+		}
+		m_size = static_cast<size_t>(st.st_size);
+
+		if (m_size > 0)
+		{
+			void* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr == MAP_FAILED)
+			{
+				close(fd);
+				throw std::runtime_error("Failed to map file " + path);
+			}
+			m_data = static_cast<const uint8_t*>(ptr);
+		}
+
+		// the mapping stays valid after the descriptor is closed
+		close(fd);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	virtual ~MappedFile()
+	{
+		Close();
+	}
+
+	const uint8_t* GetData() const
+	{
+		return m_data;
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+private:
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_data != nullptr)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping != nullptr)
+		{
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_file);
+		}
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data != nullptr)
+		{
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+		}
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+	const uint8_t* m_data;
+	size_t m_size;
+}; // class MappedFile
+
+} // namespace DecentWasmCounterTool
@@ -0,0 +1,33 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include <stdexcept>
+#include <vector>
+
+#include <src/binary-writer.h>
+#include <src/ir.h>
+#include <src/result.h>
+#include <src/stream.h>
+
+namespace DecentWasmCounterTool
+{
+
+inline std::vector<uint8_t> WriteWasmModule(const wabt::Module& mod)
+{
+	wabt::MemoryStream stream;
+	wabt::WriteBinaryOptions options;
+	wabt::Result result = wabt::WriteBinaryModule(&stream, &mod, options);
+	if (!wabt::Succeeded(result))
+	{
+		throw std::runtime_error("Failed to write the module");
+	}
+	return std::move(stream.output_buffer().data);
+}
+
+} // namespace DecentWasmCounterTool
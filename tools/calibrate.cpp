@@ -0,0 +1,461 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <DecentWasmWat/WasmWat.h>
+
+#include <DecentWasmCounter/CostTable.hpp>
+
+#include <src/error.h>
+#include <src/feature.h>
+#include <src/interp/binary-reader-interp.h>
+#include <src/interp/interp.h>
+#include <src/result.h>
+
+#include "AtomicFile.hpp"
+#include "WasmBinary.hpp"
+
+namespace DecentWasmCounterTool
+{
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief An instruction to be measured; its operands are read from locals,
+ *        and its result (if any) is written to a local, so the stack is
+ *        balanced after each instance
+*/
+struct OpSpec
+{
+	// Instruction text, e.g., "i32.add" or "call $nop"
+	std::string m_instr;
+	// WABT expression type name, e.g., "Binary"
+	std::string m_exprType;
+	// Whether the weight can be set per opcode
+	// (see CostModel::m_opcodeWeights)
+	bool m_hasOpcode;
+	// Names of locals pushed as operands
+	std::vector<std::string> m_operands;
+	// Value type of the result, or empty if there is none
+	std::string m_result;
+}; // struct OpSpec
+
+inline const std::vector<OpSpec>& GetOpSpecs()
+{
+	static const std::vector<OpSpec> specs =
+	{
+		{ "i32.add",   "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.mul",   "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.div_u", "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.rem_u", "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.and",   "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.shl",   "Binary", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i64.add",   "Binary", true, { "$x_i64", "$y_i64" }, "i64" },
+		{ "i64.mul",   "Binary", true, { "$x_i64", "$y_i64" }, "i64" },
+		{ "i64.div_u", "Binary", true, { "$x_i64", "$y_i64" }, "i64" },
+		{ "f32.add",   "Binary", true, { "$x_f32", "$y_f32" }, "f32" },
+		{ "f32.mul",   "Binary", true, { "$x_f32", "$y_f32" }, "f32" },
+		{ "f32.div",   "Binary", true, { "$x_f32", "$y_f32" }, "f32" },
+		{ "f64.add",   "Binary", true, { "$x_f64", "$y_f64" }, "f64" },
+		{ "f64.mul",   "Binary", true, { "$x_f64", "$y_f64" }, "f64" },
+		{ "f64.div",   "Binary", true, { "$x_f64", "$y_f64" }, "f64" },
+
+		{ "i32.eq",    "Compare", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i32.lt_u",  "Compare", true, { "$x_i32", "$y_i32" }, "i32" },
+		{ "i64.lt_u",  "Compare", true, { "$x_i64", "$y_i64" }, "i32" },
+		{ "f64.lt",    "Compare", true, { "$x_f64", "$y_f64" }, "i32" },
+
+		{ "i32.clz",    "Unary", true, { "$x_i32" }, "i32" },
+		{ "i32.popcnt", "Unary", true, { "$x_i32" }, "i32" },
+		{ "i64.ctz",    "Unary", true, { "$x_i64" }, "i64" },
+		{ "f64.neg",    "Unary", true, { "$x_f64" }, "f64" },
+		{ "f64.sqrt",   "Unary", true, { "$x_f64" }, "f64" },
+
+		{ "i64.extend_i32_u",  "Convert", true, { "$x_i32" }, "i64" },
+		{ "i32.wrap_i64",      "Convert", true, { "$x_i64" }, "i32" },
+		{ "f64.convert_i32_s", "Convert", true, { "$x_i32" }, "f64" },
+
+		{ "i32.load",  "Load",  true, { "$addr" }, "i32" },
+		{ "i64.load",  "Load",  true, { "$addr" }, "i64" },
+		{ "i32.store", "Store", true, { "$addr", "$x_i32" }, "" },
+		{ "i64.store", "Store", true, { "$addr", "$x_i64" }, "" },
+
+		{ "global.get $g", "GlobalGet", false, { }, "i32" },
+		{ "global.set $g", "GlobalSet", false, { "$x_i32" }, "" },
+		{ "call $nop",     "Call",      false, { }, "" },
+	};
+	return specs;
+}
+
+/**
+ * @brief Generate a module exporting `run (param $n i32)`, which executes
+ *        the given instruction `unroll` times in each of the `$n` iterations
+ *        of a loop. In the baseline, the instruction is replaced by dropping
+ *        its operands and pushing a constant result, so the difference is
+ *        mostly the cost of the instruction itself.
+*/
+inline std::string GenerateMicroModule(
+	const OpSpec& spec,
+	size_t unroll,
+	bool isBaseline)
+{
+	std::string body;
+	for (const auto& operand : spec.m_operands)
+	{
+		body += "      local.get " + operand + "\n";
+	}
+	if (isBaseline)
+	{
+		for (size_t i = 0; i < spec.m_operands.size(); ++i)
+		{
+			body += "      drop\n";
+		}
+		if (!spec.m_result.empty())
+		{
+			body += "      " + spec.m_result + ".const 0\n";
+		}
+	}
+	else
+	{
+		body += "      " + spec.m_instr + "\n";
+	}
+	if (!spec.m_result.empty())
+	{
+		body += "      local.set $r_" + spec.m_result + "\n";
+	}
+
+	std::string wat =
+		"(module\n"
+		"  (memory 1)\n"
+		"  (global $g (mut i32) (i32.const 1))\n"
+		"  (func $nop)\n"
+		"  (func (export \"run\") (param $n i32)\n"
+		"    (local $i i32) (local $addr i32)\n"
+		"    (local $x_i32 i32) (local $y_i32 i32) (local $r_i32 i32)\n"
+		"    (local $x_i64 i64) (local $y_i64 i64) (local $r_i64 i64)\n"
+		"    (local $x_f32 f32) (local $y_f32 f32) (local $r_f32 f32)\n"
+		"    (local $x_f64 f64) (local $y_f64 f64) (local $r_f64 f64)\n"
+		"    i32.const 64       local.set $addr\n"
+		"    i32.const 1000003  local.set $x_i32\n"
+		"    i32.const 7        local.set $y_i32\n"
+		"    i64.const 1000003  local.set $x_i64\n"
+		"    i64.const 7        local.set $y_i64\n"
+		"    f32.const 1000.5   local.set $x_f32\n"
+		"    f32.const 3.25     local.set $y_f32\n"
+		"    f64.const 1000.5   local.set $x_f64\n"
+		"    f64.const 3.25     local.set $y_f64\n"
+		"    loop $l\n";
+	for (size_t i = 0; i < unroll; ++i)
+	{
+		wat += body;
+	}
+	wat +=
+		"      local.get $i\n"
+		"      i32.const 1\n"
+		"      i32.add\n"
+		"      local.tee $i\n"
+		"      local.get $n\n"
+		"      i32.lt_u\n"
+		"      br_if $l\n"
+		"    end\n"
+		"  )\n"
+		")\n";
+	return wat;
+}
+
+/**
+ * @brief Instantiate the module in the WABT interpreter, and return the
+ *        minimum wall time (in nanoseconds) of calling `run` with the given
+ *        number of iterations
+*/
+inline double MeasureModule(
+	const std::string& wat,
+	uint32_t numIters,
+	size_t numRepeats)
+{
+	auto mod = DecentWasmWat::Wat2Mod(
+		"calibrate.wat", wat, DecentWasmWat::Wat2WasmConfig());
+	std::vector<uint8_t> wasm = WriteWasmModule(*(mod.m_ptr));
+
+	wabt::Features features;
+	wabt::ReadBinaryOptions options(features, nullptr,
+		false, // read debug names
+		true,  // stop on first error
+		true   // fail on custom section error
+	);
+	wabt::Errors errors;
+	wabt::interp::ModuleDesc modDesc;
+	if (!wabt::Succeeded(wabt::interp::ReadBinaryInterp("calibrate.wasm",
+		wasm.data(), wasm.size(), options, &errors, &modDesc)))
+	{
+		throw std::runtime_error("Failed to load the micro module");
+	}
+
+	wabt::interp::Store store(features);
+	auto interpMod = wabt::interp::Module::New(store, modDesc);
+	wabt::interp::RefVec imports;
+	wabt::interp::Trap::Ptr trap;
+	auto instance = wabt::interp::Instance::Instantiate(
+		store, interpMod.ref(), imports, &trap);
+	if (!instance)
+	{
+		throw std::runtime_error("Failed to instantiate the micro module");
+	}
+
+	wabt::interp::Func::Ptr runFunc;
+	const auto& exports = interpMod->desc().exports;
+	for (size_t i = 0; i < exports.size(); ++i)
+	{
+		if (exports[i].type.name == "run")
+		{
+			runFunc = store.UnsafeGet<wabt::interp::Func>(
+				instance->exports()[i]);
+		}
+	}
+	if (!runFunc)
+	{
+		throw std::runtime_error("The micro module doesn't export run");
+	}
+
+	double minNs = std::numeric_limits<double>::max();
+	for (size_t i = 0; i < numRepeats; ++i)
+	{
+		wabt::interp::Values params = {
+			wabt::interp::Value::Make(numIters) };
+		wabt::interp::Values results;
+
+		auto start = Clock::now();
+		wabt::Result res = runFunc->Call(store, params, results, &trap);
+		auto end = Clock::now();
+
+		if (!wabt::Succeeded(res))
+		{
+			throw std::runtime_error("The micro module trapped");
+		}
+
+		minNs = std::min(minNs, static_cast<double>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				end - start).count()));
+	}
+	return minNs;
+}
+
+struct CalibrateConfig
+{
+	CalibrateConfig() :
+		m_output("-"),
+		m_numIters(100000),
+		m_unroll(16),
+		m_numRepeats(5),
+		m_reference("i32.add"),
+		m_scale(1.0)
+	{}
+
+	// "-" for stdout
+	std::string m_output;
+	uint32_t m_numIters;
+	size_t m_unroll;
+	size_t m_numRepeats;
+	// Instruction whose weight is `m_scale`
+	std::string m_reference;
+	double m_scale;
+}; // struct CalibrateConfig
+
+/**
+ * @brief Measure each instruction, and fit the weights relative to the
+ *        reference instruction; weights that are not measured (e.g.,
+ *        atomics, imports, runtime-proportional cost) are kept from the
+ *        default cost model
+*/
+inline DecentWasmCounter::CostModel Calibrate(const CalibrateConfig& config)
+{
+	const double numInstrs =
+		static_cast<double>(config.m_numIters) *
+		static_cast<double>(config.m_unroll);
+
+	// time per instruction, on top of the baseline
+	std::vector<double> opNs;
+	double refNs = 0.0;
+	for (const OpSpec& spec : GetOpSpecs())
+	{
+		double baseNs = MeasureModule(
+			GenerateMicroModule(spec, config.m_unroll, true),
+			config.m_numIters, config.m_numRepeats);
+		double ns = MeasureModule(
+			GenerateMicroModule(spec, config.m_unroll, false),
+			config.m_numIters, config.m_numRepeats);
+		double perInstr = std::max(0.0, (ns - baseNs) / numInstrs);
+		opNs.push_back(perInstr);
+
+		if (spec.m_instr == config.m_reference)
+		{
+			refNs = perInstr;
+		}
+
+		std::cerr << spec.m_instr << ": " << perInstr << " ns" << std::endl;
+	}
+	if (refNs <= 0.0)
+	{
+		throw std::runtime_error(
+			"The reference instruction " + config.m_reference +
+			" is not measured, or it's too fast to be measured");
+	}
+
+	std::vector<DecentWasmCounter::CostSample> samples;
+	const auto& specs = GetOpSpecs();
+	for (size_t i = 0; i < specs.size(); ++i)
+	{
+		samples.push_back(DecentWasmCounter::CostSample{
+			specs[i].m_instr, specs[i].m_exprType, specs[i].m_hasOpcode,
+			opNs[i] / refNs * config.m_scale });
+	}
+
+	return DecentWasmCounter::FitCostModel(samples,
+		DecentWasmCounter::GetDefaultCostModel());
+}
+
+inline void PrintUsage(const char* prog)
+{
+	std::cerr <<
+		"Usage: " << prog << " [options]\n"
+		"\n"
+		"Time each instruction class in the WABT interpreter on this\n"
+		"machine, and write a cost table that can be loaded with\n"
+		"`decent-wasm-counter --cost-table`.\n"
+		"\n"
+		"Options:\n"
+		"  -o, --output <file|->       Output cost table (default: stdout)\n"
+		"  --iterations <N>            Loop iterations per measurement\n"
+		"                              (default: 100000)\n"
+		"  --unroll <N>                Instructions per loop iteration\n"
+		"                              (default: 16)\n"
+		"  --repeat <N>                Measurements per module; the fastest\n"
+		"                              one is used (default: 5)\n"
+		"  --reference <instr>         Instruction whose weight is the scale\n"
+		"                              (default: i32.add)\n"
+		"  --scale <X>                 Weight of the reference instruction\n"
+		"                              (default: 1)\n"
+		"  -h, --help                  Show this message\n";
+}
+
+inline CalibrateConfig ParseArgs(int argc, char** argv)
+{
+	CalibrateConfig config;
+
+	auto getValue = [&](int& i) -> std::string
+	{
+		if (i + 1 >= argc)
+		{
+			throw std::invalid_argument(
+				std::string("Missing value for ") + argv[i]);
+		}
+		return argv[++i];
+	};
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-o" || arg == "--output")
+		{
+			config.m_output = getValue(i);
+		}
+		else if (arg == "--iterations")
+		{
+			config.m_numIters = static_cast<uint32_t>(std::stoul(getValue(i)));
+		}
+		else if (arg == "--unroll")
+		{
+			config.m_unroll = std::stoul(getValue(i));
+		}
+		else if (arg == "--repeat")
+		{
+			config.m_numRepeats = std::stoul(getValue(i));
+		}
+		else if (arg == "--reference")
+		{
+			config.m_reference = getValue(i);
+		}
+		else if (arg == "--scale")
+		{
+			config.m_scale = std::stod(getValue(i));
+		}
+		else if (arg == "-h" || arg == "--help")
+		{
+			PrintUsage(argv[0]);
+			std::exit(0);
+		}
+		else
+		{
+			throw std::invalid_argument("Unknown option " + arg);
+		}
+	}
+
+	if ((config.m_numIters == 0) ||
+		(config.m_unroll == 0) ||
+		(config.m_numRepeats == 0) ||
+		!(config.m_scale > 0.0))
+	{
+		throw std::invalid_argument(
+			"Iterations, unroll, repeat, and scale must be > 0");
+	}
+
+	return config;
+}
+
+} // namespace DecentWasmCounterTool
+
+int main(int argc, char** argv)
+{
+	using namespace DecentWasmCounterTool;
+
+	CalibrateConfig config;
+	try
+	{
+		config = ParseArgs(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n\n";
+		PrintUsage(argv[0]);
+		return 2;
+	}
+
+	try
+	{
+		std::string table =
+			"# Generated by decent-wasm-calibrate; reference " +
+			config.m_reference + " = " + std::to_string(config.m_scale) +
+			"\n" +
+			DecentWasmCounter::WriteCostTable(Calibrate(config));
+
+		if (config.m_output == "-")
+		{
+			std::cout << table;
+		}
+		else
+		{
+			WriteFileAtomic(config.m_output, table.data(), table.size());
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
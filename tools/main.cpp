@@ -0,0 +1,701 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <DecentWasmCounter/CostTable.hpp>
+#include <DecentWasmCounter/DecentWasmCounter.hpp>
+
+#include <src/binary-reader.h>
+#include <src/binary-reader-ir.h>
+#include <src/error.h>
+#include <src/feature.h>
+#include <src/ir.h>
+#include <src/result.h>
+#include <src/wast-lexer.h>
+#include <src/wast-parser.h>
+
+#include "../src/WorkerPool.hpp"
+
+#include "AtomicFile.hpp"
+#include "MappedFile.hpp"
+#include "WasmBinary.hpp"
+
+namespace fs = std::filesystem;
+
+namespace DecentWasmCounterTool
+{
+
+using Clock = std::chrono::steady_clock;
+
+enum class ModFormat
+{
+	Wasm,
+	Wat,
+}; // enum class ModFormat
+
+struct ToolConfig
+{
+	ToolConfig() :
+		m_inputs(),
+		m_output(),
+		m_numJobs(std::max(1U, std::thread::hardware_concurrency())),
+		m_hasOutFormat(false),
+		m_outFormat(ModFormat::Wasm),
+		m_timingPath(),
+		m_instrConfig()
+	{}
+
+	std::vector<fs::path> m_inputs;
+	fs::path m_output;
+	size_t m_numJobs;
+	bool m_hasOutFormat;
+	ModFormat m_outFormat;
+	// empty if timing is not needed; "-" for stdout
+	std::string m_timingPath;
+	DecentWasmCounter::InstrumentConfig m_instrConfig;
+}; // struct ToolConfig
+
+struct Job
+{
+	fs::path m_input;
+	fs::path m_output;
+	ModFormat m_inFormat;
+	ModFormat m_outFormat;
+}; // struct Job
+
+struct JobResult
+{
+	JobResult() :
+		m_isSucceeded(false),
+		m_errMsg(),
+		m_inSize(0),
+		m_outSize(0),
+		m_readNs(0),
+		m_parseNs(0),
+		m_instrumentNs(0),
+		m_writeNs(0),
+		m_stats()
+	{}
+
+	bool m_isSucceeded;
+	std::string m_errMsg;
+	uint64_t m_inSize;
+	uint64_t m_outSize;
+	uint64_t m_readNs;
+	uint64_t m_parseNs;
+	uint64_t m_instrumentNs;
+	uint64_t m_writeNs;
+	DecentWasmCounter::ModuleStatistics m_stats;
+}; // struct JobResult
+
+inline uint64_t GetElapsedNs(Clock::time_point start)
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			Clock::now() - start).count());
+}
+
+inline bool GetFormatByExt(const fs::path& path, ModFormat& format)
+{
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(),
+		[](char c)
+		{
+			return static_cast<char>(
+				std::tolower(static_cast<unsigned char>(c)));
+		});
+	if (ext == ".wasm")
+	{
+		format = ModFormat::Wasm;
+		return true;
+	}
+	else if (ext == ".wat")
+	{
+		format = ModFormat::Wat;
+		return true;
+	}
+	return false;
+}
+
+inline fs::path ReplaceFormatExt(fs::path path, ModFormat format)
+{
+	path.replace_extension(format == ModFormat::Wasm ? ".wasm" : ".wat");
+	return path;
+}
+
+inline std::vector<Job> CollectJobs(const ToolConfig& config)
+{
+	std::vector<Job> jobs;
+
+	// the output is a directory if there are more than one inputs,
+	// or any of the input is a directory
+	bool isOutDir = (config.m_inputs.size() > 1);
+	for (const auto& input : config.m_inputs)
+	{
+		isOutDir = isOutDir || fs::is_directory(input);
+	}
+
+	auto addJob = [&](const fs::path& input, const fs::path& relPath)
+	{
+		Job job;
+		job.m_input = input;
+		if (!GetFormatByExt(input, job.m_inFormat))
+		{
+			throw std::runtime_error(
+				"Unknown input format of file " + input.string());
+		}
+		job.m_outFormat = config.m_hasOutFormat ?
+			config.m_outFormat : job.m_inFormat;
+
+		job.m_output = isOutDir ?
+			ReplaceFormatExt(config.m_output / relPath, job.m_outFormat) :
+			config.m_output;
+
+		jobs.emplace_back(std::move(job));
+	};
+
+	for (const auto& input : config.m_inputs)
+	{
+		if (fs::is_directory(input))
+		{
+			std::vector<fs::path> files;
+			for (const auto& entry : fs::recursive_directory_iterator(input))
+			{
+				ModFormat format;
+				if (entry.is_regular_file() &&
+					GetFormatByExt(entry.path(), format))
+				{
+					files.push_back(entry.path());
+				}
+			}
+			// deterministic order
+			std::sort(files.begin(), files.end());
+			for (const auto& file : files)
+			{
+				addJob(file, fs::relative(file, input));
+			}
+		}
+		else
+		{
+			addJob(input, input.filename());
+		}
+	}
+
+	return jobs;
+}
+
+/**
+ * @brief Features of the input modules, i.e., the ones the library can
+ *        instrument; the same for both `.wasm` and `.wat` inputs
+*/
+inline wabt::Features GetInputFeatures()
+{
+	wabt::Features features;
+	features.enable_tail_call();
+	features.enable_exceptions();
+	features.enable_threads();
+	features.enable_memory64();
+	return features;
+}
+
+inline std::string ErrorsToString(const wabt::Errors& errors)
+{
+	std::string errMsg;
+	for (const auto& err : errors)
+	{
+		errMsg += (err.message + '\n');
+	}
+	return errMsg;
+}
+
+inline std::unique_ptr<wabt::Module> ReadWasmModule(
+	const std::string& filename,
+	const MappedFile& file)
+{
+	wabt::Features features = GetInputFeatures();
+	wabt::ReadBinaryOptions options(features, nullptr,
+		true, // read debug names
+		true, // stop on first error
+		false // custom sections are kept as they are
+	);
+	wabt::Errors errors;
+	std::unique_ptr<wabt::Module> mod(new wabt::Module());
+
+	wabt::Result result = wabt::ReadBinaryIr(filename.c_str(),
+		file.GetData(), file.GetSize(), options, &errors, mod.get());
+	if (!wabt::Succeeded(result))
+	{
+		throw std::runtime_error("Failed to read the module:\n" +
+			ErrorsToString(errors));
+	}
+
+	return mod;
+}
+
+inline std::unique_ptr<wabt::Module> ReadWatModule(
+	const std::string& filename,
+	const MappedFile& file)
+{
+	auto lexer = wabt::WastLexer::CreateBufferLexer(
+		filename, file.GetData(), file.GetSize());
+
+	wabt::WastParseOptions options(GetInputFeatures());
+	wabt::Errors errors;
+	std::unique_ptr<wabt::Module> mod;
+	wabt::Result result =
+		wabt::ParseWatModule(lexer.get(), &mod, &errors, &options);
+	if (!wabt::Succeeded(result))
+	{
+		throw std::runtime_error("Failed to parse the module:\n" +
+			ErrorsToString(errors));
+	}
+
+	return mod;
+}
+
+/**
+ * @param instrumenter Shared by all jobs, since they have the same
+ *                     configuration
+*/
+inline JobResult ProcessJob(
+	const Job& job,
+	const DecentWasmCounter::Instrumenter& instrumenter)
+{
+	JobResult res;
+	try
+	{
+		auto start = Clock::now();
+		MappedFile file(job.m_input.string());
+		res.m_inSize = file.GetSize();
+		res.m_readNs = GetElapsedNs(start);
+
+		// # parse
+		start = Clock::now();
+		std::unique_ptr<wabt::Module> mod =
+			(job.m_inFormat == ModFormat::Wasm) ?
+				ReadWasmModule(job.m_input.string(), file) :
+				ReadWatModule(job.m_input.string(), file);
+		res.m_parseNs = GetElapsedNs(start);
+
+		// # instrument
+		start = Clock::now();
+		instrumenter.Instrument(*mod, res.m_stats);
+		res.m_instrumentNs = GetElapsedNs(start);
+
+		// # write
+		start = Clock::now();
+		if (job.m_outFormat == ModFormat::Wasm)
+		{
+			std::vector<uint8_t> out = WriteWasmModule(*mod);
+			WriteFileAtomic(job.m_output, out.data(), out.size());
+			res.m_outSize = out.size();
+		}
+		else
+		{
+			std::string out =
+				DecentWasmWat::Mod2Wat(*mod, DecentWasmWat::Wasm2WatConfig());
+			WriteFileAtomic(job.m_output, out.data(), out.size());
+			res.m_outSize = out.size();
+		}
+		res.m_writeNs = GetElapsedNs(start);
+
+		res.m_isSucceeded = true;
+	}
+	catch (const std::exception& e)
+	{
+		res.m_errMsg = e.what();
+	}
+	return res;
+}
+
+inline std::string EscapeJsonStr(const std::string& str)
+{
+	static const char sk_hex[] = "0123456789abcdef";
+
+	std::string res;
+	res.reserve(str.size() + 2);
+	res.push_back('"');
+	for (char c : str)
+	{
+		switch (c)
+		{
+		case '"':  res += "\\\""; break;
+		case '\\': res += "\\\\"; break;
+		case '\n': res += "\\n";  break;
+		case '\r': res += "\\r";  break;
+		case '\t': res += "\\t";  break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+			{
+				res += "\\u00";
+				res.push_back(sk_hex[(c >> 4) & 0x0F]);
+				res.push_back(sk_hex[c & 0x0F]);
+			}
+			else
+			{
+				res.push_back(c);
+			}
+			break;
+		}
+	}
+	res.push_back('"');
+	return res;
+}
+
+inline std::string JobResultToJsonLine(const Job& job, const JobResult& res)
+{
+	std::string line = "{";
+	line += "\"input\":" + EscapeJsonStr(job.m_input.string());
+	line += ",\"output\":" + EscapeJsonStr(job.m_output.string());
+	line += ",\"status\":";
+	line += res.m_isSucceeded ? "\"ok\"" : "\"error\"";
+	if (!res.m_isSucceeded)
+	{
+		line += ",\"error\":" + EscapeJsonStr(res.m_errMsg);
+	}
+	line += ",\"in_bytes\":" + std::to_string(res.m_inSize);
+	line += ",\"out_bytes\":" + std::to_string(res.m_outSize);
+	line += ",\"read_ns\":" + std::to_string(res.m_readNs);
+	line += ",\"parse_ns\":" + std::to_string(res.m_parseNs);
+	line += ",\"instrument_ns\":" + std::to_string(res.m_instrumentNs);
+	line += ",\"write_ns\":" + std::to_string(res.m_writeNs);
+	line += ",\"counters\":" +
+		std::to_string(res.m_stats.m_numCountersInjected);
+	line += ",\"bytes_added\":" +
+		std::to_string(res.m_stats.m_numBytesAdded);
+	line += ",\"passes\":[";
+	for (size_t i = 0; i < res.m_stats.m_passes.size(); ++i)
+	{
+		const auto& pass = res.m_stats.m_passes[i];
+		line += (i == 0) ? "{" : ",{";
+		line += "\"name\":" + EscapeJsonStr(pass.m_name);
+		line += ",\"ns\":" + std::to_string(pass.m_wallTimeNs);
+		line += "}";
+	}
+	line += "]}";
+	return line;
+}
+
+inline void PrintUsage(const char* prog)
+{
+	std::cerr <<
+		"Usage: " << prog << " [options] <input>...\n"
+		"\n"
+		"Instrument WebAssembly modules with instruction counters.\n"
+		"Each input can be a .wasm file, a .wat file, or a directory that\n"
+		"is searched recursively for them.\n"
+		"\n"
+		"Options:\n"
+		"  -o, --output <path>         Output file for a single input file, or\n"
+		"                              output directory otherwise (required)\n"
+		"  -j, --jobs <N>              Number of modules instrumented\n"
+		"                              concurrently (default: number of\n"
+		"                              hardware threads)\n"
+		"  --format <wasm|wat>         Output format (default: same as input)\n"
+		"  --timing <file|->           Write per-module timing as JSON lines\n"
+		"  --cost-table <file>         Load the cost model from a cost table;\n"
+		"                              repeat it for more cost dimensions\n"
+		"  --elide-leaf-funcs          Charge leaf functions at call sites\n"
+		"  --merge-blocks              Share one counter among the blocks that\n"
+		"                              always run together\n"
+		"  --prune-unreachable         Remove code that can never be executed\n"
+		"  --unreachable-funcs <skip|stub>\n"
+		"                              Don't instrument the functions that\n"
+		"                              can't be reached from any export, or\n"
+		"                              replace them with `unreachable`\n"
+		"  --incr-thunks <N>           Share the counters of the N most\n"
+		"                              frequent weights through thunks, to\n"
+		"                              shrink the output\n"
+		"  --emit-reprice-info         Record what each counter charges, so\n"
+		"                              the output can be repriced later\n"
+		"  --block-table-only          Leave the code untouched, and only\n"
+		"                              emit the block weights for engines\n"
+		"                              that meter natively\n"
+		"  --trap-on-exceed            Trap in the guest when the threshold is\n"
+		"                              exceeded, instead of calling the host\n"
+		"  --flush-interval <N>        Enable the budget shared by all\n"
+		"                              instances, flushing every N units;\n"
+		"                              the module must also import\n"
+		"                              decent_wasm_counter_aggregate_exceed,\n"
+		"                              unless --trap-on-exceed is given\n"
+		"  --aggregate-slot <addr>     Address of the shared budget slots in\n"
+		"                              memory 0 (default: 0)\n"
+		"  --trusted-func <name>:<W>   Don't instrument the function, and\n"
+		"                              charge it W units per call instead\n"
+		"  --export-counter <name>     Export the counter global\n"
+		"  --export-threshold <name>   Export the threshold global\n"
+		"  --entry <name>              Wrap the exported entry function with\n"
+		"                              decent_entry_function, which sets the\n"
+		"                              threshold before calling it\n"
+		"  -h, --help                  Show this message\n";
+}
+
+inline ToolConfig ParseArgs(int argc, char** argv)
+{
+	ToolConfig config;
+	bool hasCostTable = false;
+
+	auto getValue = [&](int& i) -> std::string
+	{
+		if (i + 1 >= argc)
+		{
+			throw std::invalid_argument(
+				std::string("Missing value for ") + argv[i]);
+		}
+		return argv[++i];
+	};
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-o" || arg == "--output")
+		{
+			config.m_output = getValue(i);
+		}
+		else if (arg == "-j" || arg == "--jobs")
+		{
+			config.m_numJobs = std::stoul(getValue(i));
+			if (config.m_numJobs == 0)
+			{
+				throw std::invalid_argument("Number of jobs must be > 0");
+			}
+		}
+		else if (arg == "--format")
+		{
+			std::string format = getValue(i);
+			config.m_hasOutFormat = true;
+			if (format == "wasm")
+			{
+				config.m_outFormat = ModFormat::Wasm;
+			}
+			else if (format == "wat")
+			{
+				config.m_outFormat = ModFormat::Wat;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown format " + format);
+			}
+		}
+		else if (arg == "--timing")
+		{
+			config.m_timingPath = getValue(i);
+		}
+		else if (arg == "--cost-table")
+		{
+			std::string path = getValue(i);
+			MappedFile file(path);
+			std::string text(
+				reinterpret_cast<const char*>(file.GetData()), file.GetSize());
+
+			// the first table replaces the default cost model
+			if (!hasCostTable)
+			{
+				config.m_instrConfig.m_costModels.clear();
+				hasCostTable = true;
+			}
+			config.m_instrConfig.m_costModels.push_back(
+				DecentWasmCounter::ParseCostTable(text));
+		}
+		else if (arg == "--elide-leaf-funcs")
+		{
+			config.m_instrConfig.m_elideLeafFuncCounters = true;
+		}
+		else if (arg == "--merge-blocks")
+		{
+			config.m_instrConfig.m_mergeEquivalentBlocks = true;
+		}
+		else if (arg == "--prune-unreachable")
+		{
+			config.m_instrConfig.m_pruneUnreachableCode = true;
+		}
+		else if (arg == "--unreachable-funcs")
+		{
+			std::string policy = getValue(i);
+			if (policy == "skip")
+			{
+				config.m_instrConfig.m_unreachableFuncPolicy =
+					DecentWasmCounter::UnreachableFuncPolicy::Skip;
+			}
+			else if (policy == "stub")
+			{
+				config.m_instrConfig.m_unreachableFuncPolicy =
+					DecentWasmCounter::UnreachableFuncPolicy::Stub;
+			}
+			else
+			{
+				throw std::invalid_argument(
+					"Unknown unreachable function policy " + policy);
+			}
+		}
+		else if (arg == "--incr-thunks")
+		{
+			config.m_instrConfig.m_maxIncrThunks =
+				static_cast<uint32_t>(std::stoul(getValue(i)));
+		}
+		else if (arg == "--emit-reprice-info")
+		{
+			config.m_instrConfig.m_emitRepricingInfo = true;
+		}
+		else if (arg == "--block-table-only")
+		{
+			config.m_instrConfig.m_emitBlockTableOnly = true;
+		}
+		else if (arg == "--trap-on-exceed")
+		{
+			config.m_instrConfig.m_exceedPolicy =
+				DecentWasmCounter::ExceedPolicy::Trap;
+		}
+		else if (arg == "--flush-interval")
+		{
+			config.m_instrConfig.m_aggregateBudget.m_flushInterval =
+				std::stoull(getValue(i));
+		}
+		else if (arg == "--aggregate-slot")
+		{
+			config.m_instrConfig.m_aggregateBudget.m_slotOffset =
+				std::stoull(getValue(i));
+		}
+		else if (arg == "--trusted-func")
+		{
+			std::string value = getValue(i);
+			auto sepPos = value.rfind(':');
+			if ((sepPos == std::string::npos) || (sepPos == 0))
+			{
+				throw std::invalid_argument(
+					"Invalid value for --trusted-func: " + value);
+			}
+			DecentWasmCounter::TrustedFuncCost cost;
+			cost.m_weights.push_back(std::stoull(value.substr(sepPos + 1)));
+			config.m_instrConfig.m_trustedFuncs[value.substr(0, sepPos)] =
+				cost;
+		}
+		else if (arg == "--export-counter")
+		{
+			config.m_instrConfig.m_counterExportName = getValue(i);
+		}
+		else if (arg == "--export-threshold")
+		{
+			config.m_instrConfig.m_thresholdExportName = getValue(i);
+		}
+		else if (arg == "--entry")
+		{
+			config.m_instrConfig.m_entryFuncName = getValue(i);
+		}
+		else if (arg == "-h" || arg == "--help")
+		{
+			PrintUsage(argv[0]);
+			std::exit(0);
+		}
+		else if ((arg.size() > 1) && (arg[0] == '-'))
+		{
+			throw std::invalid_argument("Unknown option " + arg);
+		}
+		else
+		{
+			config.m_inputs.emplace_back(arg);
+		}
+	}
+
+	if (config.m_inputs.empty())
+	{
+		throw std::invalid_argument("No input is given");
+	}
+	if (config.m_output.empty())
+	{
+		throw std::invalid_argument("No output is given");
+	}
+
+	return config;
+}
+
+} // namespace DecentWasmCounterTool
+
+int main(int argc, char** argv)
+{
+	using namespace DecentWasmCounterTool;
+
+	ToolConfig config;
+	std::vector<Job> jobs;
+	try
+	{
+		config = ParseArgs(argc, argv);
+		jobs = CollectJobs(config);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n\n";
+		PrintUsage(argv[0]);
+		return 2;
+	}
+
+	FILE* timingFile = nullptr;
+	if (config.m_timingPath == "-")
+	{
+		timingFile = stdout;
+	}
+	else if (!config.m_timingPath.empty())
+	{
+		timingFile = fopen(config.m_timingPath.c_str(), "w");
+		if (timingFile == nullptr)
+		{
+			std::cerr << "ERROR: Failed to open " << config.m_timingPath
+				<< std::endl;
+			return 2;
+		}
+	}
+
+	std::mutex outputMutex;
+	std::atomic<size_t> numFailed(0);
+	const DecentWasmCounter::Instrumenter instrumenter(config.m_instrConfig);
+
+	// the whole job (i.e., read, parse, instrument, and write) runs on the
+	// library's pool, so the modules don't have to be all in memory at once,
+	// as Instrumenter::InstrumentAll would need
+	DecentWasmCounter::RunOnWorkerPool(config.m_numJobs, jobs.size(),
+		[&](size_t i)
+		{
+			const Job& job = jobs[i];
+			JobResult res = ProcessJob(job, instrumenter);
+
+			std::lock_guard<std::mutex> lock(outputMutex);
+			if (!res.m_isSucceeded)
+			{
+				++numFailed;
+				std::cerr << "ERROR: " << job.m_input.string() << ": "
+					<< res.m_errMsg << std::endl;
+			}
+			if (timingFile != nullptr)
+			{
+				std::string line = JobResultToJsonLine(job, res);
+				line.push_back('\n');
+				fwrite(line.data(), 1, line.size(), timingFile);
+			}
+		}
+	);
+
+	if ((timingFile != nullptr) && (timingFile != stdout))
+	{
+		fclose(timingFile);
+	}
+
+	return (numFailed > 0) ? 1 : 0;
+}
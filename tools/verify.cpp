@@ -0,0 +1,843 @@
+// Copyright (c) 2022 Haofan Zheng
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <DecentWasmWat/WasmWat.h>
+
+#include <DecentWasmCounter/DecentWasmCounter.hpp>
+
+#include <src/error.h>
+#include <src/feature.h>
+#include <src/interp/binary-reader-interp.h>
+#include <src/interp/interp.h>
+#include <src/result.h>
+
+#include "WasmBinary.hpp"
+
+namespace DecentWasmCounterTool
+{
+
+/**
+ * @brief The cost model used for verification; every instruction emitted by
+ *        the generator has a non-zero weight, except the block-like ones,
+ *        whose weights are charged after their `end`, and thus are skipped
+ *        by design when a branch leaves them
+*/
+inline DecentWasmCounter::CostModel GetVerifyCostModel()
+{
+	DecentWasmCounter::CostModel model;
+	model.m_exprTypeWeights = {
+		{ "Binary",   1 },
+		{ "Compare",  2 },
+		{ "Const",    1 },
+		{ "LocalGet", 1 },
+		{ "LocalSet", 1 },
+		{ "LocalTee", 1 },
+		{ "Call",     2 },
+		{ "Br",       3 },
+		{ "BrIf",     3 },
+		{ "Return",   3 },
+	};
+	model.m_defaultExprWeight = 0;
+	return model;
+}
+
+inline uint64_t GetVerifyWeight(
+	const DecentWasmCounter::CostModel& model,
+	const std::string& exprTypeName)
+{
+	auto it = model.m_exprTypeWeights.find(exprTypeName);
+	return it != model.m_exprTypeWeights.cend() ?
+		it->second : model.m_defaultExprWeight;
+}
+
+enum class StmtKind
+{
+	Arith,  // $x = $x <op> imm
+	BrIf,   // br_if to an enclosing block, if ($x & imm) != 0
+	Br,     // br to an enclosing block
+	Return,
+	Call,   // $x = $leaf($x)
+	Block,
+	Loop,   // runs its body imm times
+	If,     // if ($x & 1) != 0
+}; // enum class StmtKind
+
+/**
+ * @brief A statement of the generated `run` function; blocks are targeted by
+ *        their IDs, so a statement can be moved while minimizing, as long as
+ *        its targets still enclose it
+*/
+struct Stmt
+{
+	StmtKind m_kind;
+	uint32_t m_id;
+	uint32_t m_imm;
+	uint32_t m_target;
+	std::vector<Stmt> m_body;
+	std::vector<Stmt> m_else;
+}; // struct Stmt
+
+using Program = std::vector<Stmt>;
+
+struct GenerateConfig
+{
+	GenerateConfig() :
+		m_maxDepth(4),
+		m_maxStmts(6)
+	{}
+
+	size_t m_maxDepth;
+	// Maximum number of statements in each list
+	size_t m_maxStmts;
+}; // struct GenerateConfig
+
+inline std::vector<Stmt> GenerateStmts(
+	std::mt19937_64& rng,
+	const GenerateConfig& config,
+	size_t depth,
+	std::vector<uint32_t>& blockIds,
+	uint32_t& nextId)
+{
+	auto rand = [&rng](uint32_t n) -> uint32_t
+	{
+		return static_cast<uint32_t>(rng() % n);
+	};
+
+	std::vector<Stmt> stmts;
+	size_t numStmts = rand(static_cast<uint32_t>(config.m_maxStmts)) + 1;
+	for (size_t i = 0; i < numStmts; ++i)
+	{
+		Stmt stmt{ StmtKind::Arith, nextId++, rand(7) + 1, 0, {}, {} };
+
+		uint32_t pick = rand(depth < config.m_maxDepth ? 16 : 10);
+		if (pick < 4)
+		{
+			stmt.m_kind = StmtKind::Arith;
+		}
+		else if (pick < 6)
+		{
+			stmt.m_kind = blockIds.empty() ? StmtKind::Arith : StmtKind::BrIf;
+		}
+		else if (pick < 7)
+		{
+			// rarely, so the code after it is not always dead
+			stmt.m_kind = blockIds.empty() ? StmtKind::Arith :
+				(rand(3) == 0 ? StmtKind::Br : StmtKind::Arith);
+		}
+		else if (pick < 8)
+		{
+			stmt.m_kind = (rand(4) == 0) ? StmtKind::Return : StmtKind::Arith;
+		}
+		else if (pick < 10)
+		{
+			stmt.m_kind = StmtKind::Call;
+		}
+		else if (pick < 12)
+		{
+			stmt.m_kind = StmtKind::Block;
+		}
+		else if (pick < 14)
+		{
+			stmt.m_kind = StmtKind::Loop;
+			stmt.m_imm = rand(3) + 1;
+		}
+		else
+		{
+			stmt.m_kind = StmtKind::If;
+		}
+
+		if ((stmt.m_kind == StmtKind::BrIf) || (stmt.m_kind == StmtKind::Br))
+		{
+			stmt.m_target = blockIds[rand(
+				static_cast<uint32_t>(blockIds.size()))];
+		}
+
+		if (stmt.m_kind == StmtKind::Block)
+		{
+			blockIds.push_back(stmt.m_id);
+			stmt.m_body = GenerateStmts(rng, config, depth + 1, blockIds, nextId);
+			blockIds.pop_back();
+		}
+		else if (stmt.m_kind == StmtKind::Loop)
+		{
+			// branches only go forward, so the loop always terminates
+			stmt.m_body = GenerateStmts(rng, config, depth + 1, blockIds, nextId);
+		}
+		else if (stmt.m_kind == StmtKind::If)
+		{
+			stmt.m_body = GenerateStmts(rng, config, depth + 1, blockIds, nextId);
+			if (rand(2) == 0)
+			{
+				stmt.m_else =
+					GenerateStmts(rng, config, depth + 1, blockIds, nextId);
+			}
+		}
+
+		stmts.emplace_back(std::move(stmt));
+	}
+	return stmts;
+}
+
+/**
+ * @brief Write a program as WAT; with the reference trace, each weighted
+ *        instruction is followed (or preceded, if it's a branch) by a call
+ *        adding its weight to the `$ref` global, independent of the
+ *        block-flow graph
+*/
+class WatWriter
+{
+public:
+	WatWriter(const DecentWasmCounter::CostModel& model, bool withRef) :
+		m_model(model),
+		m_withRef(withRef),
+		m_out(),
+		m_blockIds(),
+		m_loopIds(),
+		m_isValid(true)
+	{}
+
+	virtual ~WatWriter() = default;
+
+	/**
+	 * @return false if a branch targets a block that doesn't enclose it
+	 *         (e.g., after a reduction while minimizing)
+	*/
+	bool Write(const Program& prog, std::string& wat)
+	{
+		m_out.clear();
+		m_blockIds.clear();
+		m_loopIds.clear();
+		m_isValid = true;
+
+		std::string body;
+		std::swap(body, m_out);
+		Instr(2, "local.get $n", "LocalGet");
+		Instr(2, "local.set $x", "LocalSet");
+		WriteStmts(prog, 2);
+		std::swap(body, m_out);
+
+		std::string leafBody;
+		std::swap(leafBody, m_out);
+		// odd values are tripled, lowered to a block like the if statements
+		Line(2, "block $even");
+		Instr(3, "local.get $v", "LocalGet");
+		Instr(3, "i32.const 1", "Const");
+		Instr(3, "i32.and", "Binary");
+		Instr(3, "i32.const 0", "Const");
+		Instr(3, "i32.eq", "Compare");
+		Branch(3, "br_if $even", "BrIf");
+		Instr(3, "local.get $v", "LocalGet");
+		Instr(3, "i32.const 3", "Const");
+		Instr(3, "i32.mul", "Binary");
+		Instr(3, "local.set $v", "LocalSet");
+		Line(2, "end");
+		Instr(2, "local.get $v", "LocalGet");
+		std::swap(leafBody, m_out);
+
+		wat = "(module\n"
+			"  (import \"env\" \"decent_wasm_counter_exceed\" "
+				"(func $exceed (param i64)))\n";
+		if (m_withRef)
+		{
+			wat += "  (global $ref (mut i64) (i64.const 0))\n"
+				"  (export \"ref\" (global $ref))\n";
+		}
+		wat += "  (func $leaf (param $v i32) (result i32)\n" + leafBody +
+			"  )\n";
+		wat += "  (func $run (export \"run\") (param $n i32)\n"
+			"    (local $x i32)\n";
+		for (uint32_t id : m_loopIds)
+		{
+			wat += "    (local $c" + std::to_string(id) + " i32)\n";
+		}
+		wat += body + "  )\n";
+		if (m_withRef)
+		{
+			wat += "  (func $ref_add (param $w i64)\n"
+				"    global.get $ref\n"
+				"    local.get $w\n"
+				"    i64.add\n"
+				"    global.set $ref\n"
+				"  )\n";
+		}
+		wat += ")\n";
+
+		return m_isValid;
+	}
+
+private:
+
+	void Line(size_t indent, const std::string& text)
+	{
+		m_out += std::string(indent * 2, ' ') + text + '\n';
+	}
+
+	void RefCharge(size_t indent, uint64_t weight)
+	{
+		if (m_withRef && (weight > 0))
+		{
+			Line(indent, "i64.const " + std::to_string(weight));
+			Line(indent, "call $ref_add");
+		}
+	}
+
+	void Instr(size_t indent, const std::string& text,
+		const std::string& exprTypeName)
+	{
+		Line(indent, text);
+		RefCharge(indent, GetVerifyWeight(m_model, exprTypeName));
+	}
+
+	void Branch(size_t indent, const std::string& text,
+		const std::string& exprTypeName)
+	{
+		// charged before the control leaves
+		RefCharge(indent, GetVerifyWeight(m_model, exprTypeName));
+		Line(indent, text);
+	}
+
+	bool IsTargetValid(uint32_t target) const
+	{
+		for (uint32_t id : m_blockIds)
+		{
+			if (id == target)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void WriteStmts(const std::vector<Stmt>& stmts, size_t indent)
+	{
+		for (const Stmt& stmt : stmts)
+		{
+			WriteStmt(stmt, indent);
+		}
+	}
+
+	void WriteStmt(const Stmt& stmt, size_t indent)
+	{
+		static const char* const sk_ops[] = { "i32.add", "i32.mul", "i32.xor" };
+
+		std::string imm = std::to_string(stmt.m_imm);
+		std::string id = std::to_string(stmt.m_id);
+		switch (stmt.m_kind)
+		{
+		case StmtKind::Arith:
+			Instr(indent, "local.get $x", "LocalGet");
+			Instr(indent, "i32.const " + imm, "Const");
+			Instr(indent, sk_ops[stmt.m_id % 3], "Binary");
+			Instr(indent, "local.set $x", "LocalSet");
+			break;
+		case StmtKind::BrIf:
+			m_isValid = m_isValid && IsTargetValid(stmt.m_target);
+			Instr(indent, "local.get $x", "LocalGet");
+			Instr(indent, "i32.const " + imm, "Const");
+			Instr(indent, "i32.and", "Binary");
+			Instr(indent, "i32.const 0", "Const");
+			Instr(indent, "i32.ne", "Compare");
+			Branch(indent, "br_if $b" + std::to_string(stmt.m_target), "BrIf");
+			break;
+		case StmtKind::Br:
+			m_isValid = m_isValid && IsTargetValid(stmt.m_target);
+			Branch(indent, "br $b" + std::to_string(stmt.m_target), "Br");
+			break;
+		case StmtKind::Return:
+			Branch(indent, "return", "Return");
+			break;
+		case StmtKind::Call:
+			Instr(indent, "local.get $x", "LocalGet");
+			Instr(indent, "call $leaf", "Call");
+			Instr(indent, "local.set $x", "LocalSet");
+			break;
+		case StmtKind::Block:
+			Line(indent, "block $b" + id);
+			m_blockIds.push_back(stmt.m_id);
+			WriteStmts(stmt.m_body, indent + 1);
+			m_blockIds.pop_back();
+			Line(indent, "end");
+			break;
+		case StmtKind::Loop:
+			m_loopIds.push_back(stmt.m_id);
+			Instr(indent, "i32.const " + imm, "Const");
+			Instr(indent, "local.set $c" + id, "LocalSet");
+			Line(indent, "loop $l" + id);
+			WriteStmts(stmt.m_body, indent + 1);
+			Instr(indent + 1, "local.get $c" + id, "LocalGet");
+			Instr(indent + 1, "i32.const 1", "Const");
+			Instr(indent + 1, "i32.sub", "Binary");
+			Instr(indent + 1, "local.tee $c" + id, "LocalTee");
+			Branch(indent + 1, "br_if $l" + id, "BrIf");
+			Line(indent, "end");
+			break;
+		case StmtKind::If:
+			// `if` is not supported by the instrumentation, so it's written
+			// with a pair of blocks, which is how compilers lower it anyway
+			Line(indent, "block $i" + id);
+			Line(indent + 1, "block $e" + id);
+			Instr(indent + 2, "local.get $x", "LocalGet");
+			Instr(indent + 2, "i32.const 1", "Const");
+			Instr(indent + 2, "i32.and", "Binary");
+			Instr(indent + 2, "i32.const 0", "Const");
+			Instr(indent + 2, "i32.eq", "Compare");
+			Branch(indent + 2, "br_if $e" + id, "BrIf");
+			WriteStmts(stmt.m_body, indent + 2);
+			Branch(indent + 2, "br $i" + id, "Br");
+			Line(indent + 1, "end");
+			WriteStmts(stmt.m_else, indent + 1);
+			Line(indent, "end");
+			break;
+		}
+	}
+
+	const DecentWasmCounter::CostModel& m_model;
+	bool m_withRef;
+	std::string m_out;
+	std::vector<uint32_t> m_blockIds;
+	std::vector<uint32_t> m_loopIds;
+	bool m_isValid;
+}; // class WatWriter
+
+/**
+ * @brief Run `run` in the WABT interpreter once per input, each time in a
+ *        new instance, and read the given i64 global afterwards
+ *
+ * @param thrName Export name of the threshold global, which is set to the
+ *                maximum before each run; ignored if empty
+*/
+inline std::vector<uint64_t> RunInInterp(
+	const std::vector<uint8_t>& wasm,
+	const std::vector<uint32_t>& inputs,
+	const std::string& globalName,
+	const std::string& thrName)
+{
+	wabt::Features features;
+	wabt::ReadBinaryOptions options(features, nullptr,
+		false, // read debug names
+		true,  // stop on first error
+		true   // fail on custom section error
+	);
+	wabt::Errors errors;
+	wabt::interp::ModuleDesc modDesc;
+	if (!wabt::Succeeded(wabt::interp::ReadBinaryInterp("verify.wasm",
+		wasm.data(), wasm.size(), options, &errors, &modDesc)))
+	{
+		throw std::runtime_error("Failed to load the module");
+	}
+
+	std::vector<uint64_t> res;
+	for (uint32_t input : inputs)
+	{
+		wabt::interp::Store store(features);
+		auto interpMod = wabt::interp::Module::New(store, modDesc);
+
+		// the exceed notification is ignored, since the threshold is never
+		// reached
+		wabt::interp::RefVec imports;
+		for (size_t i = 0; i < interpMod->desc().imports.size(); ++i)
+		{
+			auto hostFunc = wabt::interp::HostFunc::New(store,
+				wabt::interp::FuncType({ wabt::Type::I64 }, {}),
+				[](wabt::interp::Thread&, const wabt::interp::Values&,
+					wabt::interp::Values&, wabt::interp::Trap::Ptr*)
+				{
+					return wabt::Result::Ok;
+				}
+			);
+			imports.push_back(hostFunc.ref());
+		}
+
+		wabt::interp::Trap::Ptr trap;
+		auto instance = wabt::interp::Instance::Instantiate(
+			store, interpMod.ref(), imports, &trap);
+		if (!instance)
+		{
+			throw std::runtime_error("Failed to instantiate the module");
+		}
+
+		wabt::interp::Func::Ptr runFunc;
+		wabt::interp::Global::Ptr global;
+		const auto& exports = interpMod->desc().exports;
+		for (size_t i = 0; i < exports.size(); ++i)
+		{
+			const std::string& name = exports[i].type.name;
+			if (name == "run")
+			{
+				runFunc = store.UnsafeGet<wabt::interp::Func>(
+					instance->exports()[i]);
+			}
+			else if (name == globalName)
+			{
+				global = store.UnsafeGet<wabt::interp::Global>(
+					instance->exports()[i]);
+			}
+			else if (!thrName.empty() && (name == thrName))
+			{
+				store.UnsafeGet<wabt::interp::Global>(instance->exports()[i])->
+					UnsafeSet(wabt::interp::Value::Make(static_cast<uint64_t>(
+						std::numeric_limits<int64_t>::max())));
+			}
+		}
+		if (!runFunc || !global)
+		{
+			throw std::runtime_error("The module doesn't export run or " +
+				globalName);
+		}
+
+		wabt::interp::Values params = { wabt::interp::Value::Make(input) };
+		wabt::interp::Values results;
+		if (!wabt::Succeeded(runFunc->Call(store, params, results, &trap)))
+		{
+			throw std::runtime_error("The module trapped");
+		}
+
+		res.push_back(global->Get().Get<uint64_t>());
+	}
+	return res;
+}
+
+struct VerifyMode
+{
+	std::string m_name;
+	DecentWasmCounter::InstrumentConfig m_config;
+	// The count may be higher than the reference, as documented
+	// (e.g., leaf function summaries charge the most expensive path)
+	bool m_isOverApprox;
+}; // struct VerifyMode
+
+inline std::vector<VerifyMode> GetVerifyModes()
+{
+	DecentWasmCounter::InstrumentConfig base;
+	base.m_costModels = { GetVerifyCostModel() };
+	base.m_counterExportName = "ctr";
+	base.m_thresholdExportName = "thr";
+
+	std::vector<VerifyMode> modes;
+	modes.push_back(VerifyMode{ "default", base, false });
+
+	modes.push_back(VerifyMode{ "prune-unreachable", base, false });
+	modes.back().m_config.m_pruneUnreachableCode = true;
+
+	modes.push_back(VerifyMode{ "trap-on-exceed", base, false });
+	modes.back().m_config.m_exceedPolicy =
+		DecentWasmCounter::ExceedPolicy::Trap;
+
+	modes.push_back(VerifyMode{ "merge-blocks", base, false });
+	modes.back().m_config.m_mergeEquivalentBlocks = true;
+
+	modes.push_back(VerifyMode{ "incr-thunks", base, false });
+	modes.back().m_config.m_maxIncrThunks = 4;
+
+	modes.push_back(VerifyMode{ "elide-leaf-funcs", base, true });
+	modes.back().m_config.m_elideLeafFuncCounters = true;
+
+	return modes;
+}
+
+/**
+ * @return true if the program is valid, and the count of the instrumented
+ *         module doesn't match the reference trace; the reason is written
+ *         to `reason`
+*/
+inline bool IsProgramFailing(
+	const Program& prog,
+	const VerifyMode& mode,
+	const std::vector<uint32_t>& inputs,
+	std::string& reason)
+{
+	const DecentWasmCounter::CostModel& model =
+		mode.m_config.m_costModels[0];
+
+	std::string plainWat;
+	std::string refWat;
+	if (!WatWriter(model, false).Write(prog, plainWat) ||
+		!WatWriter(model, true).Write(prog, refWat))
+	{
+		return false;
+	}
+
+	std::vector<uint64_t> refCounts;
+	try
+	{
+		auto refMod = DecentWasmWat::Wat2Mod(
+			"ref.wat", refWat, DecentWasmWat::Wat2WasmConfig());
+		refCounts = RunInInterp(
+			WriteWasmModule(*(refMod.m_ptr)), inputs, "ref", "");
+	}
+	catch (const std::exception&)
+	{
+		// not a valid program
+		return false;
+	}
+
+	std::vector<uint64_t> counts;
+	try
+	{
+		auto mod = DecentWasmWat::Wat2Mod(
+			"verify.wat", plainWat, DecentWasmWat::Wat2WasmConfig());
+		DecentWasmCounter::InstrumentResult res =
+			DecentWasmCounter::TryInstrument(*(mod.m_ptr), mode.m_config);
+		if (!res.IsSuccess())
+		{
+			reason = "Failed to instrument: " + res.m_message;
+			return true;
+		}
+		counts = RunInInterp(
+			WriteWasmModule(*(mod.m_ptr)), inputs, "ctr", "thr");
+	}
+	catch (const std::exception& e)
+	{
+		reason = e.what();
+		return true;
+	}
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		bool isOk = mode.m_isOverApprox ?
+			(counts[i] >= refCounts[i]) :
+			(counts[i] == refCounts[i]);
+		if (!isOk)
+		{
+			reason = "run(" + std::to_string(inputs[i]) + ") counted " +
+				std::to_string(counts[i]) + ", while the reference is " +
+				std::to_string(refCounts[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Get the programs that are one step smaller than the given one,
+ *        i.e., with one statement removed, or with one compound statement
+ *        replaced by its body
+*/
+inline void GetReductions(
+	const std::vector<Stmt>& stmts,
+	const std::function<Program(std::vector<Stmt>)>& rebuild,
+	std::vector<Program>& out)
+{
+	for (size_t i = 0; i < stmts.size(); ++i)
+	{
+		std::vector<Stmt> removed = stmts;
+		removed.erase(removed.begin() + i);
+		out.push_back(rebuild(std::move(removed)));
+
+		const Stmt& stmt = stmts[i];
+		if (!stmt.m_body.empty() || !stmt.m_else.empty())
+		{
+			std::vector<Stmt> flattened(stmts.begin(), stmts.begin() + i);
+			flattened.insert(flattened.end(),
+				stmt.m_body.begin(), stmt.m_body.end());
+			flattened.insert(flattened.end(),
+				stmt.m_else.begin(), stmt.m_else.end());
+			flattened.insert(flattened.end(),
+				stmts.begin() + i + 1, stmts.end());
+			out.push_back(rebuild(std::move(flattened)));
+		}
+
+		// reductions inside the compound statement
+		for (bool isElse : { false, true })
+		{
+			const std::vector<Stmt>& inner =
+				isElse ? stmt.m_else : stmt.m_body;
+			GetReductions(inner,
+				[&stmts, &rebuild, i, isElse](std::vector<Stmt> newInner)
+				{
+					std::vector<Stmt> newStmts = stmts;
+					(isElse ? newStmts[i].m_else : newStmts[i].m_body) =
+						std::move(newInner);
+					return rebuild(std::move(newStmts));
+				},
+				out);
+		}
+	}
+}
+
+/**
+ * @brief Greedily apply reductions while the program keeps failing
+*/
+inline Program MinimizeProgram(
+	Program prog,
+	const VerifyMode& mode,
+	const std::vector<uint32_t>& inputs,
+	std::string& reason)
+{
+	bool isReduced = true;
+	while (isReduced)
+	{
+		isReduced = false;
+
+		std::vector<Program> candidates;
+		GetReductions(prog,
+			[](std::vector<Stmt> stmts) { return stmts; },
+			candidates);
+		for (Program& candidate : candidates)
+		{
+			std::string candidateReason;
+			if (IsProgramFailing(candidate, mode, inputs, candidateReason))
+			{
+				prog = std::move(candidate);
+				reason = std::move(candidateReason);
+				isReduced = true;
+				break;
+			}
+		}
+	}
+	return prog;
+}
+
+struct VerifyConfig
+{
+	VerifyConfig() :
+		m_seed(1),
+		m_numModules(200),
+		m_genConfig()
+	{}
+
+	uint64_t m_seed;
+	size_t m_numModules;
+	GenerateConfig m_genConfig;
+}; // struct VerifyConfig
+
+inline void PrintUsage(const char* prog)
+{
+	std::cerr <<
+		"Usage: " << prog << " [options]\n"
+		"\n"
+		"Generate random modules with nested blocks, loops, and branches,\n"
+		"and check that the count of each instrumentation mode matches a\n"
+		"reference trace charging every instruction in the WABT\n"
+		"interpreter. Failing modules are minimized and printed.\n"
+		"\n"
+		"Options:\n"
+		"  --seed <N>                  Seed of the first module (default: 1)\n"
+		"  --count <N>                 Number of modules (default: 200)\n"
+		"  --max-depth <N>             Maximum nesting depth (default: 4)\n"
+		"  --max-stmts <N>             Maximum statements per list\n"
+		"                              (default: 6)\n"
+		"  -h, --help                  Show this message\n";
+}
+
+inline VerifyConfig ParseArgs(int argc, char** argv)
+{
+	VerifyConfig config;
+
+	auto getValue = [&](int& i) -> std::string
+	{
+		if (i + 1 >= argc)
+		{
+			throw std::invalid_argument(
+				std::string("Missing value for ") + argv[i]);
+		}
+		return argv[++i];
+	};
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--seed")
+		{
+			config.m_seed = std::stoull(getValue(i));
+		}
+		else if (arg == "--count")
+		{
+			config.m_numModules = std::stoul(getValue(i));
+		}
+		else if (arg == "--max-depth")
+		{
+			config.m_genConfig.m_maxDepth = std::stoul(getValue(i));
+		}
+		else if (arg == "--max-stmts")
+		{
+			config.m_genConfig.m_maxStmts = std::stoul(getValue(i));
+		}
+		else if (arg == "-h" || arg == "--help")
+		{
+			PrintUsage(argv[0]);
+			std::exit(0);
+		}
+		else
+		{
+			throw std::invalid_argument("Unknown option " + arg);
+		}
+	}
+
+	if (config.m_genConfig.m_maxStmts == 0)
+	{
+		throw std::invalid_argument("Max statements must be > 0");
+	}
+
+	return config;
+}
+
+} // namespace DecentWasmCounterTool
+
+int main(int argc, char** argv)
+{
+	using namespace DecentWasmCounterTool;
+
+	VerifyConfig config;
+	try
+	{
+		config = ParseArgs(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n\n";
+		PrintUsage(argv[0]);
+		return 2;
+	}
+
+	const std::vector<uint32_t> inputs = { 0, 1, 6, 7, 12345 };
+	const std::vector<VerifyMode> modes = GetVerifyModes();
+
+	size_t numFailed = 0;
+	for (size_t i = 0; i < config.m_numModules; ++i)
+	{
+		uint64_t seed = config.m_seed + i;
+		std::mt19937_64 rng(seed);
+		std::vector<uint32_t> blockIds;
+		uint32_t nextId = 0;
+		Program prog = GenerateStmts(rng, config.m_genConfig, 0,
+			blockIds, nextId);
+
+		for (const VerifyMode& mode : modes)
+		{
+			std::string reason;
+			if (!IsProgramFailing(prog, mode, inputs, reason))
+			{
+				continue;
+			}
+
+			++numFailed;
+			Program minProg = MinimizeProgram(prog, mode, inputs, reason);
+			std::string wat;
+			WatWriter(mode.m_config.m_costModels[0], false).Write(minProg, wat);
+
+			std::cerr << "FAILED: seed " << seed << ", mode " << mode.m_name <<
+				": " << reason << "\n" <<
+				"Minimized module:\n" << wat << std::endl;
+		}
+	}
+
+	std::cerr << config.m_numModules << " modules, " <<
+		modes.size() << " modes, " << numFailed << " failures" << std::endl;
+
+	return numFailed == 0 ? 0 : 1;
+}